@@ -0,0 +1,28 @@
+TEMPLATE = app
+CONFIG += console c++17
+CONFIG -= app_bundle
+CONFIG -= qt
+
+#=====================OpenCV Includes=======================
+
+INCLUDEPATH += C:\AINT308Lib\OpenCV41\release\install\include
+
+LIBS += -LC:\AINT308Lib\OpenCV41\release\lib
+LIBS +=    -lopencv_core411 \
+    -lopencv_highgui411 \
+    -lopencv_imgproc411 \
+    -lopencv_features2d411 \
+    -lopencv_calib3d411 \
+    -lopencv_videoio411 \
+    -lopencv_imgcodecs411 \
+
+#====================Project Includes======================
+SOURCES += \
+    main.cpp \
+    "../Task 4/stereo_engine.cpp"
+
+HEADERS += \
+    ../chessboard_detect.h \
+    ../fnv1a.h \
+    ../rectification.h \
+    "../Task 4/stereo_engine.h"
@@ -0,0 +1,399 @@
+//Benchmark for the vision kernels the tasks depend on, run offline over the captured stereo pairs
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "../rectification.h"
+#include "../chessboard_detect.h"
+#include "../Task 4/stereo_engine.h"
+
+using namespace std;
+using namespace cv;
+
+#define BENCH_DEFAULT_DIR "../Stereo Image Capture/CapturedImages"
+#define BENCH_DEFAULT_SCALES "0.5,1"
+#define BENCH_INTRINSICS "../intrinsics.xml"
+#define BENCH_EXTRINSICS "../extrinsics.xml"
+#define BENCH_BOARD_WIDTH 9         // same board as Stereo Calibration
+#define BENCH_BOARD_HEIGHT 6
+#define BENCH_PIXEL_ROI 64          // Task 1 converts one pixel at a time, it is timed over a square this big
+#define BENCH_TARGET_SIZE 60        // Task 3 template size at 640x480
+#define BENCH_SAD_WINDOW 7          // Task 4 matcher defaults at 640x480
+#define BENCH_NUM_DISPARITIES 144
+
+// one stereo pair at the resolution being benchmarked, with the inputs every kernel starts from
+struct BenchPair {
+    Mat left, right;              // BGR as captured
+    Mat grey_left, grey_right;    // unrectified greyscale, for the chessboard search
+    Mat rect_left, rect_right;    // rectified greyscale, for the stereo matchers
+};
+
+// one implementation of a hot path with fixed parameters. run() processes one pair and returns how many
+// pixels it worked on, so kernels that only look at part of the frame still get a fair ns/pixel
+struct Kernel {
+    string name;
+    string variant;
+    function<double(const BenchPair&)> run;
+};
+
+struct BenchResult {
+    string name, variant;
+    Size size;
+    int runs = 0;
+    double mean_ms = 0, stddev_ms = 0, min_ms = 0, max_ms = 0;
+    double ns_per_pixel = 0, fps = 0;
+};
+
+// kernel results are folded into this so the compiler cannot drop work whose output is unused
+static volatile double bench_sink = 0;
+
+// same conversion as BGRtoHSV in Task 1, one pixel through a 1x1 float matrix
+static Vec3f task1_bgr_to_hsv(const Vec3b& bgr) {
+    Mat3f bgr_mat(static_cast<Vec3f>(bgr));
+    bgr_mat *= 1.0/255.0;
+    Mat3f hsv_mat;
+    cvtColor(bgr_mat, hsv_mat, COLOR_BGR2HSV);
+    return hsv_mat(0,0);
+}
+
+// the parameters below are tuned for 640x480, sizes follow the benchmark resolution
+static int scaled(int value, double scale) {
+    return max(1, int(lround(value*scale)));
+}
+
+// block matchers need an odd window of at least 5 (BM) and a multiple of 16 disparities
+static int window_at(double scale) {
+    return max(5, scaled(BENCH_SAD_WINDOW, scale) | 1);
+}
+
+static int disparities_at(int num_disparities, double scale) {
+    return max(16, int(lround(num_disparities*scale/16))*16);
+}
+
+static vector<double> parse_scales(const string& text) {
+    vector<double> scales;
+    stringstream ss(text);
+    string item;
+    while (getline(ss, item, ',')) {
+        double s = atof(item.c_str());
+        if (s > 0) {
+            scales.push_back(s);
+        }
+    }
+    return scales;
+}
+
+// every leftN.png in the folder with its rightN.png
+static bool load_captured_pairs(const string& dir, size_t limit, vector<StereoPair>& pairs) {
+    vector<String> files;
+    glob(dir + "/left*.png", files, false);
+    sort(files.begin(), files.end());
+    for (const String& left_file : files) {
+        if (limit > 0 && pairs.size() >= limit) {
+            break;
+        }
+        string right_file = left_file;
+        right_file.replace(right_file.rfind("left"), 4, "right");
+        Mat left = imread(left_file, IMREAD_COLOR);
+        Mat right = imread(right_file, IMREAD_COLOR);
+        if (left.empty() || right.empty() || left.size() != right.size()) {
+            cerr << "skipping " << left_file << ", no matching right image" << endl;
+            continue;
+        }
+        pairs.emplace_back(left, right);
+    }
+    return !pairs.empty();
+}
+
+// every kernel variant for one resolution. rect must outlive the kernels
+static vector<Kernel> make_kernels(double scale, const StereoRectification& rect) {
+    vector<Kernel> kernels;
+
+    //==================================================Task 1: BGR to HSV================================================
+    kernels.push_back({"task1_bgr_to_hsv", "per_pixel roi=" + to_string(BENCH_PIXEL_ROI), [](const BenchPair& p) {
+        Rect roi = Rect(p.left.cols/2 - BENCH_PIXEL_ROI/2, p.left.rows/2 - BENCH_PIXEL_ROI/2, BENCH_PIXEL_ROI, BENCH_PIXEL_ROI)
+                   & Rect(0, 0, p.left.cols, p.left.rows);
+        double hue = 0;
+        for (int y = roi.y; y < roi.br().y; y++) {
+            for (int x = roi.x; x < roi.br().x; x++) {
+                hue += task1_bgr_to_hsv(p.left.at<Vec3b>(y, x))[0];
+            }
+        }
+        bench_sink = bench_sink + hue;
+        return double(roi.area());
+    }});
+    kernels.push_back({"task1_bgr_to_hsv", "frame float", [](const BenchPair& p) {
+        Mat bgr, hsv;
+        p.left.convertTo(bgr, CV_32F, 1.0/255.0);
+        cvtColor(bgr, hsv, COLOR_BGR2HSV);
+        bench_sink = bench_sink + hsv.at<Vec3f>(0, 0)[0];
+        return double(p.left.total());
+    }});
+
+    //==========================================Task 2: colour threshold + centroid=======================================
+    struct HsvRange { const char* variant; Scalar low, high; };
+    const HsvRange ranges[] = {
+        {"range=narrow", Scalar(0, 100, 50), Scalar(20, 255, 255)},
+        {"range=all", Scalar(0, 0, 0), Scalar(180, 255, 255)},
+    };
+    for (const HsvRange& range : ranges) {
+        Scalar low = range.low, high = range.high;
+        kernels.push_back({"task2_threshold", range.variant, [low, high](const BenchPair& p) {
+            Mat hsv, mask;
+            cvtColor(p.left, hsv, COLOR_BGR2HSV);
+            inRange(hsv, low, high, mask);
+            Moments m = moments(mask, true);
+            bench_sink = bench_sink + m.m00;
+            return double(p.left.total());
+        }});
+    }
+
+    //==========================================Task 3: template match in both eyes======================================
+    struct MatchSetup { int size; int method; const char* method_name; };
+    const MatchSetup setups[] = {
+        {BENCH_TARGET_SIZE/2, TM_SQDIFF_NORMED, "sqdiff_normed"},
+        {BENCH_TARGET_SIZE, TM_SQDIFF_NORMED, "sqdiff_normed"},
+        {BENCH_TARGET_SIZE*3/2, TM_SQDIFF_NORMED, "sqdiff_normed"},
+        {BENCH_TARGET_SIZE, TM_CCOEFF_NORMED, "ccoeff_normed"},
+    };
+    for (const MatchSetup& setup : setups) {
+        int size = scaled(setup.size, scale);
+        int method = setup.method;
+        kernels.push_back({"task3_match", string(setup.method_name) + " template=" + to_string(size),
+                           [size, method](const BenchPair& p) {
+            // target cut from the middle of the left eye, as if it had been selected there
+            Mat target = p.left(Rect(p.left.cols/2 - size/2, p.left.rows/2 - size/2, size, size));
+            Mat l_match, r_match;
+            double l_min, r_min;
+            Point l_loc, r_loc;
+            matchTemplate(p.left, target, l_match, method);
+            matchTemplate(p.right, target, r_match, method);
+            minMaxLoc(l_match, &l_min, nullptr, &l_loc);
+            minMaxLoc(r_match, &r_min, nullptr, &r_loc);
+            bench_sink = bench_sink + l_loc.x + r_loc.x;
+            return double(p.left.total() + p.right.total());
+        }});
+    }
+
+    //========================================Task 4: rectification + block matching=====================================
+    kernels.push_back({"task4_remap", "grey banded", [&rect](const BenchPair& p) {
+        Mat grey_left, grey_right;
+        rectifyPair(p.left, p.right, rect, grey_left, grey_right);
+        bench_sink = bench_sink + grey_left.at<uchar>(0, 0);
+        return double(p.left.total() + p.right.total());
+    }});
+    kernels.push_back({"task4_remap", "colour then grey", [&rect](const BenchPair& p) {
+        Mat grey_left, grey_right, colour_left, colour_right;
+        rectifyPair(p.left, p.right, rect, grey_left, grey_right, &colour_left, &colour_right);
+        bench_sink = bench_sink + grey_left.at<uchar>(0, 0);
+        return double(p.left.total() + p.right.total());
+    }});
+
+    // the matchers keep state between calls, so each kernel owns its engine
+    struct MatcherSetup { const char* engine; int num_disparities; };
+    const MatcherSetup matchers[] = {
+        {"sgbm", BENCH_NUM_DISPARITIES/2},
+        {"sgbm", BENCH_NUM_DISPARITIES},
+        {"sgbm", BENCH_NUM_DISPARITIES*2},
+        {"bm", BENCH_NUM_DISPARITIES},
+    };
+    for (const MatcherSetup& setup : matchers) {
+        int window = window_at(scale);
+        int disparities = disparities_at(setup.num_disparities, scale);
+        Ptr<StereoEngine> engine = string(setup.engine) == "sgbm" ? create_sgbm_engine(window, disparities)
+                                                                  : create_bm_engine(window, disparities);
+        kernels.push_back({"task4_match", engine->name() + " block=" + to_string(window) + " disparities=" + to_string(disparities),
+                           [engine](const BenchPair& p) {
+            Mat disp;
+            engine->compute(p.rect_left, p.rect_right, disp);
+            bench_sink = bench_sink + disp.at<short>(disp.rows/2, disp.cols/2);
+            return double(p.rect_left.total());
+        }});
+    }
+
+    //========================================Stereo Calibration: chessboard search======================================
+    Size board(BENCH_BOARD_WIDTH, BENCH_BOARD_HEIGHT);
+    kernels.push_back({"chessboard", "findChessboardCorners full", [board](const BenchPair& p) {
+        // the search StereoCalib ran before the downscaled ladder
+        vector<Point2f> corners;
+        if (findChessboardCorners(p.grey_left, board, corners, CHESS_DETECT_FLAGS)) {
+            cornerSubPix(p.grey_left, corners, Size(CHESS_REFINE_WIN_MAX, CHESS_REFINE_WIN_MAX), Size(-1, -1),
+                         TermCriteria(TermCriteria::COUNT + TermCriteria::EPS, 30, 0.01));
+        }
+        bench_sink = bench_sink + corners.size();
+        return double(p.grey_left.total());
+    }});
+    kernels.push_back({"chessboard", "findChessboard ladder", [board](const BenchPair& p) {
+        vector<Point2f> corners;
+        bench_sink = bench_sink + findChessboard(p.grey_left, board, corners);
+        return double(p.grey_left.total());
+    }});
+    kernels.push_back({"chessboard", "findChessboardDownscaled", [board](const BenchPair& p) {
+        vector<Point2f> corners;
+        bench_sink = bench_sink + findChessboardDownscaled(p.grey_left, board, corners);
+        return double(p.grey_left.total());
+    }});
+    return kernels;
+}
+
+// one warm-up call, then repeats timed calls per pair. ns/pixel uses the pixels the kernel reports, fps is
+// calls per second
+static BenchResult run_kernel(const Kernel& kernel, const vector<BenchPair>& pairs, int repeats) {
+    BenchResult result;
+    result.name = kernel.name;
+    result.variant = kernel.variant;
+    result.size = pairs[0].left.size();
+    kernel.run(pairs[0]);
+
+    double sum = 0, sum_sq = 0, pixels = 0;
+    result.min_ms = DBL_MAX;
+    for (const BenchPair& pair : pairs) {
+        for (int r = 0; r < repeats; r++) {
+            int64 start = getTickCount();
+            double n = kernel.run(pair);
+            double ms = (getTickCount() - start)*1000./getTickFrequency();
+            sum += ms;
+            sum_sq += ms*ms;
+            pixels += n;
+            result.min_ms = min(result.min_ms, ms);
+            result.max_ms = max(result.max_ms, ms);
+            result.runs++;
+        }
+    }
+    result.mean_ms = sum/result.runs;
+    result.stddev_ms = sqrt(max(0., sum_sq/result.runs - result.mean_ms*result.mean_ms));
+    result.ns_per_pixel = pixels > 0 ? sum*1e6/pixels : 0;
+    result.fps = result.mean_ms > 0 ? 1000./result.mean_ms : 0;
+    return result;
+}
+
+static string json_escape(const string& text) {
+    string out;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+static void write_csv(const vector<BenchResult>& results, ostream& out) {
+    out << "kernel,variant,width,height,runs,mean_ms,stddev_ms,min_ms,max_ms,ns_per_pixel,fps\n";
+    out << setprecision(6);
+    for (const BenchResult& r : results) {
+        out << r.name << ",\"" << r.variant << "\"," << r.size.width << "," << r.size.height << "," << r.runs << ","
+            << r.mean_ms << "," << r.stddev_ms << "," << r.min_ms << "," << r.max_ms << ","
+            << r.ns_per_pixel << "," << r.fps << "\n";
+    }
+}
+
+static void write_json(const vector<BenchResult>& results, ostream& out) {
+    out << "[\n" << setprecision(6);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << "  {\"kernel\": \"" << json_escape(r.name) << "\", \"variant\": \"" << json_escape(r.variant)
+            << "\", \"width\": " << r.size.width << ", \"height\": " << r.size.height << ", \"runs\": " << r.runs
+            << ", \"mean_ms\": " << r.mean_ms << ", \"stddev_ms\": " << r.stddev_ms
+            << ", \"min_ms\": " << r.min_ms << ", \"max_ms\": " << r.max_ms
+            << ", \"ns_per_pixel\": " << r.ns_per_pixel << ", \"fps\": " << r.fps << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+int main(int argc, char** argv) {
+    CommandLineParser parser(argc, argv, "{dir|" BENCH_DEFAULT_DIR "|folder holding the leftN.png/rightN.png pairs}"
+                                         "{scales|" BENCH_DEFAULT_SCALES "|comma separated resolutions relative to the captures}"
+                                         "{repeats|3|timed runs per kernel and pair, after one warm-up run}"
+                                         "{limit|0|use at most this many pairs, 0 for all}"
+                                         "{kernel||only run kernels whose name contains this}"
+                                         "{json||write JSON instead of CSV}"
+                                         "{out||write the results to this file instead of stdout}"
+                                         "{help||}");
+    if (parser.has("help")) {
+        cout << "Usage:\n ./Benchmark [-dir=<captured images>] [-scales=0.5,1,2] [-repeats=3] [-limit=<pairs>]"
+                " [-kernel=<name>] [-json] [-out=<file>]\n"
+                "Times every kernel variant on every pair at every scale and prints one row per variant and scale:\n"
+                "mean/stddev/min/max ms per call, ns per pixel processed and calls per second.\n" << endl;
+        return 0;
+    }
+    string dir = parser.get<string>("dir");
+    vector<double> scales = parse_scales(parser.get<string>("scales"));
+    int repeats = max(1, parser.get<int>("repeats"));
+    size_t limit = size_t(max(0, parser.get<int>("limit")));
+    string only = parser.has("kernel") ? parser.get<string>("kernel") : "";
+    bool json = parser.has("json");
+    string out_path = parser.has("out") ? parser.get<string>("out") : "";
+    if (!parser.check()) {
+        parser.printErrors();
+        return -1;
+    }
+
+    vector<StereoPair> captured;
+    if (!load_captured_pairs(dir, limit, captured)) {
+        cerr << "no stereo pairs found in " << dir << endl;
+        return -1;
+    }
+    cerr << "benchmarking on " << captured.size() << " pairs" << endl;
+
+    vector<BenchResult> results;
+    Size native = captured[0].first.size();
+    for (double scale : scales) {
+        Size size(scaled(native.width, scale), scaled(native.height, scale));
+        // maps computed for this scale, the cache Task 4 shares stays at its own size
+        StereoRectification rect;
+        if (!loadRectification(BENCH_INTRINSICS, BENCH_EXTRINSICS, size, rect, false, native)) {
+            return -1;
+        }
+
+        // every kernel sees exactly the same resized images
+        vector<BenchPair> pairs(captured.size());
+        for (size_t i = 0; i < captured.size(); i++) {
+            BenchPair& p = pairs[i];
+            int interpolation = scale < 1 ? INTER_AREA : INTER_LINEAR;
+            resize(captured[i].first, p.left, size, 0, 0, interpolation);
+            resize(captured[i].second, p.right, size, 0, 0, interpolation);
+            cvtColor(p.left, p.grey_left, COLOR_BGR2GRAY);
+            cvtColor(p.right, p.grey_right, COLOR_BGR2GRAY);
+            rectifyPair(p.left, p.right, rect, p.rect_left, p.rect_right);
+        }
+
+        for (const Kernel& kernel : make_kernels(scale, rect)) {
+            if (!only.empty() && kernel.name.find(only) == string::npos) {
+                continue;
+            }
+            cerr << size.width << "x" << size.height << " " << kernel.name << " (" << kernel.variant << ")" << endl;
+            results.push_back(run_kernel(kernel, pairs, repeats));
+        }
+    }
+
+    ofstream file;
+    if (!out_path.empty()) {
+        file.open(out_path);
+        if (!file.is_open()) {
+            cerr << "cannot write " << out_path << endl;
+            return -1;
+        }
+    }
+    ostream& out = out_path.empty() ? cout : file;
+    if (json) {
+        write_json(results, out);
+    } else {
+        write_csv(results, out);
+    }
+    return 0;
+}
@@ -0,0 +1,26 @@
+TEMPLATE = app
+CONFIG += console c++17
+CONFIG -= app_bundle
+CONFIG -= qt
+
+#=====================OpenCV Includes=======================
+INCLUDEPATH += C:\AINT308Lib\OpenCV41\release\install\include
+
+LIBS += -LC:\AINT308Lib\OpenCV41\release\lib
+LIBS +=    -lopencv_core411 \
+    -lopencv_highgui411 \
+    -lopencv_imgproc411 \
+    -lopencv_videoio411 \
+
+LIBS += -lws2_32
+
+SOURCES += \
+    main.cpp \
+    "..\Task 2\hsv_config.cpp"
+
+HEADERS += \
+    ..\owl.h \
+    ..\owl_fleet.h \
+    ..\frame_pool.h \
+    ..\stream_stats.h \
+    "..\Task 2\hsv_config.h"
@@ -0,0 +1,151 @@
+//Owl fleet: Task 2's colour tracking on several owls from one process, sharing one servo event loop and one
+//worker pool. with OwlSimulators on consecutive ports, e.g. -port=12345 -streamport=8080, -port=12346
+//-streamport=8081 and so on, ./OwlFleet -owls=N tracks with all of them
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../owl_fleet.h"
+#include "../Task 2/hsv_config.h"
+
+#define FRAME_CENTER_X 320
+#define FRAME_CENTER_Y 240
+#define MOVE_FACTOR_X 0.25f
+#define MOVE_FACTOR_Y 0.25f
+#define MOVE_FACTOR_NECK MOVE_FACTOR_X/2
+
+static std::atomic<bool> interrupted(false);
+
+static void onInterrupt(int)
+{
+    interrupted = true;
+}
+
+//host:servoport:streamport, the ports fall back to the owl's own
+static bool parseOwl(const string& text, OwlConfig& config)
+{
+    std::istringstream in(text);
+    string port;
+    if(!std::getline(in, config.host, ':') || config.host.empty())
+        return false;
+    if(std::getline(in, port, ':'))
+        config.servoPort = stoi(port);
+    if(std::getline(in, port, ':'))
+        config.streamPort = stoi(port);
+    return true;
+}
+
+//the threshold, centroid and control steps of Task 2, on the left eye
+static void trackColour(robotOwl& owl, const HSVConfig& range, Mat& left)
+{
+    Mat hsvLeft, filteredLeft;
+    cvtColor(left, hsvLeft, COLOR_BGR2HSV);
+    inRange(hsvLeft, Scalar(range.lh, range.ls, range.lv), Scalar(range.hh, range.hs, range.hv), filteredLeft);
+    Moments m = moments(filteredLeft, true);
+    if(m.m00 <= 0)
+        return;
+    Point center(int(m.m10/m.m00), int(m.m01/m.m00));
+
+    int xr, yr, xl, yl, neck;
+    owl.getRelativeServoPositions(xr, yr, xl, yl, neck);
+    int xMove = int((center.x - FRAME_CENTER_X)*MOVE_FACTOR_X);
+    int yMove = int((center.y - FRAME_CENTER_Y)*MOVE_FACTOR_Y);
+    int neckMove = (xl < 50) && (xl > -50) ? 0 : int(xl*MOVE_FACTOR_NECK);
+    owl.setServoRelativePositions(0, 0, xMove, -yMove, neckMove);
+}
+
+int main(int argc, char** argv)
+{
+    CommandLineParser parser(argc, argv, "{owls|2|owls at consecutive ports from -host, -port and -streamport}"
+                                         "{host|127.0.0.1|address of the first owl}"
+                                         "{port|12345|servo port of the first owl}"
+                                         "{streamport|8080|camera stream port of the first owl}"
+                                         "{list||comma separated host:servoport:streamport, instead of -owls}"
+                                         "{workers|0|threads decoding and tracking, 0 for one per core}"
+                                         "{seconds|0|stop after this long, 0 runs until ctrl-c}"
+                                         "{report|5|seconds between reports}"
+                                         "{hsv|" HSV_CONFIG_FILEPATH "|colour range saved by Task 2}"
+                                         "{help||}");
+    if(parser.has("help"))
+    {
+        cout<<"Usage:\n ./OwlFleet [-owls=2] [-host=127.0.0.1] [-port=12345] [-streamport=8080] [-workers=0] [-seconds=0]\n"
+              " ./OwlFleet -list=10.0.0.10,10.0.0.11:12345:8080\n"<<endl;
+        return 0;
+    }
+    int count = parser.get<int>("owls");
+    string host = parser.get<string>("host");
+    int port = parser.get<int>("port");
+    int streamPort = parser.get<int>("streamport");
+    string list = parser.has("list") ? parser.get<string>("list") : "";
+    unsigned workers = unsigned(max(0, parser.get<int>("workers")));
+    double seconds = parser.get<double>("seconds");
+    double reportSeconds = max(1., parser.get<double>("report"));
+    string hsvPath = parser.get<string>("hsv");
+    if(!parser.check())
+    {
+        parser.printErrors();
+        return -1;
+    }
+
+    std::vector<OwlConfig> configs;
+    if(!list.empty())
+    {
+        std::istringstream in(list);
+        string item;
+        while(std::getline(in, item, ','))
+        {
+            OwlConfig config;
+            if(!parseOwl(item, config))
+            {
+                cout<<"Could not read owl \""<<item<<"\", expected host[:servoport[:streamport]]"<<endl;
+                return -1;
+            }
+            configs.push_back(config);
+        }
+    }
+    else
+        for(int i = 0; i < count; i++)
+        {
+            OwlConfig config;
+            config.host = host;
+            config.servoPort = port + i;
+            config.streamPort = streamPort + i;
+            configs.push_back(config);
+        }
+
+    HSVConfig range = loadConfig(hsvPath.c_str());
+    int centres[OWL_CALIB_ITEMS] = {1500, 1475, 1520, 1525, 1520};
+
+    OwlFleet fleet(workers);
+    for(const OwlConfig& config : configs)
+        fleet.add(config, centres, [&range](robotOwl& owl, int, Mat& left, Mat&) {
+            trackColour(owl, range, left);
+        });
+    cout<<"Tracking with "<<fleet.size()<<" owls on "<<fleet.workers()<<" workers"<<endl;
+
+    signal(SIGINT, onInterrupt);
+    fleet.start();
+    auto begin = std::chrono::steady_clock::now();
+    auto lastReport = begin;
+    while(!interrupted)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        auto now = std::chrono::steady_clock::now();
+        if(seconds > 0 && std::chrono::duration<double>(now - begin).count() >= seconds)
+            break;
+        if(std::chrono::duration<double>(now - lastReport).count() >= reportSeconds)
+        {
+            fleet.report(cout);
+            lastReport = now;
+        }
+    }
+    fleet.stop();
+    fleet.report(cout);
+    return 0;
+}
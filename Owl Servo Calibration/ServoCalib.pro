@@ -20,8 +20,15 @@ LIBS +=    -lopencv_core411 \
 LIBS += -lws2_32
 
 SOURCES += \
-    main.cpp
+    main.cpp \
+    auto_calibration.cpp
 
 HEADERS += \
     ..\owl.h \
+    ..\frame_pool.h \
+    ..\telemetry.h \
+    ..\display_service.h \
+    ..\hud_overlay.h \
+    ..\chessboard_detect.h \
+    auto_calibration.h \
 
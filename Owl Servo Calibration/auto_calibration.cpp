@@ -0,0 +1,168 @@
+#include "auto_calibration.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "../chessboard_detect.h"
+
+static const char* servoNames[ServoAutoCalibration::SERVO_COUNT] = {"neck", "right x", "right y", "left x", "left y"};
+
+ServoAutoCalibration::ServoAutoCalibration()
+{
+    lastTarget[0] = lastTarget[1] = Point2f(-1, -1);
+    for(int i = 0; i < SERVO_COUNT; i++)
+        raw[i] = 0;
+}
+
+void ServoAutoCalibration::start(robotOwl& owl)
+{
+    owl.getRawServoPositions(raw[RIGHT_X], raw[RIGHT_Y], raw[LEFT_X], raw[LEFT_Y], raw[NECK]);
+    running = true;
+    success = false;
+    servo = NECK;
+    phase = PROBE;
+    waitFrames = CALIB_SETTLE_FRAMES;
+    lostFrames = 0;
+    iterations = 0;
+    samples.clear();
+    message = "looking for the target";
+}
+
+void ServoAutoCalibration::cancel()
+{
+    if(running)
+        finish(false, "cancelled");
+}
+
+void ServoAutoCalibration::centres(int calib[OWL_CALIB_ITEMS]) const
+{
+    calib[0] = raw[RIGHT_X];
+    calib[1] = raw[RIGHT_Y];
+    calib[2] = raw[LEFT_X];
+    calib[3] = raw[LEFT_Y];
+    calib[4] = raw[NECK];
+}
+
+bool ServoAutoCalibration::locate(const Mat& image, Point2f& centre) const
+{
+    Mat grey;
+    cvtColor(image, grey, COLOR_BGR2GRAY);
+    std::vector<Point2f> corners;
+    if(!findChessboardDownscaled(grey, Size(CALIB_TARGET_WIDTH, CALIB_TARGET_HEIGHT), corners))
+        return false;
+    Scalar m = mean(corners);
+    centre = Point2f(float(m[0]), float(m[1]));
+    return true;
+}
+
+//pixel error the given servo is responsible for. the same image centre as the crosshair in drawUI
+double ServoAutoCalibration::error(Servo which, const Point2f& left, const Point2f& right, Size imageSize) const
+{
+    Point centre = Point(imageSize.width, imageSize.height)/2;
+    switch(which) {
+        case NECK:    return ((left.x - centre.x) + (right.x - centre.x))/2;
+        case RIGHT_X: return right.x - centre.x;
+        case RIGHT_Y: return right.y - centre.y;
+        case LEFT_X:  return left.x - centre.x;
+        case LEFT_Y:  return left.y - centre.y;
+        default:      return 0;
+    }
+}
+
+void ServoAutoCalibration::move(robotOwl& owl, Servo which, int delta)
+{
+    raw[which] += delta;
+    owl.setServoRawPositions(raw[RIGHT_X], raw[RIGHT_Y], raw[LEFT_X], raw[LEFT_Y], raw[NECK]);
+    waitFrames = CALIB_SETTLE_FRAMES;
+}
+
+void ServoAutoCalibration::nextServo(robotOwl& owl)
+{
+    cout<<servoNames[servo]<<" centred at "<<raw[servo]<<endl;
+    servo = Servo(servo + 1);
+    if(servo == SERVO_COUNT) {
+        finish(true, "done");
+        return;
+    }
+    //re-read in case the operator moved a servo by hand meanwhile
+    owl.getRawServoPositions(raw[RIGHT_X], raw[RIGHT_Y], raw[LEFT_X], raw[LEFT_Y], raw[NECK]);
+    phase = PROBE;
+    iterations = 0;
+}
+
+void ServoAutoCalibration::finish(bool ok, const std::string& why)
+{
+    running = false;
+    success = ok;
+    message = why;
+    cout<<"Servo auto calibration "<<(ok ? "finished" : "failed")<<": "<<why<<endl;
+}
+
+bool ServoAutoCalibration::update(robotOwl& owl, const Mat& left, const Mat& right)
+{
+    if(!running)
+        return false;
+
+    bool found = locate(left, lastTarget[0]) & locate(right, lastTarget[1]);
+    if(!found) {
+        lastTarget[0] = lastTarget[1] = Point2f(-1, -1);
+        samples.clear();
+        if(++lostFrames > CALIB_LOST_FRAMES)
+            finish(false, "target lost, hold the chessboard where both eyes see it");
+        return !running;
+    }
+    lostFrames = 0;
+
+    //let the servo and the stream settle after a move, then average a few measurements
+    if(waitFrames > 0) {
+        waitFrames--;
+        return false;
+    }
+    samples.push_back(error(servo, lastTarget[0], lastTarget[1], left.size()));
+    if(samples.size() < CALIB_MEASURE_FRAMES)
+        return false;
+    double e = 0;
+    for(double s : samples)
+        e += s;
+    e /= samples.size();
+    samples.clear();
+
+    switch(phase) {
+        case PROBE:
+            probeStart = e;
+            move(owl, servo, CALIB_PROBE_STEP);
+            phase = PROBE_RESULT;
+            message = std::string("probing ") + servoNames[servo];
+            return false;
+
+        case PROBE_RESULT:
+            gain = (e - probeStart)/CALIB_PROBE_STEP;
+            if(std::fabs(gain) < 0.05) {
+                finish(false, std::string(servoNames[servo]) + " does not move the target");
+                return true;
+            }
+            phase = CORRECT;
+            //the probe measurement is the first error to correct
+            [[fallthrough]];
+
+        case CORRECT:
+            if(std::fabs(e) <= CALIB_TOLERANCE) {
+                nextServo(owl);
+                return !running;
+            }
+            if(++iterations > CALIB_MAX_ITERATIONS) {
+                finish(false, std::string(servoNames[servo]) + " did not converge");
+                return true;
+            }
+            {
+                int step = int(std::lround(-e/gain));
+                step = std::max(-CALIB_MAX_STEP, std::min(CALIB_MAX_STEP, step));
+                if(step == 0)
+                    step = (e > 0) == (gain > 0) ? -1 : 1;
+                move(owl, servo, step);
+                message = std::string("centring ") + servoNames[servo] + ", " + std::to_string(int(std::lround(e))) + "px off";
+            }
+            return false;
+    }
+    return false;
+}
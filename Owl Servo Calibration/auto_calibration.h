@@ -0,0 +1,72 @@
+#ifndef AUTO_CALIBRATION_H
+#define AUTO_CALIBRATION_H
+
+#include <string>
+#include <vector>
+
+#include "../owl.h"
+
+#define CALIB_TARGET_WIDTH 9        //inner corners of the chessboard used as the target
+#define CALIB_TARGET_HEIGHT 6
+#define CALIB_PROBE_STEP 30         //PWM moved to measure how far the target shifts per unit
+#define CALIB_MAX_STEP 60           //largest correction applied in one go
+#define CALIB_TOLERANCE 1.5         //pixels from the image centre that count as centred
+#define CALIB_SETTLE_FRAMES 4       //frames skipped after a move for the servo and the stream to catch up
+#define CALIB_MEASURE_FRAMES 3      //target positions averaged per measurement
+#define CALIB_MAX_ITERATIONS 15     //corrections per servo before giving up
+#define CALIB_LOST_FRAMES 60        //frames without the target before giving up
+
+//closed loop servo centring against a chessboard held straight in front of the owl. the neck goes first and
+//turns the head until the target sits midway between where the two eyes see it, then each eye servo is
+//driven until the target is on that eye's image centre. every servo starts with a probe move to learn its
+//gain and direction (pixels per PWM), after which corrections are proportional to the remaining error.
+//one update() per camera frame, so the caller keeps drawing and reading keys while it runs.
+class ServoAutoCalibration
+{
+public:
+    enum Servo { NECK, RIGHT_X, RIGHT_Y, LEFT_X, LEFT_Y, SERVO_COUNT };
+
+    ServoAutoCalibration();
+
+    void start(robotOwl& owl);
+    void cancel();
+    bool active() const { return running; }
+    bool succeeded() const { return success; }
+
+    //measure the newest frames and move the servos, returns true on the frame the calibration finishes
+    bool update(robotOwl& owl, const Mat& left, const Mat& right);
+
+    //what it is doing, for the UI
+    const std::string& status() const { return message; }
+    //target centre in each eye from the last frame, negative if not seen
+    Point2f target(int eye) const { return lastTarget[eye]; }
+
+    //centres found, in robotOwl constructor order (RxC RyC LxC LyC NeckC)
+    void centres(int calib[OWL_CALIB_ITEMS]) const;
+
+private:
+    enum Phase { PROBE, PROBE_RESULT, CORRECT };
+
+    bool locate(const Mat& image, Point2f& centre) const;
+    double error(Servo which, const Point2f& left, const Point2f& right, Size imageSize) const;
+    void move(robotOwl& owl, Servo which, int delta);
+    void nextServo(robotOwl& owl);
+    void finish(bool ok, const std::string& why);
+
+    bool running = false;
+    bool success = false;
+    std::string message;
+    Point2f lastTarget[2];
+
+    Servo servo = NECK;
+    Phase phase = PROBE;
+    int waitFrames = 0;
+    int lostFrames = 0;
+    int iterations = 0;
+    std::vector<double> samples;
+    double probeStart = 0;
+    double gain = 0;            //pixels of error per PWM for the current servo
+    int raw[SERVO_COUNT];       //raw positions, in servo order
+};
+
+#endif // AUTO_CALIBRATION_H
@@ -5,29 +5,114 @@
 #include <sys/types.h>
 #include <iostream>
 #include <string>
+#include <cstring>
+#include <chrono>
 
 #include "../owl.h"
+#include "../display_service.h"
+#include "../hud_overlay.h"
+#include "../telemetry.h"
+#include "auto_calibration.h"
 
 using namespace std;
 using namespace cv;
 
-void drawUI(Mat& left, Mat& right, char key);
+//the crosshair and key layout for both eyes, rasterised once. only the box of a key that changes between
+//pressed and released is drawn again
+struct ServoUI
+{
+    HudOverlay left{Size(640, 480)}, right{Size(640, 480)};
+    vector<pair<char, int>> leftKeys, rightKeys;    //key and the id of its element
+};
+
+void buildUI(ServoUI& ui);
+void drawUI(ServoUI& ui, Mat& left, Mat& right, char key);
+void drawAutoCalibration(Mat& left, Mat& right, const ServoAutoCalibration& calibration);
+
+#define AUTO_CALIBRATE_FLAG "-auto"
+#define TELEMETRY_TOOL "servocalib"     //ring name the telemetry viewer is pointed at
+
+static float msSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+}
 
-int main()
+int main(int argc, char** argv)
 {
     //connect with the owl and load calibration values
     robotOwl owl(1495, 1530, 1575, 1430, 1560);
+    DisplayService display(displayHeadless(argc, argv));
+    ServoUI ui;
+    if(!display.headless())
+        buildUI(ui);
+
+    //C centres every servo on a chessboard held straight in front of the owl and saves the result for the other tools
+    ServoAutoCalibration calibration;
+    bool exitWhenCalibrated=false;
+    for(int i=1; i<argc; i++)
+        if(strcmp(argv[i], AUTO_CALIBRATE_FLAG)==0)
+        {
+            calibration.start(owl);
+            exitWhenCalibrated=true;
+        }
+
+    //servo positions every frame, watch them with ./TelemetryViewer servocalib instead of printing them
+    TelemetryWriter telemetry;
+    telemetry.open(TELEMETRY_TOOL, {"capture", "calibrate", "display"});
+    TelemetryRecord record;
 
-    while (true){
+    //kept across frames so every frame lands in the same pooled buffer
+    Mat left, right;
+    for(uint64_t frameId=0; ; frameId++){
         //read the owls camera frames and record the users keypress
-        Mat left, right;
+        auto start = chrono::steady_clock::now();
         owl.getCameraFrames(left, right);
-        char key = waitKey(30);
-        drawUI(left, right, key);
-        imshow("left",left);
-        imshow("right",right);
+        char key = char(display.pollKey());
+        record.stageMs[0] = msSince(start);
+        start = chrono::steady_clock::now();
+
+        bool calibrated = calibration.update(owl, left, right);
+        record.stageMs[1] = msSince(start);
+        start = chrono::steady_clock::now();
+        if(calibrated)
+        {
+            if(calibration.succeeded())
+            {
+                int calib[OWL_CALIB_ITEMS];
+                calibration.centres(calib);
+                owl.setServoCentres(calib[0], calib[1], calib[2], calib[3], calib[4]);
+                if(saveOwlCalibration(OWL_CALIB_FILEPATH, calib))
+                    cout<<"Servo centres=("<<calib[0]<<", "<<calib[1]<<", "<<calib[2]<<", "<<calib[3]<<", "<<calib[4]<<") saved to "<<OWL_CALIB_FILEPATH<<endl;
+            }
+            if(exitWhenCalibrated)
+                return calibration.succeeded() ? 0 : 1;
+        }
+        if(key=='c')
+        {
+            if(calibration.active())
+                calibration.cancel();
+            else
+                calibration.start(owl);
+        }
 
-        //based on the key press, move a servo a set ammount
+        if(!display.headless())
+        {
+            drawUI(ui, left, right, key);
+            drawAutoCalibration(left, right, calibration);
+            display.show("left",left);
+            display.show("right",right);
+        }
+        record.stageMs[2] = msSince(start);
+        record.frameId = frameId;
+        record.timeUs = 0;
+        //how sure the auto calibration is of where the target is, both eyes found it or not
+        record.confidence = calibration.active() ? (calibration.target(0).x >= 0 && calibration.target(1).x >= 0 ? 1.f : 0.f) : -1.f;
+        owl.getRawServoPositions(record.servos[0], record.servos[1], record.servos[2], record.servos[3], record.servos[4]);
+        telemetry.publish(record);
+
+        //based on the key press, move a servo a set ammount. keys are ignored while the auto calibration drives the servos
+        if(calibration.active())
+            continue;
         switch (key){
             case 'i': owl.setServoRelativePositions( 0, 5, 0, 0, 0); break;
             case 'k': owl.setServoRelativePositions( 0,-5, 0, 0, 0); break;
@@ -40,97 +125,86 @@ int main()
             case 'q': owl.setServoRelativePositions( 0, 0, 0, 0,-5); break;
             case 'e': owl.setServoRelativePositions( 0, 0, 0, 0, 5); break;
         }
-
-        //if a key has been pressed, print the new servo positions
-        if(key!=-1)
-        {
-            int Rx, Ry, Lx, Ly, Neck;
-            owl.getRawServoPositions(Rx, Ry, Lx, Ly, Neck);
-            cout<<"Raw servo positions=("<<Rx<<", "<<Ry<<", "<<Lx<<", "<<Ly<<", "<<Neck<<")"<<endl;
-        }
     }
 }
 
-void drawUI(Mat& left, Mat& right, char key)
+//a key box with its letter, drawn thicker while the key is pressed
+static HudDraw keyElement(Rect box, const string& letter, Point textPos)
 {
-    Point cameraCentre = Point(left.size().width, left.size().height)/2;
-    //draw left marker
-    Mat leftMask(left.size(), CV_8U, Scalar(0));
-    circle(leftMask, cameraCentre, 7, Scalar(255), 4);
-    line(leftMask,cameraCentre+Point(7,0), cameraCentre+Point(17,0), Scalar(255), 4);
-    line(leftMask,cameraCentre-Point(7,0), cameraCentre-Point(17,0), Scalar(255), 4);
-    line(leftMask,cameraCentre+Point(0,7), cameraCentre+Point(0,17), Scalar(255), 4);
-    line(leftMask,cameraCentre-Point(0,7), cameraCentre-Point(0,17), Scalar(255), 4);
-
-    //draw left key boxes
-    rectangle(leftMask, Rect(70 ,360,50,50), Scalar(255), (key=='w')?6:4);//border width changes if they key matches the button
-    rectangle(leftMask, Rect(10 ,420,50,50), Scalar(255), (key=='a')?6:4);
-    rectangle(leftMask, Rect(70 ,420,50,50), Scalar(255), (key=='s')?6:4);
-    rectangle(leftMask, Rect(130,420,50,50), Scalar(255), (key=='d')?6:4);
-    rectangle(leftMask, Rect(520,420,50,50), Scalar(255), (key=='q')?6:4);
-    rectangle(leftMask, Rect(580,420,50,50), Scalar(255), (key=='e')?6:4);
-
-    //draw left letters
-    putText(leftMask, "W", Point(77 ,400),  FONT_HERSHEY_SIMPLEX, 1.5, Scalar(255), (key=='w')?6:4);
-    putText(leftMask, "A", Point(21 ,460),  FONT_HERSHEY_SIMPLEX, 1.5, Scalar(255), (key=='a')?6:4);
-    putText(leftMask, "S", Point(79 ,460),  FONT_HERSHEY_SIMPLEX, 1.5, Scalar(255), (key=='s')?6:4);
-    putText(leftMask, "D", Point(138,460),  FONT_HERSHEY_SIMPLEX, 1.5, Scalar(255), (key=='d')?6:4);
-    putText(leftMask, "Q", Point(527 ,460), FONT_HERSHEY_SIMPLEX, 1.5, Scalar(255), (key=='q')?6:4);
-    putText(leftMask, "E", Point(589,460),  FONT_HERSHEY_SIMPLEX, 1.5, Scalar(255), (key=='e')?6:4);
-    putText(leftMask, "Neck", Point(535, 410), FONT_HERSHEY_SIMPLEX, 1.0, Scalar(255), 4);
-
-    //draw right marker
-    Mat rightMask(left.size(), CV_8U, Scalar(0));
-    circle(rightMask, cameraCentre, 7, Scalar(255), 4);
-    line(rightMask,cameraCentre+Point(7,0), cameraCentre+Point(17,0), Scalar(255), 4);
-    line(rightMask,cameraCentre-Point(7,0), cameraCentre-Point(17,0), Scalar(255), 4);
-    line(rightMask,cameraCentre+Point(0,7), cameraCentre+Point(0,17), Scalar(255), 4);
-    line(rightMask,cameraCentre-Point(0,7), cameraCentre-Point(0,17), Scalar(255), 4);
-
-    //draw right key boxes
-    rectangle(rightMask, Rect(70 ,360,50,50), Scalar(255), (key=='i')?6:4);//border width changes if they key matches the button
-    rectangle(rightMask, Rect(10 ,420,50,50), Scalar(255), (key=='j')?6:4);
-    rectangle(rightMask, Rect(70 ,420,50,50), Scalar(255), (key=='k')?6:4);
-    rectangle(rightMask, Rect(130,420,50,50), Scalar(255), (key=='l')?6:4);
-    rectangle(rightMask, Rect(520,420,50,50), Scalar(255), (key=='q')?6:4);
-    rectangle(rightMask, Rect(580,420,50,50), Scalar(255), (key=='e')?6:4);
-
-    //draw right letters
-    putText(rightMask, "I", Point(88 ,400), FONT_HERSHEY_SIMPLEX, 1.5, Scalar(255), (key=='i')?6:4);
-    putText(rightMask, "J", Point(23 ,460), FONT_HERSHEY_SIMPLEX, 1.5, Scalar(255), (key=='j')?6:4);
-    putText(rightMask, "K", Point(79 ,460), FONT_HERSHEY_SIMPLEX, 1.5, Scalar(255), (key=='k')?6:4);
-    putText(rightMask, "L", Point(140,460), FONT_HERSHEY_SIMPLEX, 1.5, Scalar(255), (key=='l')?6:4);
-    putText(rightMask, "Q", Point(527 ,460), FONT_HERSHEY_SIMPLEX, 1.5, Scalar(255), (key=='q')?6:4);
-    putText(rightMask, "E", Point(589,460),  FONT_HERSHEY_SIMPLEX, 1.5, Scalar(255), (key=='e')?6:4);
-    putText(rightMask, "Neck", Point(535, 410), FONT_HERSHEY_SIMPLEX, 1.0, Scalar(255), 4);
-
-
-    //draw in black, then erode, then draw in white. gives everything a black outline
-    left.setTo(Scalar(0,0,0), leftMask);
-    cv::erode(leftMask, leftMask, cv::Mat::ones(3, 3, CV_8U));
-    left.setTo(Scalar(255,255,255), leftMask);
-
-    right.setTo(Scalar(0,0,0), rightMask);
-    cv::erode(rightMask, rightMask, cv::Mat::ones(3, 3, CV_8U));
-    right.setTo(Scalar(255,255,255), rightMask);
-
+    return [=](Mat& mask, int pressed) {
+        rectangle(mask, box, Scalar(255), pressed?6:4);
+        putText(mask, letter, textPos, FONT_HERSHEY_SIMPLEX, 1.5, Scalar(255), pressed?6:4);
+    };
 }
 
+static void drawCrosshair(Mat& mask, int)
+{
+    Point cameraCentre = Point(mask.size().width, mask.size().height)/2;
+    circle(mask, cameraCentre, 7, Scalar(255), 4);
+    line(mask,cameraCentre+Point(7,0), cameraCentre+Point(17,0), Scalar(255), 4);
+    line(mask,cameraCentre-Point(7,0), cameraCentre-Point(17,0), Scalar(255), 4);
+    line(mask,cameraCentre+Point(0,7), cameraCentre+Point(0,17), Scalar(255), 4);
+    line(mask,cameraCentre-Point(0,7), cameraCentre-Point(0,17), Scalar(255), 4);
+}
 
+static void drawNeckLabel(Mat& mask, int)
+{
+    putText(mask, "Neck", Point(535, 410), FONT_HERSHEY_SIMPLEX, 1.0, Scalar(255), 4);
+}
 
+void buildUI(ServoUI& ui)
+{
+    Scalar white(255,255,255);
+
+    //left eye: marker, WASD and the neck keys
+    ui.left.add(drawCrosshair, white, true);
+    ui.leftKeys = {
+        {'w', ui.left.add(keyElement(Rect(70 ,360,50,50), "W", Point(77 ,400)), white, true)},
+        {'a', ui.left.add(keyElement(Rect(10 ,420,50,50), "A", Point(21 ,460)), white, true)},
+        {'s', ui.left.add(keyElement(Rect(70 ,420,50,50), "S", Point(79 ,460)), white, true)},
+        {'d', ui.left.add(keyElement(Rect(130,420,50,50), "D", Point(138,460)), white, true)},
+        {'q', ui.left.add(keyElement(Rect(520,420,50,50), "Q", Point(527,460)), white, true)},
+        {'e', ui.left.add(keyElement(Rect(580,420,50,50), "E", Point(589,460)), white, true)}};
+    ui.left.add(drawNeckLabel, white, true);
+
+    //right eye: marker, IJKL and the neck keys
+    ui.right.add(drawCrosshair, white, true);
+    ui.rightKeys = {
+        {'i', ui.right.add(keyElement(Rect(70 ,360,50,50), "I", Point(88 ,400)), white, true)},
+        {'j', ui.right.add(keyElement(Rect(10 ,420,50,50), "J", Point(23 ,460)), white, true)},
+        {'k', ui.right.add(keyElement(Rect(70 ,420,50,50), "K", Point(79 ,460)), white, true)},
+        {'l', ui.right.add(keyElement(Rect(130,420,50,50), "L", Point(140,460)), white, true)},
+        {'q', ui.right.add(keyElement(Rect(520,420,50,50), "Q", Point(527,460)), white, true)},
+        {'e', ui.right.add(keyElement(Rect(580,420,50,50), "E", Point(589,460)), white, true)}};
+    ui.right.add(drawNeckLabel, white, true);
+}
 
+void drawUI(ServoUI& ui, Mat& left, Mat& right, char key)
+{
+    //border width changes if the key matches the button
+    for(const auto& k : ui.leftKeys)
+        ui.left.setState(k.second, k.first==key);
+    for(const auto& k : ui.rightKeys)
+        ui.right.setState(k.second, k.first==key);
+    ui.left.compose(left);
+    ui.right.compose(right);
+}
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+void drawAutoCalibration(Mat& left, Mat& right, const ServoAutoCalibration& calibration)
+{
+    if(!calibration.active() && calibration.status().empty())
+    {
+        putText(left, "C: auto calibrate", Point(10, 30), FONT_HERSHEY_SIMPLEX, 0.8, Scalar(255,255,255), 2);
+        return;
+    }
+    //mark where the target was found, the crosshair from drawUI shows where it should end up
+    Mat* eyes[2] = {&left, &right};
+    for(int eye=0; eye<2; eye++)
+    {
+        Point2f target = calibration.target(eye);
+        if(target.x >= 0)
+            drawMarker(*eyes[eye], target, Scalar(0,255,255), MARKER_TILTED_CROSS, 20, 2);
+    }
+    string text = string(calibration.active() ? "Auto: " : "Auto calibration ") + calibration.status();
+    putText(left, text, Point(10, 30), FONT_HERSHEY_SIMPLEX, 0.8, Scalar(0,255,255), 2);
+}
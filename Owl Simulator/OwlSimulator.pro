@@ -0,0 +1,29 @@
+TEMPLATE = app
+CONFIG += console c++17
+CONFIG -= app_bundle
+CONFIG -= qt
+
+#=====================OpenCV Includes=======================
+INCLUDEPATH += C:\AINT308Lib\OpenCV41\release\install\include
+
+LIBS += -LC:\AINT308Lib\OpenCV41\release\lib
+LIBS +=    -lopencv_core411 \
+    -lopencv_highgui411 \
+    -lopencv_imgproc411 \
+    -lopencv_videoio411 \
+    -lopencv_imgcodecs411 \
+
+LIBS += -lws2_32
+
+SOURCES += \
+    main.cpp \
+    sim_owl.cpp \
+    sim_server.cpp \
+    tracking_harness.cpp
+
+HEADERS += \
+    ..\owl.h \
+    ..\frame_pool.h \
+    sim_owl.h \
+    sim_server.h \
+    tracking_harness.h
@@ -0,0 +1,107 @@
+//Owl simulator: the servo TCP server and MJPEG camera stream of the owl's Pi, backed by a rendered scene,
+//so the tools can run closed loop without the robot. point a tool at it with OWL_HOST=127.0.0.1
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include "sim_owl.h"
+#include "sim_server.h"
+#include "tracking_harness.h"
+
+int main(int argc, char** argv)
+{
+    CommandLineParser parser(argc, argv, "{host|127.0.0.1|address the servo server and the stream listen on}"
+                                         "{port|12345|servo server port, give each simulator its own to run several}"
+                                         "{streamport|8080|camera stream port}"
+                                         "{fps|30|frames rendered per second}"
+                                         "{slew|3000|servo speed in PWM per second}"
+                                         "{latency|20|one way network delay in ms, applied to servo packets and frames}"
+                                         "{harness||task2 or task3, step the target and report how the tracker copes}"
+                                         "{trials|6|target steps the harness makes}"
+                                         "{step|150|sideways size of a target step in mm}"
+                                         "{distance|800|distance to the target's home position in mm}"
+                                         "{help||}");
+    if(parser.has("help"))
+    {
+        cout<<"Usage:\n ./OwlSimulator [-port=12345] [-streamport=8080] [-fps=30] [-slew=<PWM/s>] [-latency=<ms>] [-harness=task2|task3] [-trials=6] [-step=<mm>]\n"
+              "then start a tool with OWL_HOST=127.0.0.1, e.g. Task2 -headless -track or Task3 -headless -track\n"<<endl;
+        return 0;
+    }
+    string host = parser.get<string>("host");
+    int servoPort = parser.get<int>("port");
+    int streamPort = parser.get<int>("streamport");
+    double fps = max(1., parser.get<double>("fps"));
+    int latency = max(0, parser.get<int>("latency"));
+    string harnessName = parser.has("harness") ? parser.get<string>("harness") : "";
+    if(!parser.check())
+    {
+        parser.printErrors();
+        return -1;
+    }
+
+    //the same centres the tools load, so a straight command looks straight ahead
+    int centres[OWL_CALIB_ITEMS] = {1500, 1500, 1500, 1500, 1500};
+    if(loadOwlCalibration(OWL_CALIB_FILEPATH, centres))
+        cout<<"Servo centres loaded from "<<OWL_CALIB_FILEPATH<<endl;
+    SimulatedOwl owl(centres, parser.get<double>("slew"));
+    Point3d home(0, 0, parser.get<double>("distance"));
+    owl.setTarget(home);
+
+    std::unique_ptr<TrackingHarness> harness;
+    if(harnessName == "task2" || harnessName == "task3")
+        harness.reset(new TrackingHarness(harnessName == "task2" ? TrackingHarness::TASK2 : TrackingHarness::TASK3,
+                                          parser.get<int>("trials"), parser.get<double>("step"), home));
+    else if(!harnessName.empty())
+    {
+        cout<<"Unknown harness "<<harnessName<<", use task2 or task3"<<endl;
+        return -1;
+    }
+
+    WSAData version;
+    if(WSAStartup(MAKEWORD(2,2), &version)!=0)
+    {
+        cout<<"WinSock version is not supported! - "<<WSAGetLastError()<<endl;
+        return -1;
+    }
+    ServoServer servos(owl, latency, [&harness](const int pwm[SIM_SERVOS]) {
+        if(harness)
+            harness->onCommand(pwm);
+    });
+    MjpegServer stream(latency);
+    if(!servos.start(host, servoPort) || !stream.start(host, streamPort))
+    {
+        WSACleanup();
+        return -1;
+    }
+
+    //render at a fixed rate, the stream carries both eyes side by side and mirrored, which robotOwl undoes
+    Mat left, right, eyes, frame;
+    auto period = std::chrono::duration_cast<SimClock::duration>(std::chrono::duration<double>(1./fps));
+    auto next = SimClock::now();
+    auto last = next;
+    while(true)
+    {
+        auto now = SimClock::now();
+        owl.update(std::chrono::duration<double>(now - last).count());
+        last = now;
+
+        owl.render(left, right);
+        hconcat(left, right, eyes);
+        flip(eyes, frame, 1);
+        stream.publish(frame);
+
+        if(harness && !harness->update(owl))
+            break;
+        next += period;
+        std::this_thread::sleep_until(next);
+    }
+
+    servos.stop();
+    stream.stop();
+    WSACleanup();
+    if(harness)
+        harness->report(cout);
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include "sim_owl.h"
+
+#include <algorithm>
+#include <cmath>
+
+static Matx33d rotationY(double angle)
+{
+    double c = std::cos(angle), s = std::sin(angle);
+    return Matx33d(c, 0, s,
+                   0, 1, 0,
+                  -s, 0, c);
+}
+
+//positive tilts the view down, y points down
+static Matx33d rotationX(double angle)
+{
+    double c = std::cos(angle), s = std::sin(angle);
+    return Matx33d(1, 0, 0,
+                   0, c, s,
+                   0,-s, c);
+}
+
+SimulatedOwl::SimulatedOwl(const int centres[OWL_CALIB_ITEMS], double slew) : slew(slew), target(0, 0, 800)
+{
+    for(int i = 0; i < SIM_SERVOS; i++)
+        centre[i] = actual[i] = commanded[i] = centres[i];
+
+    //blocks of colour for the trackers to lock on to the wrong thing with, hues kept away from the
+    //target's magenta so a correct Task 2 range only ever sees the ball
+    RNG rng(321);
+    texture.create(SIM_TEXTURE_H, SIM_TEXTURE_W, CV_8UC3);
+    texture.setTo(Scalar(95, 100, 90));
+    for(int i = 0; i < 600; i++) {
+        Mat colour(1, 1, CV_8UC3, Scalar(rng.uniform(0, 130), rng.uniform(30, 200), rng.uniform(50, 230)));
+        cvtColor(colour, colour, COLOR_HSV2BGR);
+        Rect block(rng.uniform(0, SIM_TEXTURE_W), rng.uniform(0, SIM_TEXTURE_H), rng.uniform(16, 160), rng.uniform(16, 160));
+        rectangle(texture, block, Scalar(colour.at<Vec3b>(0, 0)), FILLED);
+    }
+    for(int x = 0; x < SIM_TEXTURE_W; x += 128)
+        line(texture, Point(x, 0), Point(x, SIM_TEXTURE_H), Scalar(40, 40, 40), 3);
+    for(int y = 0; y < SIM_TEXTURE_H; y += 128)
+        line(texture, Point(0, y), Point(SIM_TEXTURE_W, y), Scalar(40, 40, 40), 3);
+}
+
+void SimulatedOwl::command(const int pwm[SIM_SERVOS])
+{
+    std::lock_guard<std::mutex> lock(commandMutex);
+    for(int i = 0; i < SIM_SERVOS; i++)
+        commanded[i] = pwm[i];
+}
+
+void SimulatedOwl::update(double dt)
+{
+    double goal[SIM_SERVOS];
+    {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        std::copy(commanded, commanded + SIM_SERVOS, goal);
+    }
+    double step = slew*dt;
+    for(int i = 0; i < SIM_SERVOS; i++)
+        actual[i] += std::max(-step, std::min(step, goal[i] - actual[i]));
+}
+
+//camera to world rotation and the eye's position. the eyes sit either side of the neck axis and turn with it
+void SimulatedOwl::eyePose(SimEye eye, Matx33d& rotation, Vec3d& position) const
+{
+    double neck = (centre[SIM_NECK] - actual[SIM_NECK])*SERVO_PWM2RAD;
+    double yaw, pitch;
+    if(eye == SIM_LEFT) {
+        yaw = neck + (actual[SIM_LX] - centre[SIM_LX])*SERVO_PWM2RAD;
+        pitch = (actual[SIM_LY] - centre[SIM_LY])*SERVO_PWM2RAD;
+    }
+    else {
+        yaw = neck + (actual[SIM_RX] - centre[SIM_RX])*SERVO_PWM2RAD;
+        pitch = (centre[SIM_RY] - actual[SIM_RY])*SERVO_PWM2RAD;
+    }
+    rotation = rotationY(yaw)*rotationX(pitch);
+    position = rotationY(neck)*Vec3d(eye == SIM_LEFT ? -SIM_EYE_BASELINE/2 : SIM_EYE_BASELINE/2, 0, 0);
+}
+
+bool SimulatedOwl::project(SimEye eye, const Point3d& point, Point2d& pixel) const
+{
+    Matx33d rotation;
+    Vec3d position;
+    eyePose(eye, rotation, position);
+    Vec3d p = rotation.t()*(Vec3d(point.x, point.y, point.z) - position);
+    if(p[2] < 1)
+        return false;
+    pixel = Point2d(SIM_FRAME_W/2. + SIM_FOCAL*p[0]/p[2], SIM_FRAME_H/2. + SIM_FOCAL*p[1]/p[2]);
+    return true;
+}
+
+void SimulatedOwl::renderEye(SimEye eye, Mat& image) const
+{
+    Matx33d rotation;
+    Vec3d position;
+    eyePose(eye, rotation, position);
+
+    //the wall is a plane, so texture to image is a homography: texture pixel -> wall point relative to the
+    //eye -> camera coordinates -> pixel
+    double scale = SIM_WALL_WIDTH/SIM_TEXTURE_W;
+    Matx33d wall(scale, 0, -SIM_WALL_WIDTH/2 - position[0],
+                 0, scale, -SIM_WALL_HEIGHT/2 - position[1],
+                 0, 0, SIM_WALL_DISTANCE - position[2]);
+    Matx33d camera(SIM_FOCAL, 0, SIM_FRAME_W/2.,
+                   0, SIM_FOCAL, SIM_FRAME_H/2.,
+                   0, 0, 1);
+    warpPerspective(texture, image, Mat(camera*rotation.t()*wall), Size(SIM_FRAME_W, SIM_FRAME_H),
+                    INTER_LINEAR, BORDER_CONSTANT, Scalar(60, 60, 60));
+
+    //the ball, with a dark rim and a highlight so a template of it has some structure
+    Vec3d p = rotation.t()*(Vec3d(target.x, target.y, target.z) - position);
+    if(p[2] < SIM_TARGET_RADIUS)
+        return;
+    double radius = SIM_FOCAL*SIM_TARGET_RADIUS/p[2];
+    Point c(int(std::lround(SIM_FRAME_W/2. + SIM_FOCAL*p[0]/p[2])), int(std::lround(SIM_FRAME_H/2. + SIM_FOCAL*p[1]/p[2])));
+    circle(image, c, int(std::lround(radius)), SIM_TARGET_COLOUR, FILLED, LINE_AA);
+    circle(image, c, int(std::lround(radius)), Scalar(60, 0, 120), 2, LINE_AA);
+    circle(image, c - Point(int(radius*0.35), int(radius*0.35)), int(std::lround(radius*0.3)), Scalar(200, 150, 255), FILLED, LINE_AA);
+}
+
+void SimulatedOwl::render(Mat& left, Mat& right) const
+{
+    renderEye(SIM_LEFT, left);
+    renderEye(SIM_RIGHT, right);
+}
@@ -0,0 +1,61 @@
+#ifndef SIM_OWL_H
+#define SIM_OWL_H
+
+#include <mutex>
+
+#include "../owl.h"
+
+#define SIM_FRAME_W 640
+#define SIM_FRAME_H 480
+#define SIM_FOCAL 500.                          //pixels, close to the owl cameras' field of view
+#define SIM_EYE_BASELINE 67.                    //mm between the eyes, INTER_EYE_DIST in Task 3
+#define SIM_WALL_DISTANCE 2500.                 //mm to the textured wall behind the target
+#define SIM_WALL_WIDTH 8000.
+#define SIM_WALL_HEIGHT 6000.
+#define SIM_TEXTURE_W 2048
+#define SIM_TEXTURE_H 1536
+#define SIM_TARGET_RADIUS 40.                   //mm
+#define SIM_TARGET_COLOUR Scalar(127, 0, 255)   //magenta, inside Task 2's default hsv range
+
+//servos in the order of the TCP packets and owl_calib.txt
+enum SimServo { SIM_RX, SIM_RY, SIM_LX, SIM_LY, SIM_NECK, SIM_SERVOS };
+enum SimEye { SIM_LEFT, SIM_RIGHT };
+
+//the owl's head and eyes as pinhole cameras looking at a ball in front of a textured wall. servo packets set
+//the commanded PWM, update() slews the actual positions towards it at a fixed rate and render() draws what
+//each eye sees from the actual positions. the directions match what the trackers expect of the real owl:
+//Lx and Rx up turn the eyes right, Ly up and Ry down tilt them down, Neck down turns the head right.
+//angles come from the offset to the calibrated centre times SERVO_PWM2RAD, as in robotOwl::getServoAngles.
+//world axes are x right, y down and z forward (mm), with the neck at the origin.
+class SimulatedOwl
+{
+public:
+    SimulatedOwl(const int centres[OWL_CALIB_ITEMS], double slew);
+
+    //a servo packet arrived, called from the servo server's thread
+    void command(const int pwm[SIM_SERVOS]);
+    //move every servo towards its command by at most slew*dt
+    void update(double dt);
+
+    void setTarget(const Point3d& position) { target = position; }
+    Point3d targetPosition() const { return target; }
+
+    //the two eye images, unflipped, as robotOwl::getCameraFrames hands them out
+    void render(Mat& left, Mat& right) const;
+    //where a world point lands in an eye's image, false if it is behind the camera
+    bool project(SimEye eye, const Point3d& point, Point2d& pixel) const;
+
+private:
+    void eyePose(SimEye eye, Matx33d& rotation, Vec3d& position) const;
+    void renderEye(SimEye eye, Mat& image) const;
+
+    double slew;                    //PWM per second
+    double centre[SIM_SERVOS];
+    double actual[SIM_SERVOS];
+    mutable std::mutex commandMutex;
+    double commanded[SIM_SERVOS];
+    Point3d target;
+    Mat texture;
+};
+
+#endif // SIM_OWL_H
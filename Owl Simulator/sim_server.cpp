@@ -0,0 +1,244 @@
+#include "sim_server.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <opencv2/imgcodecs.hpp>
+
+static SOCKET listenOn(const std::string& host, int port)
+{
+    SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(s == INVALID_SOCKET) {
+        cout<<"Failed to create socket "<<WSAGetLastError()<<endl;
+        return s;
+    }
+    //a restarted simulator can take the port straight back
+    char reuse = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(host.c_str());
+    addr.sin_port = htons(u_short(port));
+    if(bind(s, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR || listen(s, 4) == SOCKET_ERROR) {
+        cout<<"Unable to listen on "<<host<<":"<<port<<" "<<WSAGetLastError()<<endl;
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+static bool sendAll(SOCKET s, const char* data, size_t size)
+{
+    while(size > 0) {
+        int n = send(s, data, int(size), 0);
+        if(n == SOCKET_ERROR || n == 0)
+            return false;
+        data += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+//==================================================Servo server=====================================================
+
+ServoServer::ServoServer(SimulatedOwl& owl, int latencyMs, ServoHandler onCommand)
+    : owl(owl), latency(latencyMs), onCommand(onCommand)
+{
+}
+
+bool ServoServer::start(const std::string& host, int port)
+{
+    listener = listenOn(host, port);
+    if(listener == INVALID_SOCKET)
+        return false;
+    running = true;
+    worker = std::thread(&ServoServer::run, this);
+    cout<<"Servo server listening on "<<host<<":"<<port<<endl;
+    return true;
+}
+
+void ServoServer::stop()
+{
+    if(!running.exchange(false))
+        return;
+    //closing the sockets wakes accept and recv
+    closesocket(listener);
+    {
+        std::lock_guard<std::mutex> lock(clientMutex);
+        if(client != INVALID_SOCKET) {
+            closesocket(client);
+            client = INVALID_SOCKET;
+        }
+    }
+    if(worker.joinable())
+        worker.join();
+}
+
+void ServoServer::run()
+{
+    while(running) {
+        SOCKET s = accept(listener, nullptr, nullptr);
+        if(s == INVALID_SOCKET)
+            break;
+        {
+            std::lock_guard<std::mutex> lock(clientMutex);
+            client = s;
+        }
+        cout<<"Servo client connected"<<endl;
+
+        char packet[128];
+        while(running) {
+            int n = recv(s, packet, sizeof(packet) - 1, 0);
+            if(n <= 0)
+                break;
+            packet[n] = 0;
+            std::istringstream in(packet);
+            int pwm[SIM_SERVOS];
+            bool valid = true;
+            for(int i = 0; i < SIM_SERVOS; i++)
+                valid = valid && bool(in >> pwm[i]);
+
+            std::this_thread::sleep_for(latency);
+            if(valid) {
+                owl.command(pwm);
+                if(onCommand)
+                    onCommand(pwm);
+            }
+            else
+                cout<<"Ignoring malformed servo packet \""<<packet<<"\""<<endl;
+            std::this_thread::sleep_for(latency);
+            if(!sendAll(s, "ok", 2))
+                break;
+        }
+
+        std::lock_guard<std::mutex> lock(clientMutex);
+        if(client != INVALID_SOCKET) {
+            closesocket(client);
+            client = INVALID_SOCKET;
+        }
+        cout<<"Servo client disconnected"<<endl;
+    }
+}
+
+//==================================================MJPEG server=====================================================
+
+bool MjpegServer::start(const std::string& host, int port)
+{
+    listener = listenOn(host, port);
+    if(listener == INVALID_SOCKET)
+        return false;
+    running = true;
+    acceptor = std::thread(&MjpegServer::acceptClients, this);
+    cout<<"Camera stream on http://"<<host<<":"<<port<<"/stream/video.mjpeg"<<endl;
+    return true;
+}
+
+void MjpegServer::stop()
+{
+    if(!running.exchange(false))
+        return;
+    closesocket(listener);
+    if(acceptor.joinable())
+        acceptor.join();
+    {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        for(SOCKET s : clientSockets)
+            closesocket(s);
+    }
+    frameReady.notify_all();
+    for(std::thread& t : clients)
+        if(t.joinable())
+            t.join();
+}
+
+void MjpegServer::publish(const Mat& frame)
+{
+    Encoded encoded;
+    encoded.rendered = SimClock::now();
+    encoded.jpeg = std::make_shared<std::vector<uchar>>();
+    imencode(".jpg", frame, *encoded.jpeg, {IMWRITE_JPEG_QUALITY, SIM_JPEG_QUALITY});
+    inFlight.push_back(encoded);
+
+    std::shared_ptr<std::vector<uchar>> arrived;
+    while(!inFlight.empty() && SimClock::now() - inFlight.front().rendered >= latency) {
+        arrived = inFlight.front().jpeg;
+        inFlight.pop_front();
+    }
+    if(!arrived)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        latest = arrived;
+        sequence++;
+    }
+    frameReady.notify_all();
+}
+
+void MjpegServer::acceptClients()
+{
+    while(running) {
+        SOCKET s = accept(listener, nullptr, nullptr);
+        if(s == INVALID_SOCKET)
+            break;
+        std::lock_guard<std::mutex> lock(frameMutex);
+        //reap the clients that have gone, so reconnecting viewers do not pile up threads
+        for(std::thread::id id : finished) {
+            auto done = std::find_if(clients.begin(), clients.end(), [id](const std::thread& t) { return t.get_id() == id; });
+            if(done != clients.end()) {
+                done->join();
+                clients.erase(done);
+            }
+        }
+        finished.clear();
+        clientSockets.push_back(s);
+        clients.emplace_back(&MjpegServer::serve, this, s);
+    }
+}
+
+void MjpegServer::serve(SOCKET s)
+{
+    stream(s);
+    std::lock_guard<std::mutex> lock(frameMutex);
+    //stop() closes whatever is still listed, so only close the socket if it has not got to it yet
+    auto open = std::find(clientSockets.begin(), clientSockets.end(), s);
+    if(open != clientSockets.end()) {
+        clientSockets.erase(open);
+        closesocket(s);
+    }
+    finished.push_back(std::this_thread::get_id());
+}
+
+void MjpegServer::stream(SOCKET s)
+{
+    //any request gets the stream, the path is not checked
+    char request[1024];
+    if(recv(s, request, sizeof(request), 0) <= 0)
+        return;
+    const char* header = "HTTP/1.0 200 OK\r\n"
+                         "Cache-Control: no-cache\r\n"
+                         "Connection: close\r\n"
+                         "Content-Type: multipart/x-mixed-replace; boundary=" SIM_MJPEG_BOUNDARY "\r\n\r\n";
+    if(!sendAll(s, header, strlen(header)))
+        return;
+    cout<<"Camera client connected"<<endl;
+
+    uint64_t sent = 0;
+    while(running) {
+        std::shared_ptr<std::vector<uchar>> jpeg;
+        {
+            std::unique_lock<std::mutex> lock(frameMutex);
+            frameReady.wait(lock, [&]() { return !running || sequence != sent; });
+            if(!running)
+                break;
+            jpeg = latest;
+            sent = sequence;
+        }
+        std::string part = "--" SIM_MJPEG_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: "
+                           + std::to_string(jpeg->size()) + "\r\n\r\n";
+        if(!sendAll(s, part.data(), part.size()) || !sendAll(s, (const char*)jpeg->data(), jpeg->size()) || !sendAll(s, "\r\n", 2))
+            break;
+    }
+    cout<<"Camera client disconnected"<<endl;
+}
@@ -0,0 +1,90 @@
+#ifndef SIM_SERVER_H
+#define SIM_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sim_owl.h"
+
+#define SIM_JPEG_QUALITY 80
+#define SIM_MJPEG_BOUNDARY "owlframe"
+
+typedef std::chrono::steady_clock SimClock;
+
+//called with every servo packet once it has reached the simulated owl
+typedef std::function<void(const int pwm[SIM_SERVOS])> ServoHandler;
+
+//the servo half of the owl's Pi server: "Rx Ry Lx Ly Neck" packets in, "ok" back, one client at a time.
+//like the Pi, each packet is expected to arrive in one piece, robotOwl waits for the reply before sending the
+//next. latency is one way, so a packet takes effect latency after it was sent and the reply comes back
+//another latency later
+class ServoServer
+{
+public:
+    ServoServer(SimulatedOwl& owl, int latencyMs, ServoHandler onCommand);
+    ~ServoServer() { stop(); }
+
+    bool start(const std::string& host, int port);
+    void stop();
+
+private:
+    void run();
+
+    SimulatedOwl& owl;
+    std::chrono::milliseconds latency;
+    ServoHandler onCommand;
+    SOCKET listener = INVALID_SOCKET;
+    SOCKET client = INVALID_SOCKET;
+    std::mutex clientMutex;
+    std::atomic<bool> running{false};
+    std::thread worker;
+};
+
+//the camera half: an HTTP multipart/x-mixed-replace JPEG stream, what VideoCapture opens on the real owl.
+//published frames are held back for latency before any client sees them
+class MjpegServer
+{
+public:
+    explicit MjpegServer(int latencyMs) : latency(latencyMs) {}
+    ~MjpegServer() { stop(); }
+
+    bool start(const std::string& host, int port);
+    void stop();
+
+    //encode a frame and release every frame that has now been in flight for latency, call once per rendered frame
+    void publish(const Mat& frame);
+
+private:
+    struct Encoded
+    {
+        SimClock::time_point rendered;
+        std::shared_ptr<std::vector<uchar>> jpeg;
+    };
+
+    void acceptClients();
+    void serve(SOCKET socket);
+    void stream(SOCKET socket);
+
+    std::chrono::milliseconds latency;
+    std::deque<Encoded> inFlight;   //publishing thread only
+    SOCKET listener = INVALID_SOCKET;
+    std::atomic<bool> running{false};
+    std::thread acceptor;
+
+    std::mutex frameMutex;
+    std::condition_variable frameReady;
+    std::shared_ptr<std::vector<uchar>> latest;
+    uint64_t sequence = 0;
+    std::vector<std::thread> clients;
+    std::vector<SOCKET> clientSockets;          //open client connections, each closed by whoever removes it
+    std::vector<std::thread::id> finished;      //client threads that have returned, joined on the next accept
+};
+
+#endif // SIM_SERVER_H
@@ -0,0 +1,158 @@
+#include "tracking_harness.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+TrackingHarness::TrackingHarness(Tracker tracker, int trials, double step, const Point3d& home)
+    : tracker(tracker), trialCount(trials), stepSize(step), home(home), begin(std::chrono::steady_clock::now())
+{
+    if(tracker == TASK2)
+        signals = {{"left x", SIM_LEFT, false}, {"left y", SIM_LEFT, true}};
+    else
+        signals = {{"left x", SIM_LEFT, false}, {"right x", SIM_RIGHT, false}};
+    std::fill(lastPwm, lastPwm + SIM_SERVOS, 0);
+    std::fill(stepPwm, stepPwm + SIM_SERVOS, 0);
+}
+
+//alternating steps to either side. Task 2 also gets a vertical component, Task 3 a change in depth so the
+//eyes have to change their vergence as well as follow
+Point3d TrackingHarness::trialTarget(int index) const
+{
+    double side = index % 2 == 0 ? 1 : -1;
+    if(tracker == TASK2)
+        return home + Point3d(side*stepSize, side*stepSize/2, 0);
+    double depth = index % 4 < 2 ? -0.25 : 0.25;
+    return home + Point3d(side*stepSize, 0, depth*home.z);
+}
+
+void TrackingHarness::onCommand(const int pwm[SIM_SERVOS])
+{
+    double t = now();
+    std::lock_guard<std::mutex> lock(mutex);
+    connected = true;
+    std::copy(pwm, pwm + SIM_SERVOS, lastPwm);
+    if(trials.empty() || trials.back().latency >= 0)
+        return;
+    if(!std::equal(pwm, pwm + SIM_SERVOS, stepPwm))
+        trials.back().latency = t - trials.back().start;
+}
+
+bool TrackingHarness::update(SimulatedOwl& owl)
+{
+    double t = now();
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!connected)
+        return true;
+    if(warmupStart < 0) {
+        warmupStart = t;
+        owl.setTarget(home);
+        cout<<"Tool connected, holding the target for "<<HARNESS_WARMUP_S<<"s"<<endl;
+    }
+    if(t - warmupStart < HARNESS_WARMUP_S)
+        return true;
+
+    if(trials.empty() || t - trials.back().start >= HARNESS_TRIAL_S) {
+        if(int(trials.size()) == trialCount)
+            return false;
+        Trial trial;
+        trial.start = t;
+        trial.target = trialTarget(int(trials.size()));
+        owl.setTarget(trial.target);
+        std::copy(lastPwm, lastPwm + SIM_SERVOS, stepPwm);
+        trials.push_back(trial);
+        cout<<"Step "<<trials.size()<<"/"<<trialCount<<endl;
+        //the step shows from the next rendered frame on
+        return true;
+    }
+
+    Sample sample;
+    sample.t = t - trials.back().start;
+    for(const Signal& signal : signals) {
+        Point2d pixel;
+        if(!owl.project(signal.eye, owl.targetPosition(), pixel))
+            return true;
+        sample.error.push_back(signal.vertical ? pixel.y - SIM_FRAME_H/2. : pixel.x - SIM_FRAME_W/2.);
+    }
+    trials.back().samples.push_back(sample);
+    return true;
+}
+
+TrackingHarness::Metrics TrackingHarness::evaluate(const Trial& trial, size_t signal) const
+{
+    Metrics m;
+    m.latency = trial.latency;
+    const std::vector<Sample>& samples = trial.samples;
+    if(samples.size() < 4)
+        return m;
+
+    size_t tail = std::max<size_t>(1, size_t(samples.size()*HARNESS_FINAL_FRACTION));
+    for(size_t i = samples.size() - tail; i < samples.size(); i++)
+        m.final += samples[i].error[signal];
+    m.final /= tail;
+
+    double travel = m.final - samples.front().error[signal];
+    m.step = std::fabs(travel);
+    double band = std::max(HARNESS_BAND_PX, HARNESS_BAND_FRACTION*m.step);
+
+    //settled after the last sample outside the band, never if that is the last sample of the trial
+    size_t lastOutside = samples.size();
+    double past = 0;
+    for(size_t i = 0; i < samples.size(); i++) {
+        double offset = samples[i].error[signal] - m.final;
+        if(std::fabs(offset) > band)
+            lastOutside = i;
+        past = std::max(past, travel >= 0 ? offset : -offset);
+    }
+    if(lastOutside == samples.size())
+        m.settling = 0;
+    else if(lastOutside + 1 < samples.size())
+        m.settling = samples[lastOutside + 1].t;
+    m.overshoot = m.step > band ? 100*past/m.step : 0;
+    return m;
+}
+
+void TrackingHarness::report(std::ostream& out) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    out << std::left << std::setw(7) << "step" << std::setw(10) << "axis" << std::right
+        << std::setw(10) << "step px" << std::setw(12) << "latency ms" << std::setw(12) << "settle ms"
+        << std::setw(13) << "overshoot %" << std::setw(10) << "final px" << "\n";
+    out << std::fixed << std::setprecision(1);
+
+    for(size_t s = 0; s < signals.size(); s++) {
+        double latencySum = 0, settleSum = 0, overshootSum = 0;
+        int reacted = 0, settled = 0, evaluated = 0;
+        for(size_t i = 0; i < trials.size(); i++) {
+            Metrics m = evaluate(trials[i], s);
+            out << std::left << std::setw(7) << i + 1 << std::setw(10) << signals[s].name << std::right
+                << std::setw(10) << m.step;
+            if(m.latency >= 0)
+                out << std::setw(12) << m.latency*1000;
+            else
+                out << std::setw(12) << "none";
+            if(m.settling >= 0)
+                out << std::setw(12) << m.settling*1000;
+            else
+                out << std::setw(12) << "unsettled";
+            out << std::setw(13) << m.overshoot << std::setw(10) << m.final << "\n";
+
+            evaluated++;
+            overshootSum += m.overshoot;
+            if(m.latency >= 0) {
+                latencySum += m.latency;
+                reacted++;
+            }
+            if(m.settling >= 0) {
+                settleSum += m.settling;
+                settled++;
+            }
+        }
+        if(evaluated == 0)
+            continue;
+        out << std::left << std::setw(7) << "mean" << std::setw(10) << signals[s].name << std::right << std::setw(10) << ""
+            << std::setw(12) << (reacted ? latencySum*1000/reacted : 0.) << std::setw(12) << (settled ? settleSum*1000/settled : 0.)
+            << std::setw(13) << overshootSum/evaluated << "   " << settled << "/" << evaluated << " settled\n";
+    }
+    out << std::defaultfloat;
+}
@@ -0,0 +1,83 @@
+#ifndef TRACKING_HARNESS_H
+#define TRACKING_HARNESS_H
+
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include "sim_owl.h"
+
+#define HARNESS_WARMUP_S 5.             //target held still while the tool starts, connects and locks on
+#define HARNESS_TRIAL_S 4.              //time each step is given to settle
+#define HARNESS_FINAL_FRACTION 0.25     //tail of a trial averaged for the error it settled at
+#define HARNESS_BAND_PX 4.              //settled once within this of the final error, or 5% of the step if larger
+#define HARNESS_BAND_FRACTION 0.05
+
+//steps the target around in front of the owl and measures how a tracker running against the simulator copes.
+//per step and tracked image axis it reports:
+// latency   - step to the first servo packet that differs from the one in force at the step, i.e. camera,
+//             stream, tracker and network together (motion to photon to motion)
+// settling  - step to the last time the target left the band around the error it ended up at
+// overshoot - how far the error went past that final value, as a percentage of the distance travelled
+// final     - remaining pixel error, trackers that aim at an offset still settle, just not at zero
+//the error is the true image position of the ball centre, not what the tracker thinks it sees
+class TrackingHarness
+{
+public:
+    //TASK2 follows the ball with the left eye, TASK3 verges both eyes on it
+    enum Tracker { TASK2, TASK3 };
+
+    TrackingHarness(Tracker tracker, int trials, double step, const Point3d& home);
+
+    //servo server thread, every packet
+    void onCommand(const int pwm[SIM_SERVOS]);
+    //render thread, after every frame: samples the error and starts the next step. false once all are done
+    bool update(SimulatedOwl& owl);
+
+    void report(std::ostream& out) const;
+
+private:
+    struct Signal
+    {
+        const char* name;
+        SimEye eye;
+        bool vertical;
+    };
+    struct Sample
+    {
+        double t;                       //seconds since the step
+        std::vector<double> error;      //pixels, one per signal
+    };
+    struct Trial
+    {
+        double start = 0;
+        Point3d target;
+        std::vector<Sample> samples;
+        double latency = -1;            //seconds, negative until the tracker reacts
+    };
+    struct Metrics
+    {
+        double step = 0, latency = -1, settling = -1, overshoot = 0, final = 0;
+    };
+
+    double now() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count(); }
+    Point3d trialTarget(int index) const;
+    Metrics evaluate(const Trial& trial, size_t signal) const;
+
+    Tracker tracker;
+    int trialCount;
+    double stepSize;
+    Point3d home;
+    std::vector<Signal> signals;
+    std::chrono::steady_clock::time_point begin;
+    double warmupStart = -1;
+
+    mutable std::mutex mutex;           //trials and the packets seen are shared with the servo thread
+    bool connected = false;
+    int lastPwm[SIM_SERVOS];
+    int stepPwm[SIM_SERVOS];
+    std::vector<Trial> trials;
+};
+
+#endif // TRACKING_HARNESS_H
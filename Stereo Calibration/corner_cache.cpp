@@ -0,0 +1,125 @@
+#include "corner_cache.h"
+
+#include <fstream>
+#include <iostream>
+
+#include "../fnv1a.h"
+
+using namespace cv;
+using namespace std;
+
+//file layout: header, then per entry the key, image size, found flag, corner count and the corners as floats
+struct CornerCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+};
+
+struct CornerCacheEntry
+{
+    uint64_t key;
+    int32_t width, height;
+    int32_t found;
+    int32_t cornerCount;
+};
+
+uint64_t CornerCache::makeKey(const vector<char>& fileBytes, Size boardSize, int flags, int pipelineVersion)
+{
+    uint64_t hash = fnv1a(fileBytes.data(), fileBytes.size());
+    int32_t settings[5] = {boardSize.width, boardSize.height, flags, pipelineVersion, CORNER_CACHE_VERSION};
+    hash = fnv1a(settings, sizeof(settings), hash);
+    //0 is reserved for images that could not be read
+    return hash ? hash : 1;
+}
+
+bool CornerCache::load(Size boardSize)
+{
+    entries.clear();
+    ifstream file(path, ios::binary);
+    if( !file.is_open() )
+        return false;
+
+    CornerCacheHeader header;
+    if( !file.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || header.magic != CORNER_CACHE_MAGIC || header.version != CORNER_CACHE_VERSION )
+        return false;
+
+    for( uint64_t i = 0; i < header.count; i++ )
+    {
+        CornerCacheEntry e;
+        if( !file.read(reinterpret_cast<char*>(&e), sizeof(e)) )
+            break;
+        //a found board has every corner, a miss at most that many. anything else is a damaged file, start over
+        if( e.cornerCount < 0 || e.cornerCount > boardSize.area() || (e.found && e.cornerCount != boardSize.area()) )
+        {
+            cout << "corner cache " << path << " is damaged, every image will be searched again" << endl;
+            entries.clear();
+            return false;
+        }
+        Entry& entry = entries[e.key];
+        entry.imageSize = Size(e.width, e.height);
+        entry.found = e.found != 0;
+        entry.corners.resize(size_t(e.cornerCount));
+        if( !file.read(reinterpret_cast<char*>(entry.corners.data()), streamsize(entry.corners.size()*sizeof(Point2f))) )
+        {
+            entries.erase(e.key);
+            break;
+        }
+    }
+    return true;
+}
+
+bool CornerCache::save() const
+{
+    ofstream file(path, ios::binary | ios::trunc);
+    if( !file.is_open() )
+    {
+        cout << "could not write corner cache: " << path << endl;
+        return false;
+    }
+    CornerCacheHeader header = {CORNER_CACHE_MAGIC, CORNER_CACHE_VERSION, 0};
+    for( const auto& entry : entries )
+        if( entry.second.used )
+            header.count++;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for( const auto& entry : entries )
+    {
+        if( !entry.second.used )
+            continue;
+        CornerCacheEntry e;
+        e.key = entry.first;
+        e.width = entry.second.imageSize.width;
+        e.height = entry.second.imageSize.height;
+        e.found = entry.second.found;
+        e.cornerCount = int32_t(entry.second.corners.size());
+        file.write(reinterpret_cast<const char*>(&e), sizeof(e));
+        file.write(reinterpret_cast<const char*>(entry.second.corners.data()), streamsize(entry.second.corners.size()*sizeof(Point2f)));
+    }
+    return file.good();
+}
+
+bool CornerCache::find(uint64_t key, CornerDetection& result) const
+{
+    auto it = entries.find(key);
+    if( it == entries.end() )
+        return false;
+    result.key = key;
+    result.imageSize = it->second.imageSize;
+    result.found = it->second.found;
+    result.corners = it->second.corners;
+    result.cached = true;
+    return true;
+}
+
+void CornerCache::insert(const CornerDetection& result)
+{
+    if( result.key == 0 )
+        return;
+    Entry& entry = entries[result.key];
+    entry.imageSize = result.imageSize;
+    entry.found = result.found;
+    entry.corners = result.corners;
+    entry.used = true;
+}
@@ -0,0 +1,65 @@
+#ifndef CORNER_CACHE_H
+#define CORNER_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "../chessboard_detect.h"
+
+#define CORNER_CACHE_MAGIC 0x4e524f43    // "CORN"
+#define CORNER_CACHE_VERSION 1
+#define CORNER_CACHE_SUFFIX ".corners"
+
+//corners found in one calibration image
+struct CornerDetection
+{
+    cv::Size imageSize;
+    bool found = false;
+    ChessboardLevel level = CHESS_NOT_FOUND;   //detection step that found the board, not cached
+    std::vector<cv::Point2f> corners;
+    cv::Mat preview;        //the image itself, only kept when the corners are going to be shown
+    uint64_t key = 0;       //cache key, 0 if the image could not be read
+    bool cached = false;    //true if the result came from the cache instead of a detection
+};
+
+//refined chessboard corners from previous runs, stored next to the image list. entries are keyed by the
+//image file contents together with the board size and detection settings, so renamed files still hit and
+//edited files, another board or a changed detector miss. images without a board are remembered too, so a
+//bad capture is not searched again on every run.
+class CornerCache
+{
+public:
+    explicit CornerCache(const std::string& path) : path(path) {}
+
+    //a corner count that cannot come from boardSize means a damaged file, the whole cache is dropped then
+    bool load(cv::Size boardSize);
+    //only the entries passed to insert() since load() are written, so images dropped from the list fall out
+    bool save() const;
+
+    //key for an image file's bytes under the given detection settings
+    static uint64_t makeKey(const std::vector<char>& fileBytes, cv::Size boardSize, int flags, int pipelineVersion);
+
+    //safe to call from several threads as long as nothing is inserted at the same time
+    bool find(uint64_t key, CornerDetection& result) const;
+    //add or refresh the entry for a result, cache hits are passed back in too so they are kept on save
+    void insert(const CornerDetection& result);
+
+    size_t size() const { return entries.size(); }
+
+private:
+    struct Entry
+    {
+        cv::Size imageSize;
+        bool found = false;
+        std::vector<cv::Point2f> corners;
+        bool used = false;     //looked up or stored during this run
+    };
+
+    std::string path;
+    std::unordered_map<uint64_t, Entry> entries;
+};
+
+#endif // CORNER_CACHE_H
@@ -25,6 +25,7 @@
 /* Phil Culverhouse CRNS Plymouth University 2017
  * changed intrinsics.yml & extrinsics.yml to xml files
  * default to display stereo pairs during chequer board matching
+ * (corner previews are now opt-in with -preview, detection runs in parallel)
 */
 
 #include "opencv2/calib3d.hpp"
@@ -41,6 +42,11 @@
 #include <stdlib.h>
 #include <ctype.h>
 
+#include "../chessboard_detect.h"
+#include "../rectification.h"
+#include "corner_cache.h"
+#include "view_selection.h"
+
 using namespace cv;
 using namespace std;
 
@@ -55,13 +61,45 @@ static int print_help()
             "         matrix separately) stereo. \n"
             " Calibrate the cameras and display the\n"
             " rectified results along with the computed disparity images.   \n" << endl;
-    cout << "Usage:\n ./stereo_calib -w=<board_width default=9> -h=<board_height default=6> -s=<square_size default=1.0> <image list XML/YML file default=../Stereo Image Capture/image_list.xml>\n" << endl;
+    cout << "Usage:\n ./stereo_calib -w=<board_width default=9> -h=<board_height default=6> -s=<square_size default=1.0> [-nr] [-preview] [-target=<rms pixels>] <image list XML/YML file default=../Stereo Image Capture/image_list.xml>\n" << endl;
+    cout << " -nr skips the rectified pair viewer, -preview shows the corners found in every image\n"
+            " -target calibrates on the fewest pairs that keep every pair under that reprojection error,\n"
+            "   0 (the default) uses all of them\n" << endl;
     return 0;
 }
 
 
+#define CORNER_PIPELINE_VERSION 3   //bump when detectCorners changes so cached corners are redone
+
+//find the chessboard in one image, starting from a downscaled copy (see findChessboard).
+//the file is hashed first and the detection skipped if the cache already has corners for it
+static void detectCorners(const string& filename, Size boardSize, bool keepImage, const CornerCache& cache, CornerDetection& result)
+{
+    vector<char> bytes;
+    if( !readFileBytes(filename, bytes) || bytes.empty() )
+        return;
+    uint64_t key = CornerCache::makeKey(bytes, boardSize, CHESS_DETECT_FLAGS, CORNER_PIPELINE_VERSION);
+    if( cache.find(key, result) && !keepImage )
+        return;
+    Mat img = imdecode(bytes, IMREAD_GRAYSCALE );
+    //cv::flip(img,img,1); //PFC flip cal images 20.03.19 if required
+    if( img.empty() )
+        return;
+    if( result.cached )
+    {
+        result.preview = img;
+        return;
+    }
+    result.key = key;
+    result.imageSize = img.size();
+    result.level = findChessboard(img, boardSize, result.corners);
+    result.found = result.level != CHESS_NOT_FOUND;
+    if( keepImage )
+        result.preview = img;
+}
+
 static void
-StereoCalib(const vector<string>& imagelist, Size boardSize, float squareSize, bool displayCorners = false, bool useCalibrated=true, bool showRectified=true)
+StereoCalib(const vector<string>& imagelist, Size boardSize, float squareSize, CornerCache& cache, double targetRms = 0, bool displayCorners = false, bool useCalibrated=true, bool showRectified=true)
 {
     if( imagelist.size() % 2 != 0 )
     {
@@ -69,7 +107,6 @@ StereoCalib(const vector<string>& imagelist, Size boardSize, float squareSize, b
         return;
     }
 
-    const int maxScale = 2;
     // ARRAY AND VECTOR STORAGE:
 
     vector<vector<Point2f> > imagePoints[2];
@@ -82,63 +119,62 @@ StereoCalib(const vector<string>& imagelist, Size boardSize, float squareSize, b
     imagePoints[1].resize(nimages);
     vector<string> goodImageList;
 
+    // every image is independent, so detection and sub-pixel refinement run on all cores at once.
+    // results are stored by index, the pairs below are assembled in list order whatever finishes first
+    vector<CornerDetection> detections(imagelist.size());
+    int64 detectStart = getTickCount();
+    parallel_for_(Range(0, (int)imagelist.size()), [&](const Range& range)
+    {
+        for( int n = range.start; n < range.end; n++ )
+            detectCorners(imagelist[n], boardSize, displayCorners, cache, detections[n]);
+    });
+    int cachedCount = 0, levelCount[CHESS_FOUND_UPSCALED + 1] = {0};
+    for( const CornerDetection& detection : detections )
+    {
+        cachedCount += detection.cached;
+        if( !detection.cached )
+            levelCount[detection.level]++;
+        cache.insert(detection);
+    }
+    cache.save();
+    cout << "corner detection took " << (getTickCount() - detectStart)/getTickFrequency() << "s for "
+         << imagelist.size() << " images (" << cachedCount << " from the cache)\n";
+    cout << "  found downscaled: " << levelCount[CHESS_FOUND_DOWNSCALED] << ", full size: " << levelCount[CHESS_FOUND_FULL]
+         << ", upscaled: " << levelCount[CHESS_FOUND_UPSCALED] << ", not found: " << levelCount[CHESS_NOT_FOUND] << "\n";
+
     for( i = j = 0; i < nimages; i++ )
     {
         for( k = 0; k < 2; k++ )
         {
             const string& filename = imagelist[i*2+k];
-            Mat img = imread(filename, IMREAD_GRAYSCALE );
-            //cv::flip(img,img,1); //PFC flip cal images 20.03.19 if required
-            if(img.empty())
+            const CornerDetection& detection = detections[i*2+k];
+            if( detection.imageSize == Size() )
                 break;
             if( imageSize == Size() )
-                imageSize = img.size();
-            else if( img.size() != imageSize )
+                imageSize = detection.imageSize;
+            else if( detection.imageSize != imageSize )
             {
                 cout << "The image " << filename << " has the size different from the first image size. Skipping the pair\n";
                 break;
             }
-            bool found = false;
-            vector<Point2f>& corners = imagePoints[k][j];
-            for( int scale = 1; scale <= maxScale; scale++ )
-            {
-                Mat timg;
-                if( scale == 1 )
-                    timg = img;
-                else
-                    resize(img, timg, Size(), scale, scale);
-                found = findChessboardCorners(timg, boardSize, corners,
-                    CALIB_CB_ADAPTIVE_THRESH | CALIB_CB_NORMALIZE_IMAGE);
-                if( found )
-                {
-                    if( scale > 1 )
-                    {
-                        Mat cornersMat(corners);
-                        cornersMat *= 1./scale;
-                    }
-                    break;
-                }
-            }
-            if (true) //PFC was (displayCorners )
+            if( displayCorners )
             {
                 cout << filename << endl;
                 Mat cimg, cimg1;
-                cvtColor(img, cimg, COLOR_GRAY2BGR);
-                drawChessboardCorners(cimg, boardSize, corners, found);
-                double sf = 640./MAX(img.rows, img.cols);
+                cvtColor(detection.preview, cimg, COLOR_GRAY2BGR);
+                drawChessboardCorners(cimg, boardSize, detection.corners, detection.found);
+                double sf = 640./MAX(imageSize.height, imageSize.width);
                 resize(cimg, cimg1, Size(), sf, sf);
                 imshow("corners", cimg1);
                 char c = (char)waitKey(500);
                 if( c == 27 || c == 'q' || c == 'Q' ) //Allow ESC to quit
                     exit(-1);
             }
-            else
-                putchar('.');
-            if( !found )
+            else if( !detection.found )
+                cout << "no chessboard found in " << filename << endl;
+            if( !detection.found )
                 break;
-            cornerSubPix(img, corners, Size(11,11), Size(-1,-1),
-                         TermCriteria(TermCriteria::COUNT+TermCriteria::EPS,
-                                      30, 0.01));
+            imagePoints[k][j] = detection.corners;
         }
         if( k == 2 )
         {
@@ -147,6 +183,7 @@ StereoCalib(const vector<string>& imagelist, Size boardSize, float squareSize, b
             j++;
         }
     }
+    detections.clear();
     cout << j << " pairs have been successfully detected.\n";
     nimages = j;
     if( nimages < 2 )
@@ -168,22 +205,39 @@ StereoCalib(const vector<string>& imagelist, Size boardSize, float squareSize, b
 
     cout << "Running stereo calibration ...\n";
 
-    Mat cameraMatrix[2], distCoeffs[2];
-    cameraMatrix[0] = initCameraMatrix2D(objectPoints,imagePoints[0],imageSize,0);
-    cameraMatrix[1] = initCameraMatrix2D(objectPoints,imagePoints[1],imageSize,0);
-    Mat R, T, E, F;
-
-    double rms = stereoCalibrate(objectPoints, imagePoints[0], imagePoints[1],
-                    cameraMatrix[0], distCoeffs[0],
-                    cameraMatrix[1], distCoeffs[1],
-                    imageSize, R, T, E, F,
-                    CALIB_FIX_ASPECT_RATIO +
-                    CALIB_ZERO_TANGENT_DIST +
-                    CALIB_USE_INTRINSIC_GUESS +
-                    CALIB_SAME_FOCAL_LENGTH +
-                    CALIB_RATIONAL_MODEL +
-                    CALIB_FIX_K3 + CALIB_FIX_K4 + CALIB_FIX_K5,
-                    TermCriteria(TermCriteria::COUNT+TermCriteria::EPS, 100, 1e-5) );
+    StereoCalibration calib;
+    if( targetRms > 0 )
+    {
+        // calibrate on a small diverse subset that still meets the target on every pair,
+        // the rest of the function then only sees the chosen pairs
+        vector<int> selected = selectViews(objectPoints, imagePoints[0], imagePoints[1], imageSize, targetRms, calib);
+        if( selected.empty() )
+        {
+            cout << "Error: too little pairs left to run the calibration\n";
+            return;
+        }
+        vector<vector<Point2f> > chosenPoints[2];
+        vector<string> chosenImages;
+        for( int v : selected )
+        {
+            chosenPoints[0].push_back(imagePoints[0][v]);
+            chosenPoints[1].push_back(imagePoints[1][v]);
+            chosenImages.push_back(goodImageList[v*2]);
+            chosenImages.push_back(goodImageList[v*2+1]);
+        }
+        imagePoints[0].swap(chosenPoints[0]);
+        imagePoints[1].swap(chosenPoints[1]);
+        goodImageList.swap(chosenImages);
+        nimages = (int)selected.size();
+        objectPoints.resize(nimages);
+    }
+    else
+        calibrateStereo(objectPoints, imagePoints[0], imagePoints[1], imageSize, calib);
+
+    Mat cameraMatrix[2] = {calib.cameraMatrix[0], calib.cameraMatrix[1]};
+    Mat distCoeffs[2] = {calib.distCoeffs[0], calib.distCoeffs[1]};
+    Mat R = calib.R, T = calib.T, E = calib.E, F = calib.F;
+    double rms = calib.rms;
     cout << "done with RMS error=" << rms << endl;
 
 // CALIBRATION QUALITY CHECK
@@ -234,7 +288,7 @@ StereoCalib(const vector<string>& imagelist, Size boardSize, float squareSize, b
     stereoRectify(cameraMatrix[0], distCoeffs[0],
                   cameraMatrix[1], distCoeffs[1],
                   imageSize, R, T, R1, R2, P1, P2, Q,
-                  CALIB_ZERO_DISPARITY, 1, imageSize, &validRoi[0], &validRoi[1]);
+                  CALIB_ZERO_DISPARITY, RECT_ALPHA, imageSize, &validRoi[0], &validRoi[1]);
     //PFC Saves to local Repo folder
     fs.open("../extrinsics.xml", FileStorage::WRITE);
     if( fs.isOpened() )
@@ -257,7 +311,15 @@ StereoCalib(const vector<string>& imagelist, Size boardSize, float squareSize, b
 // IF BY CALIBRATED (BOUGUET'S METHOD)
     if(useCalibrated )
     {
-        // we already computed everything
+        // use the shared maps so the preview matches what the other tools rectify with,
+        // the xml files were just rewritten so this also refreshes the cache
+        StereoRectification rect;
+        if( loadRectification("../intrinsics.xml", "../extrinsics.xml", imageSize, rect) )
+        {
+            rmap[0][0] = rect.map11; rmap[0][1] = rect.map12;
+            rmap[1][0] = rect.map21; rmap[1][1] = rect.map22;
+            validRoi[0] = rect.roi1; validRoi[1] = rect.roi2;
+        }
     }
 // OR ELSE HARTLEY'S METHOD
     else
@@ -282,8 +344,11 @@ StereoCalib(const vector<string>& imagelist, Size boardSize, float squareSize, b
     }
 
     //Precompute maps for cv::remap()
-    initUndistortRectifyMap(cameraMatrix[0], distCoeffs[0], R1, P1, imageSize, CV_16SC2, rmap[0][0], rmap[0][1]);
-    initUndistortRectifyMap(cameraMatrix[1], distCoeffs[1], R2, P2, imageSize, CV_16SC2, rmap[1][0], rmap[1][1]);
+    if( rmap[0][0].empty() )
+    {
+        initUndistortRectifyMap(cameraMatrix[0], distCoeffs[0], R1, P1, imageSize, CV_16SC2, rmap[0][0], rmap[0][1]);
+        initUndistortRectifyMap(cameraMatrix[1], distCoeffs[1], R2, P2, imageSize, CV_16SC2, rmap[1][0], rmap[1][1]);
+    }
 
     Mat canvas;
     double sf;
@@ -309,7 +374,6 @@ StereoCalib(const vector<string>& imagelist, Size boardSize, float squareSize, b
         {
             Mat img = imread(goodImageList[i*2+k], IMREAD_GRAYSCALE ), rimg, cimg;
             remap(img, rimg, rmap[k][0], rmap[k][1], INTER_LINEAR);
-            imshow("test",img); waitKey(500); //PFC DEBUG
             cvtColor(rimg, cimg, COLOR_GRAY2BGR);
             Mat canvasPart = !isVerticalStereo ? canvas(Rect(w*k, 0, w, h)) : canvas(Rect(0, h*k, w, h));
             resize(cimg, canvasPart, canvasPart.size(), 0, 0, INTER_AREA);
@@ -360,14 +424,16 @@ int main(int argc, char** argv)
     Size boardSize;
     string imagelistfn;
     bool showRectified;
-    cv::CommandLineParser parser(argc, argv, "{w|9|}{h|6|}{s|26.0|}{nr||}{help||}{@input|../Stereo Calibration/image_list.xml|}");
+    cv::CommandLineParser parser(argc, argv, "{w|9|}{h|6|}{s|26.0|}{nr||}{preview||}{target|0|}{help||}{@input|../Stereo Calibration/image_list.xml|}");
     if (parser.has("help"))
         return print_help();
     showRectified = !parser.has("nr");
+    bool previewCorners = parser.has("preview");
     imagelistfn = parser.get<string>("@input");
     boardSize.width = parser.get<int>("w");
     boardSize.height = parser.get<int>("h");
     float squareSize = parser.get<float>("s");
+    double targetRms = parser.get<double>("target");
     if (!parser.check())
     {
         parser.printErrors();
@@ -381,6 +447,10 @@ int main(int argc, char** argv)
         return print_help();
     }
 
-    StereoCalib(imagelist, boardSize, squareSize, true, true, showRectified);
+    // corners from earlier runs are reused, only new or changed images are searched
+    CornerCache cache(imagelistfn + CORNER_CACHE_SUFFIX);
+    cache.load(boardSize);
+
+    StereoCalib(imagelist, boardSize, squareSize, cache, targetRms, previewCorners, true, showRectified);
     return 0;
 }
@@ -19,7 +19,16 @@ LIBS +=    -lopencv_core411 \
 LIBS +=-lws2_32 \
 
 SOURCES += \
-    main.cpp
+    main.cpp \
+    corner_cache.cpp \
+    view_selection.cpp
+
+HEADERS += \
+    ../chessboard_detect.h \
+    ../fnv1a.h \
+    ../rectification.h \
+    corner_cache.h \
+    view_selection.h
 
 DISTFILES += \
     image_list.xml
@@ -0,0 +1,236 @@
+#include "view_selection.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iomanip>
+
+using namespace cv;
+using namespace std;
+
+typedef vector<vector<Point3f> > ObjectPointList;
+typedef vector<vector<Point2f> > ImagePointList;
+
+double calibrateStereo(const ObjectPointList& objectPoints, const ImagePointList& imagePoints0,
+                       const ImagePointList& imagePoints1, Size imageSize, StereoCalibration& calib)
+{
+    calib.cameraMatrix[0] = initCameraMatrix2D(objectPoints,imagePoints0,imageSize,0);
+    calib.cameraMatrix[1] = initCameraMatrix2D(objectPoints,imagePoints1,imageSize,0);
+    calib.distCoeffs[0].release();
+    calib.distCoeffs[1].release();
+    calib.rms = stereoCalibrate(objectPoints, imagePoints0, imagePoints1,
+                    calib.cameraMatrix[0], calib.distCoeffs[0],
+                    calib.cameraMatrix[1], calib.distCoeffs[1],
+                    imageSize, calib.R, calib.T, calib.E, calib.F,
+                    STEREO_CALIB_FLAGS,
+                    TermCriteria(TermCriteria::COUNT+TermCriteria::EPS, 100, 1e-5) );
+    return calib.rms;
+}
+
+void stereoViewErrors(const ObjectPointList& objectPoints, const ImagePointList& imagePoints0,
+                      const ImagePointList& imagePoints1, const StereoCalibration& calib, vector<double>& errors)
+{
+    errors.assign(objectPoints.size(), 0.);
+    Matx33d R;
+    calib.R.convertTo(R, CV_64F);
+    Vec3d T;
+    calib.T.convertTo(T, CV_64F);
+    parallel_for_(Range(0, (int)objectPoints.size()), [&](const Range& range)
+    {
+        vector<Point2f> projected;
+        for( int i = range.start; i < range.end; i++ )
+        {
+            Vec3d rvec, tvec;
+            solvePnP(objectPoints[i], imagePoints0[i], calib.cameraMatrix[0], calib.distCoeffs[0], rvec, tvec);
+            projectPoints(objectPoints[i], rvec, tvec, calib.cameraMatrix[0], calib.distCoeffs[0], projected);
+            double err = norm(imagePoints0[i], projected, NORM_L2SQR);
+
+            //the same board pose seen from the right camera
+            Matx33d Rl;
+            Rodrigues(rvec, Rl);
+            Vec3d rvecR, tvecR = R*tvec + T;
+            Rodrigues(R*Rl, rvecR);
+            projectPoints(objectPoints[i], rvecR, tvecR, calib.cameraMatrix[1], calib.distCoeffs[1], projected);
+            err += norm(imagePoints1[i], projected, NORM_L2SQR);
+
+            errors[i] = sqrt(err/(2.*objectPoints[i].size()));
+        }
+    });
+}
+
+//per view pose descriptor: board normal, position relative to the typical distance and where it sits in the
+//image, all roughly unit scaled so no single term dominates the distance between views
+static void poseFeatures(const ObjectPointList& objectPoints, const ImagePointList& imagePoints,
+                         Size imageSize, vector<Vec<double, 7> >& features)
+{
+    Mat M = initCameraMatrix2D(objectPoints,imagePoints,imageSize,0);
+    size_t n = objectPoints.size();
+    vector<Vec3d> normals(n), positions(n);
+    double depth = 0;
+    for( size_t i = 0; i < n; i++ )
+    {
+        Vec3d rvec, tvec;
+        solvePnP(objectPoints[i], imagePoints[i], M, noArray(), rvec, tvec);
+        Matx33d Rb;
+        Rodrigues(rvec, Rb);
+        normals[i] = Vec3d(Rb(0,2), Rb(1,2), Rb(2,2));
+        if( normals[i][2] > 0 )
+            normals[i] = -normals[i];
+        positions[i] = tvec;
+        depth += fabs(tvec[2]);
+    }
+    depth = max(depth/n, DBL_EPSILON);
+
+    features.resize(n);
+    for( size_t i = 0; i < n; i++ )
+    {
+        Scalar centre = mean(imagePoints[i]);
+        features[i] = Vec<double, 7>(normals[i][0], normals[i][1],
+                                     positions[i][0]/depth, positions[i][1]/depth, positions[i][2]/depth,
+                                     centre[0]/imageSize.width, centre[1]/imageSize.height);
+    }
+}
+
+//farthest point ordering: start from the most unusual view, then repeatedly take the view that is most
+//different from everything already taken
+static vector<int> diversityOrder(const vector<Vec<double, 7> >& features)
+{
+    size_t n = features.size();
+    Vec<double, 7> centre = Vec<double, 7>::all(0);
+    for( const Vec<double, 7>& f : features )
+        centre += f;
+    centre *= 1./n;
+
+    vector<int> order;
+    vector<double> nearest(n, DBL_MAX);
+    vector<bool> taken(n, false);
+    int next = 0;
+    double best = -1;
+    for( size_t i = 0; i < n; i++ )
+    {
+        double d = norm(features[i] - centre);
+        if( d > best )
+        {
+            best = d;
+            next = (int)i;
+        }
+    }
+    while( order.size() < n )
+    {
+        order.push_back(next);
+        taken[next] = true;
+        best = -1;
+        for( size_t i = 0; i < n; i++ )
+        {
+            if( taken[i] )
+                continue;
+            nearest[i] = min(nearest[i], norm(features[i] - features[next]));
+            if( nearest[i] > best )
+            {
+                best = nearest[i];
+                next = (int)i;
+            }
+        }
+    }
+    return order;
+}
+
+template <typename T>
+static vector<T> subset(const vector<T>& all, const vector<int>& indices)
+{
+    vector<T> out;
+    out.reserve(indices.size());
+    for( int i : indices )
+        out.push_back(all[i]);
+    return out;
+}
+
+vector<int> selectViews(const ObjectPointList& objectPoints, const ImagePointList& imagePoints0,
+                        const ImagePointList& imagePoints1, Size imageSize, double targetRms,
+                        StereoCalibration& calib, ostream& report)
+{
+    size_t n = objectPoints.size();
+    vector<Vec<double, 7> > features;
+    poseFeatures(objectPoints, imagePoints0, imageSize, features);
+    vector<int> order = diversityOrder(features);
+
+    vector<bool> outlier(n, false);
+    vector<int> selected;
+    vector<double> errors;
+    size_t nextView = 0;
+    double totalSeconds = 0;
+    bool grow = true;
+
+    report << " pairs   calib rms   all-view rms   outliers   time(s)\n";
+    for( ;; )
+    {
+        //grow the selection with the next most diverse views that are not known outliers
+        size_t want = selected.empty() ? PLAN_MIN_VIEWS : selected.size() + PLAN_STEP_VIEWS;
+        while( grow && selected.size() < want && nextView < n )
+        {
+            int v = order[nextView++];
+            if( !outlier[v] )
+                selected.push_back(v);
+        }
+        grow = true;
+        if( selected.size() < 2 )
+        {
+            //calib no longer matches any selection that can be returned
+            report << "too few usable pairs left to calibrate\n";
+            return vector<int>();
+        }
+
+        int64 start = getTickCount();
+        calibrateStereo(subset(objectPoints, selected), subset(imagePoints0, selected),
+                        subset(imagePoints1, selected), imageSize, calib);
+        double seconds = (getTickCount() - start)/getTickFrequency();
+        totalSeconds += seconds;
+
+        //score every detected view, not just the chosen ones, so the target holds for the whole set
+        stereoViewErrors(objectPoints, imagePoints0, imagePoints1, calib, errors);
+        vector<double> sorted;
+        for( size_t i = 0; i < n; i++ )
+            if( !outlier[i] )
+                sorted.push_back(errors[i]);
+        nth_element(sorted.begin(), sorted.begin() + sorted.size()/2, sorted.end());
+        double median = sorted[sorted.size()/2];
+
+        bool dropped = false;
+        for( size_t i = 0; i < n; i++ )
+        {
+            if( !outlier[i] && errors[i] > PLAN_OUTLIER_FACTOR*median && errors[i] > targetRms )
+            {
+                outlier[i] = true;
+                dropped |= find(selected.begin(), selected.end(), (int)i) != selected.end();
+            }
+        }
+        double sumSq = 0;
+        int count = 0, outliers = 0;
+        for( size_t i = 0; i < n; i++ )
+        {
+            if( outlier[i] )
+            {
+                outliers++;
+                continue;
+            }
+            sumSq += errors[i]*errors[i];
+            count++;
+        }
+        double allRms = sqrt(sumSq/max(count, 1));
+        report << setw(6) << selected.size() << setw(12) << fixed << setprecision(3) << calib.rms
+               << setw(15) << allRms << setw(11) << outliers << setw(10) << setprecision(2) << seconds << "\n";
+
+        if( dropped )
+        {
+            //an outlier pulled the last calibration, recalibrate the same views without it before judging the result
+            selected.erase(remove_if(selected.begin(), selected.end(), [&](int v) { return outlier[v]; }), selected.end());
+            grow = false;
+            continue;
+        }
+        if( allRms <= targetRms || nextView >= n )
+            break;
+    }
+    report << "selected " << selected.size() << " of " << n << " pairs, " << setprecision(2) << totalSeconds
+           << "s spent calibrating\n" << defaultfloat;
+    return selected;
+}
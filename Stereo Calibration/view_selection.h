@@ -0,0 +1,48 @@
+#ifndef VIEW_SELECTION_H
+#define VIEW_SELECTION_H
+
+#include <iostream>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/calib3d.hpp>
+
+#define STEREO_CALIB_FLAGS (cv::CALIB_FIX_ASPECT_RATIO + cv::CALIB_ZERO_TANGENT_DIST + cv::CALIB_USE_INTRINSIC_GUESS + \
+                            cv::CALIB_SAME_FOCAL_LENGTH + cv::CALIB_RATIONAL_MODEL + \
+                            cv::CALIB_FIX_K3 + cv::CALIB_FIX_K4 + cv::CALIB_FIX_K5)
+#define PLAN_MIN_VIEWS 5          //pairs in the first trial calibration
+#define PLAN_STEP_VIEWS 2         //pairs added per round until the target is met
+#define PLAN_OUTLIER_FACTOR 3.0   //views with more than this times the median error are dropped
+
+//result of a stereoCalibrate run
+struct StereoCalibration
+{
+    cv::Mat cameraMatrix[2], distCoeffs[2];
+    cv::Mat R, T, E, F;
+    double rms = 0;
+};
+
+//stereoCalibrate over the given views with the StereoCalib flags, starting from initCameraMatrix2D guesses
+double calibrateStereo(const std::vector<std::vector<cv::Point3f> >& objectPoints,
+                       const std::vector<std::vector<cv::Point2f> >& imagePoints0,
+                       const std::vector<std::vector<cv::Point2f> >& imagePoints1,
+                       cv::Size imageSize, StereoCalibration& calib);
+
+//rms reprojection error of every view under a calibration. the board pose is fitted in the left camera and
+//carried into the right one through R and T, so a view only scores well if it agrees with the stereo geometry
+void stereoViewErrors(const std::vector<std::vector<cv::Point3f> >& objectPoints,
+                      const std::vector<std::vector<cv::Point2f> >& imagePoints0,
+                      const std::vector<std::vector<cv::Point2f> >& imagePoints1,
+                      const StereoCalibration& calib, std::vector<double>& errors);
+
+//pick a small set of views that calibrates every detected view to within targetRms pixels. views are
+//ordered by pose diversity (board orientation, distance and image position, farthest point first) and
+//added a few at a time; after each trial calibration all views are scored and outliers are dropped for good.
+//prints one line per round with the pair count, errors and time so the trade-off can be judged.
+//returns the indices of the chosen views, calib holds their calibration. empty if fewer than two usable views remain.
+std::vector<int> selectViews(const std::vector<std::vector<cv::Point3f> >& objectPoints,
+                             const std::vector<std::vector<cv::Point2f> >& imagePoints0,
+                             const std::vector<std::vector<cv::Point2f> >& imagePoints1,
+                             cv::Size imageSize, double targetRms, StereoCalibration& calib,
+                             std::ostream& report = std::cout);
+
+#endif // VIEW_SELECTION_H
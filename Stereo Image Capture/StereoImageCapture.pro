@@ -20,8 +20,13 @@ LIBS +=    -lopencv_core411 \
 LIBS += -lws2_32
 
 SOURCES += \
-    main.cpp
+    main.cpp \
+    auto_capture.cpp
 
 HEADERS += \
     ..\owl.h \
+    ..\frame_pool.h \
+    ..\display_service.h \
+    ..\chessboard_detect.h \
+    auto_capture.h \
 
@@ -0,0 +1,233 @@
+#include "auto_capture.h"
+
+#include <algorithm>
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "../chessboard_detect.h"
+
+using namespace cv;
+using namespace std;
+
+AutoCapture::AutoCapture(Size boardSize) : boardSize(boardSize), posesSeen(CAPTURE_POSE_BINS, false)
+{
+    for(int k = 0; k < 2; k++)
+        coverage[k] = Mat::zeros(COVERAGE_ROWS, COVERAGE_COLS, CV_32S);
+    worker = thread(&AutoCapture::run, this);
+}
+
+AutoCapture::~AutoCapture()
+{
+    {
+        lock_guard<std::mutex> lock(pairMutex);
+        running = false;
+    }
+    wake.notify_one();
+    if(worker.joinable())
+        worker.join();
+}
+
+void AutoCapture::submit(const Mat& left, const Mat& right)
+{
+    Pair pair;
+    left.copyTo(pair.left);
+    right.copyTo(pair.right);
+    {
+        lock_guard<std::mutex> lock(pairMutex);
+        swap(pending, pair);
+        hasPending = true;
+    }
+    wake.notify_one();
+}
+
+void AutoCapture::addManual(const Mat& left, const Mat& right)
+{
+    Pair pair;
+    left.copyTo(pair.left);
+    right.copyTo(pair.right);
+    pair.manual = true;
+    {
+        lock_guard<std::mutex> lock(pairMutex);
+        manual.push_back(pair);
+    }
+    wake.notify_one();
+}
+
+bool AutoCapture::status(CaptureStatus& result)
+{
+    lock_guard<std::mutex> lock(pairMutex);
+    if(!fresh)
+        return false;
+    result = latest;
+    fresh = false;
+    return true;
+}
+
+bool AutoCapture::nextPair(Mat& left, Mat& right)
+{
+    lock_guard<std::mutex> lock(pairMutex);
+    if(accepted.empty())
+        return false;
+    left = accepted.front().left;
+    right = accepted.front().right;
+    accepted.pop_front();
+    return true;
+}
+
+void AutoCapture::run()
+{
+    while(true) {
+        Pair pair;
+        {
+            unique_lock<std::mutex> lock(pairMutex);
+            wake.wait(lock, [this]() { return !running || hasPending || !manual.empty(); });
+            if(!running)
+                return;
+            if(!manual.empty()) {
+                pair = manual.front();
+                manual.pop_front();
+            }
+            else {
+                swap(pair, pending);
+                hasPending = false;
+            }
+        }
+        process(pair);
+    }
+}
+
+//grid cells holding at least one corner
+static vector<int> coveredCells(const vector<Point2f>& corners, Size imageSize)
+{
+    vector<int> cells;
+    for(const Point2f& p : corners) {
+        int cx = min(COVERAGE_COLS - 1, max(0, int(p.x*COVERAGE_COLS/imageSize.width)));
+        int cy = min(COVERAGE_ROWS - 1, max(0, int(p.y*COVERAGE_ROWS/imageSize.height)));
+        int cell = cy*COVERAGE_COLS + cx;
+        if(find(cells.begin(), cells.end(), cell) == cells.end())
+            cells.push_back(cell);
+    }
+    return cells;
+}
+
+//coarse pose from the outline of the board: apparent size (distance) and how much opposite edges differ
+//in length (tilt about each axis)
+static int poseBin(const vector<Point2f>& corners, Size boardSize, Size imageSize)
+{
+    const Point2f& tl = corners[0];
+    const Point2f& tr = corners[size_t(boardSize.width - 1)];
+    const Point2f& bl = corners[size_t((boardSize.height - 1)*boardSize.width)];
+    const Point2f& br = corners.back();
+    double top = norm(tr - tl), bottom = norm(br - bl), left = norm(bl - tl), right = norm(br - tr);
+
+    auto tiltBin = [](double a, double b) {
+        double t = (a - b)/max(a + b, 1e-6);
+        return t < -CAPTURE_TILT_BIN ? 0 : t > CAPTURE_TILT_BIN ? 2 : 1;
+    };
+    vector<Point2f> outline = {tl, tr, br, bl};
+    double area = contourArea(outline)/imageSize.area();
+    int sizeBin = area < 0.08 ? 0 : area < 0.25 ? 1 : 2;
+    return (sizeBin*3 + tiltBin(left, right))*3 + tiltBin(top, bottom);
+}
+
+//variance of the Laplacian inside the board's bounding box, motion blur and bad focus both pull it down
+static double boardSharpness(const Mat& grey, const vector<Point2f>& corners)
+{
+    Rect box = boundingRect(corners) & Rect(0, 0, grey.cols, grey.rows);
+    if(box.area() == 0)
+        return 0;
+    Mat lap;
+    Laplacian(grey(box), lap, CV_16S);
+    Scalar mean, stddev;
+    meanStdDev(lap, mean, stddev);
+    return stddev[0]*stddev[0];
+}
+
+void AutoCapture::process(Pair& pair)
+{
+    CaptureStatus result;
+    const Mat* images[2] = {&pair.left, &pair.right};
+    for(int k = 0; k < 2; k++) {
+        Mat grey;
+        if(images[k]->channels() == 1)
+            grey = *images[k];
+        else
+            cvtColor(*images[k], grey, COLOR_BGR2GRAY);
+        result.found[k] = findChessboardDownscaled(grey, boardSize, result.corners[k]);
+        if(result.found[k])
+            result.sharpness[k] = boardSharpness(grey, result.corners[k]);
+    }
+    Size imageSize = pair.left.size();
+    if(result.found[0])
+        result.pose = poseBin(result.corners[0], boardSize, imageSize);
+
+    vector<int> cells[2];
+    int newCells = 0;
+    for(int k = 0; k < 2; k++) {
+        if(!result.found[k])
+            continue;
+        cells[k] = coveredCells(result.corners[k], imageSize);
+        for(int cell : cells[k])
+            newCells += coverage[k].at<int>(cell) == 0;
+    }
+    bool newPose = result.pose >= 0 && !posesSeen[size_t(result.pose)];
+
+    int64_t now = getTickCount();
+    bool bothFound = result.found[0] && result.found[1];
+    if(pair.manual) {
+        result.accepted = bothFound;
+        result.reason = bothFound ? "stored by hand" : "stored by hand, board not found in both eyes";
+    }
+    else if(!bothFound)
+        result.reason = result.found[0] || result.found[1] ? "board only in one eye" : "no board";
+    else if(min(result.sharpness[0], result.sharpness[1]) < CAPTURE_MIN_SHARPNESS)
+        result.reason = "blurred, hold the board still";
+    else if(newCells < CAPTURE_MIN_NEW_CELLS && !newPose)
+        result.reason = "nothing new, move or tilt the board";
+    else if((now - lastCapture)*1000./getTickFrequency() < CAPTURE_MIN_INTERVAL_MS)
+        result.reason = "waiting";
+    else if(!autoCapture)
+        result.reason = "good pair, press SPACE or A";
+    else {
+        result.accepted = true;
+        result.reason = newPose ? "stored, new pose" : "stored, new area";
+    }
+
+    if(result.accepted) {
+        for(int k = 0; k < 2; k++)
+            for(int cell : cells[k])
+                coverage[k].at<int>(cell)++;
+        posesSeen[size_t(result.pose)] = true;
+        if(!pair.manual)
+            lastCapture = now;
+        capturedCount++;
+    }
+    for(int k = 0; k < 2; k++)
+        result.coverage[k] = coverage[k].clone();
+    result.posesSeen = int(count(posesSeen.begin(), posesSeen.end(), true));
+    result.capturedCount = capturedCount;
+
+    lock_guard<std::mutex> lock(pairMutex);
+    if(result.accepted && !pair.manual)
+        accepted.push_back(pair);
+    latest = result;
+    fresh = true;
+}
+
+void AutoCapture::drawCoverage(Mat& stereo, const CaptureStatus& status) const
+{
+    int width = stereo.cols/2;
+    for(int k = 0; k < 2; k++) {
+        if(status.coverage[k].empty())
+            continue;
+        //a handful of pairs per cell is plenty, saturate there so single holes stand out
+        Mat scaled, heat;
+        status.coverage[k].convertTo(scaled, CV_8U, 255./4);
+        resize(scaled, scaled, Size(width, stereo.rows), 0, 0, INTER_NEAREST);
+        applyColorMap(scaled, heat, COLORMAP_JET);
+        Mat eye = stereo(Rect(k*width, 0, width, stereo.rows));
+        addWeighted(eye, 0.7, heat, 0.3, 0, eye);
+        if(status.found[k])
+            drawChessboardCorners(eye, boardSize, status.corners[k], true);
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef AUTO_CAPTURE_H
+#define AUTO_CAPTURE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+#define COVERAGE_COLS 8                 //image area coverage grid per eye
+#define COVERAGE_ROWS 6
+#define CAPTURE_MIN_NEW_CELLS 3         //grid cells a pair has to add (either eye) unless it shows a new pose
+#define CAPTURE_MIN_SHARPNESS 60.0      //variance of the Laplacian over the board, lower is motion blur
+#define CAPTURE_MIN_INTERVAL_MS 700     //gap between automatic captures so the board can be moved
+#define CAPTURE_TILT_BIN 0.06           //relative edge length difference that counts as tilted
+#define CAPTURE_POSE_BINS 27            //3 sizes x 3 horizontal tilts x 3 vertical tilts
+
+//what the detector made of the last frame it looked at
+struct CaptureStatus
+{
+    bool found[2] = {false, false};
+    std::vector<cv::Point2f> corners[2];    //full resolution, unrefined
+    double sharpness[2] = {0, 0};
+    int pose = -1;                          //pose bin of the left board, -1 without a board
+    bool accepted = false;
+    std::string reason;                     //why the pair was or was not stored
+    cv::Mat coverage[2];                    //COVERAGE_ROWS x COVERAGE_COLS CV_32S, pairs that touched each cell
+    int posesSeen = 0;
+    int capturedCount = 0;
+};
+
+//background chessboard detection for the capture loop. submit() hands over the newest pair and returns at once,
+//the worker thread detects the board in both eyes on downscaled copies and stores the pair when both boards are
+//found, sharp and add image area or pose coverage that earlier pairs did not. frames that arrive while the
+//worker is busy replace each other, so detection never holds up the camera. accepted pairs are queued for the
+//caller to save.
+class AutoCapture
+{
+public:
+    explicit AutoCapture(cv::Size boardSize);
+    ~AutoCapture();
+
+    AutoCapture(const AutoCapture&) = delete;
+    AutoCapture& operator=(const AutoCapture&) = delete;
+
+    //the images are copied, the caller can keep drawing on them
+    void submit(const cv::Mat& left, const cv::Mat& right);
+    //latest detector result, false if nothing new since the last call
+    bool status(CaptureStatus& result);
+    //oldest accepted pair that has not been taken yet
+    bool nextPair(cv::Mat& left, cv::Mat& right);
+    //with automatic capture off the detector still reports on every frame but stores nothing
+    void setAutoCapture(bool on) { autoCapture = on; }
+    bool autoCaptureOn() const { return autoCapture; }
+    //count a pair stored by hand towards the coverage, it is not queued for saving again
+    void addManual(const cv::Mat& left, const cv::Mat& right);
+
+    //blend the coverage heat-map over a side by side stereo image, cold cells are the ones still to fill
+    void drawCoverage(cv::Mat& stereo, const CaptureStatus& status) const;
+
+private:
+    struct Pair
+    {
+        cv::Mat left, right;
+        bool manual = false;
+    };
+
+    void run();
+    void process(Pair& pair);
+
+    cv::Size boardSize;
+    std::mutex pairMutex;
+    std::condition_variable wake;
+    Pair pending;
+    bool hasPending = false;
+    std::deque<Pair> manual;        //never replaced, every hand stored pair is counted
+    std::deque<Pair> accepted;
+    CaptureStatus latest;
+    bool fresh = false;
+    std::atomic<bool> running{true};
+    std::atomic<bool> autoCapture{false};
+    std::thread worker;
+
+    //worker thread only
+    cv::Mat coverage[2];
+    std::vector<bool> posesSeen;
+    int64_t lastCapture = 0;
+    int capturedCount = 0;
+};
+
+#endif // AUTO_CAPTURE_H
@@ -5,42 +5,87 @@
 #include <sys/types.h>
 #include <iostream>
 #include <string>
+#include <cstring>
 
 #include "../owl.h"
+#include "../display_service.h"
+#include "auto_capture.h"
 
 using namespace std;
 using namespace cv;
 
 string outputFolder="..\\Stereo Image Capture\\CapturedImages";
 
-int main()
+//inner corners of the calibration board, must match -w and -h given to stereo_calib
+#define BOARD_WIDTH 9
+#define BOARD_HEIGHT 6
+#define AUTO_CAPTURE_FLAG "-auto"
+
+static void savePair(const Mat& left, const Mat& right, int& imgNumber)
+{
+    cout<<"Saving image pair "<<imgNumber<<" to \""<<outputFolder<<"\""<<endl;
+    imwrite(outputFolder+"/right"+to_string(imgNumber)+".png", right);
+    imwrite(outputFolder+"/left" +to_string(imgNumber)+".png", left);
+    imgNumber++;
+}
+
+int main(int argc, char** argv)
 {
     //connect with the owl and load calibration values
     robotOwl owl(1485, 1505, 1555, 1445, 1560);
+    DisplayService display(displayHeadless(argc, argv));
     int imgNumber=0;
 
+    //board detection runs on a worker thread, with auto capture on it stores pairs that add coverage by itself
+    AutoCapture capture(Size(BOARD_WIDTH, BOARD_HEIGHT));
+    CaptureStatus status;
+    for(int i=1; i<argc; i++)
+        if(strcmp(argv[i], AUTO_CAPTURE_FLAG)==0)
+            capture.setAutoCapture(true);
+
+    //kept across frames so the camera frames and the stitched view reuse their buffers instead of allocating
+    Mat left, right, stereo;
     while (true){
         //read the owls camera frames
-        Mat left, right;
         owl.getCameraFrames(left, right);
+        capture.submit(left, right);
 
-        //stitch images
-        Mat stereo(left.size().height, left.size().width*2, CV_8UC3, Scalar(0,0,0));
-        left .copyTo(stereo(Rect(0,0,left.size().width,left.size().height)));
-        right.copyTo(stereo(Rect(left.size().width,0,left.size().width,left.size().height)));
+        //save what the detector accepted
+        Mat acceptedLeft, acceptedRight;
+        while(capture.nextPair(acceptedLeft, acceptedRight))
+            savePair(acceptedLeft, acceptedRight, imgNumber);
+        if(capture.status(status) && status.accepted)
+            cout<<status.reason<<", "<<status.posesSeen<<"/"<<CAPTURE_POSE_BINS<<" poses covered"<<endl;
 
-        //draw text and display
-        putText(stereo, "Press SPACE to take a picture", Point(250, 460), FONT_HERSHEY_SIMPLEX, 1.5, Scalar(255,255,255), 2);
-        putText(stereo, "Images Captured: " + to_string(imgNumber), Point(10,35), FONT_HERSHEY_SIMPLEX, 1.0, Scalar(255,255,255), 2);
-        imshow("stereo",stereo);
+        if(!display.headless())
+        {
+            //stitch images, both halves are overwritten so the buffer needs no clearing
+            stereo.create(left.size().height, left.size().width*2, CV_8UC3);
+            left .copyTo(stereo(Rect(0,0,left.size().width,left.size().height)));
+            right.copyTo(stereo(Rect(left.size().width,0,left.size().width,left.size().height)));
+
+            //coverage heat-map and the boards the detector last saw
+            capture.drawCoverage(stereo, status);
+
+            //draw text and display
+            putText(stereo, "Press SPACE to take a picture, A for auto capture", Point(100, 460), FONT_HERSHEY_SIMPLEX, 1.2, Scalar(255,255,255), 2);
+            putText(stereo, "Images Captured: " + to_string(imgNumber), Point(10,35), FONT_HERSHEY_SIMPLEX, 1.0, Scalar(255,255,255), 2);
+            putText(stereo, string(capture.autoCaptureOn() ? "AUTO: " : "manual: ") + status.reason, Point(10,70), FONT_HERSHEY_SIMPLEX, 0.8, Scalar(255,255,255), 2);
+            putText(stereo, "Poses: " + to_string(status.posesSeen) + "/" + to_string(CAPTURE_POSE_BINS), Point(10,100), FONT_HERSHEY_SIMPLEX, 0.8, Scalar(255,255,255), 2);
+            display.show("stereo",stereo);
+        }
 
         //handle keypress
-        if(waitKey(10)==' ')
+        int key=display.pollKey();
+        if(key==' ')
+        {
+            savePair(left, right, imgNumber);
+            capture.addManual(left, right);
+        }
+        else if(key=='a' || key=='A')
         {
-            cout<<"Saving image pair "<<imgNumber<<" to \""<<outputFolder<<"\""<<endl;
-            imwrite(outputFolder+"/right"+to_string(imgNumber)+".png", right);
-            imwrite(outputFolder+"/left" +to_string(imgNumber)+".png", left);
-            imgNumber++;
+            capture.setAutoCapture(!capture.autoCaptureOn());
+            cout<<"Auto capture "<<(capture.autoCaptureOn() ? "on" : "off")<<endl;
         }
     }
 }
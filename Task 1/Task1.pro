@@ -24,4 +24,7 @@ SOURCES += \
 
 HEADERS += \
     ..\owl.h \
+    ..\frame_pool.h \
+    ..\telemetry.h \
+    ..\display_service.h \
 
@@ -5,12 +5,22 @@
 #include <sys/types.h>
 #include <iostream>
 #include <string>
+#include <chrono>
 
 #include "../owl.h"
+#include "../display_service.h"
+#include "../telemetry.h"
 
 using namespace std;
 using namespace cv;
 
+#define TELEMETRY_TOOL "task1"  //ring name the telemetry viewer is pointed at
+
+static float msSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+}
+
 Vec3f BGRtoHSV(const Vec3b& rgb)
 {
     // create matrix from rgb pixel
@@ -54,42 +64,70 @@ string getColorString(const Vec3f& hsv)
     return "n/a";
 }
 
-int main()
+int main(int argc, char** argv)
 {
     //connect with the owl and load calibration values
     robotOwl owl(1500, 1475, 1520, 1525, 1520, true); //starts in "quiet mode" which switches off the servos.
+    DisplayService display(displayHeadless(argc, argv));
 
+    //capture, classify and display times per frame for the telemetry viewer
+    TelemetryWriter telemetry;
+    telemetry.open(TELEMETRY_TOOL, {"capture", "classify", "display"});
+    TelemetryRecord record;
+
+    string lastColorText;
     bool running = true;
-    while (running) {
+    // kept across frames so every frame lands in the same pooled buffer
+    Mat left, right;
+    for (uint64_t frameId = 0; running; frameId++) {
         // read the owls camera frames
-        Mat left, right;
+        auto start = chrono::steady_clock::now();
         owl.getCameraFrames(left, right);
+        record.stageMs[0] = msSince(start);
+        start = chrono::steady_clock::now();
 
         // get pixel colour values
         Point centrePoint(left.size().width/2, left.size().height/2);
         Vec3b pixelValue = left.at<Vec3b>(centrePoint);
 
-    	// drawing functions
-		// draw a circle to show the pixel being processed
-        circle(left, centrePoint, 15, Scalar(255,255,255), 2); 
-		// convert the pixel to hsv
-        Vec3f hsv = BGRtoHSV(pixelValue); 
-		//draw the string containing hsv components to the image
-        string hsvText = "(" + to_string(hsv[0]) + ", " + to_string(hsv[1]) + ", " + to_string(hsv[2]) + ")";
-        putText(left, hsvText, centrePoint+Point(-250,100), FONT_HERSHEY_SIMPLEX, 1, Scalar(255,255,255), 2);
-		//draw the string denoting the estimated color to the image
+        // convert the pixel to hsv and name the colour
+        Vec3f hsv = BGRtoHSV(pixelValue);
         string colorText = getColorString(hsv);
-        putText(left, colorText, centrePoint+Point(-50,50), FONT_HERSHEY_SIMPLEX, 1, Scalar(255,255,255), 2);
-
-        // display image
-        imshow("left", left);
-        switch(waitKey(10)) {
+        record.stageMs[1] = msSince(start);
+        start = chrono::steady_clock::now();
+
+        if (!display.headless()) {
+            // drawing functions
+            // draw a circle to show the pixel being processed
+            circle(left, centrePoint, 15, Scalar(255,255,255), 2); 
+            //draw the string containing hsv components to the image
+            string hsvText = "(" + to_string(hsv[0]) + ", " + to_string(hsv[1]) + ", " + to_string(hsv[2]) + ")";
+            putText(left, hsvText, centrePoint+Point(-250,100), FONT_HERSHEY_SIMPLEX, 1, Scalar(255,255,255), 2);
+            //draw the string denoting the estimated color to the image
+            putText(left, colorText, centrePoint+Point(-50,50), FONT_HERSHEY_SIMPLEX, 1, Scalar(255,255,255), 2);
+
+            // display image
+            display.show("left", left);
+        } else if (colorText != lastColorText) {
+            // nothing to look at without windows, report colour changes instead
+            cout << colorText << endl;
+        }
+        lastColorText = colorText;
+        int key = display.pollKey();
+        record.stageMs[2] = msSince(start);
+        record.frameId = frameId;
+        record.timeUs = 0;
+        owl.getRawServoPositions(record.servos[0], record.servos[1], record.servos[2], record.servos[3], record.servos[4]);
+        telemetry.publish(record);
+
+        switch(key) {
         case 'q':
         case 27: // ESC
             running = false;
             break;
 	    }
     }
+    owlFramePool().report(cout);
 }
 
 
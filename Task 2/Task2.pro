@@ -21,9 +21,16 @@ LIBS += -lws2_32
 
 SOURCES += \
     main.cpp \
+    face_tracker.cpp \
     hsv_config.cpp
 
 HEADERS += \
     ..\owl.h \
+    ..\frame_pool.h \
+    ..\telemetry.h \
+    ..\display_service.h \
+    ..\stream_stats.h \
+    ..\pipeline.h \
+    face_tracker.h \
     hsv_config.h
 
@@ -0,0 +1,82 @@
+#include "face_tracker.h"
+#include <iostream>
+#include <vector>
+#include <opencv2/imgproc.hpp>
+
+using namespace cv;
+
+bool FaceTracker::load(const std::string& cascadePath)
+{
+    if (!cascade.load(cascadePath)) {
+        std::cout << "could not open: " << cascadePath << "\nface tracking unavailable\n";
+        return false;
+    }
+    return true;
+}
+
+bool FaceTracker::update(const Mat& bgr, Rect& face, float& score)
+{
+    Mat small;
+    resize(bgr, small, Size(), FACE_DETECT_SCALE, FACE_DETECT_SCALE, INTER_AREA);
+    cvtColor(small, gray, COLOR_BGR2GRAY);
+    equalizeHist(gray, gray); //so the template still matches when the camera's exposure shifts
+
+    Rect found;
+    if (tracking && ++sinceDetect < FACE_DETECT_INTERVAL) {
+        tracking = follow(found, score);
+    } else {
+        tracking = detect(found);
+        score = tracking ? 1.f : 0.f;
+    }
+    if (!tracking)
+        return false;
+    last = found;
+    face = Rect(int(found.x/FACE_DETECT_SCALE), int(found.y/FACE_DETECT_SCALE),
+                int(found.width/FACE_DETECT_SCALE), int(found.height/FACE_DETECT_SCALE));
+    return true;
+}
+
+//full cascade over the downscaled frame, keeping the face nearest the one being tracked, or else the largest
+bool FaceTracker::detect(Rect& found)
+{
+    std::vector<Rect> faces;
+    cascade.detectMultiScale(gray, faces, 1.2, 3, 0, Size(FACE_MIN_SIZE, FACE_MIN_SIZE));
+    if (faces.empty())
+        return false;
+
+    Point previous = (last.tl() + last.br())/2;
+    size_t best = 0;
+    for (size_t i = 1; i < faces.size(); i++) {
+        if (tracking) {
+            Point a = (faces[i].tl() + faces[i].br())/2 - previous;
+            Point b = (faces[best].tl() + faces[best].br())/2 - previous;
+            if (a.dot(a) < b.dot(b))
+                best = i;
+        } else if (faces[i].area() > faces[best].area()) {
+            best = i;
+        }
+    }
+    found = faces[best];
+    gray(found).copyTo(templ);
+    sinceDetect = 0;
+    return true;
+}
+
+//template match of the last detection, only inside the previous face grown by FACE_SEARCH_MARGIN on each side
+bool FaceTracker::follow(Rect& found, float& score)
+{
+    int mx = int(last.width*FACE_SEARCH_MARGIN), my = int(last.height*FACE_SEARCH_MARGIN);
+    Rect window = Rect(last.x - mx, last.y - my, last.width + 2*mx, last.height + 2*my) & Rect(Point(), gray.size());
+    if (window.width < templ.cols || window.height < templ.rows)
+        return false;
+
+    matchTemplate(gray(window), templ, result, TM_CCOEFF_NORMED);
+    double best;
+    Point at;
+    minMaxLoc(result, nullptr, &best, nullptr, &at);
+    score = float(best);
+    if (best < FACE_MATCH_THRESHOLD)
+        return false;
+    found = Rect(window.tl() + at, templ.size());
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef FACE_TRACKER_H
+#define FACE_TRACKER_H
+
+#include <string>
+#include <opencv2/core.hpp>
+#include <opencv2/objdetect.hpp>
+
+#define FACE_CASCADE_FILEPATH "lbpcascade_frontalface_improved.xml" //from opencv's data/lbpcascades
+#define FACE_DETECT_INTERVAL 10     //frames between full cascade detections while a face is being tracked
+#define FACE_DETECT_SCALE 0.5       //detection and tracking both run on the frame shrunk by this much
+#define FACE_MIN_SIZE 24            //smallest face the cascade looks for, in downscaled pixels
+#define FACE_SEARCH_MARGIN 0.5      //the local search looks this many face widths around the previous face
+#define FACE_MATCH_THRESHOLD 0.6    //template match score below which the face counts as lost
+
+//finds a face with a cascade every FACE_DETECT_INTERVAL frames, and in between follows it by template matching
+//the last detected face inside a window around where it was, which costs far less than a detection.
+//a weak match drops the track and the next frame runs the cascade again
+class FaceTracker
+{
+public:
+    bool load(const std::string& cascadePath);
+    bool loaded() const { return !cascade.empty(); }
+
+    //face in full frame coordinates, score is the match score or 1 on a detection. false when no face is found
+    bool update(const cv::Mat& bgr, cv::Rect& face, float& score);
+    void reset() { tracking = false; }
+
+private:
+    bool detect(cv::Rect& found);
+    bool follow(cv::Rect& found, float& score);
+
+    cv::CascadeClassifier cascade;
+    cv::Mat gray, templ, result;
+    cv::Rect last;                  //downscaled coordinates
+    bool tracking = false;
+    int sinceDetect = 0;
+};
+
+#endif // FACE_TRACKER_H
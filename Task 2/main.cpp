@@ -5,9 +5,15 @@
 #include <sys/types.h>
 #include <iostream>
 #include <string>
+#include <atomic>
+#include <mutex>
 
 #include "../owl.h"
+#include "../display_service.h"
+#include "../pipeline.h"
+#include "../telemetry.h"
 #include "hsv_config.h"
+#include "face_tracker.h"
 
 using namespace std;
 using namespace cv;
@@ -19,124 +25,252 @@ using namespace cv;
 #define MOVE_FACTOR_X 0.25f
 #define MOVE_FACTOR_Y 0.25f
 #define MOVE_FACTOR_NECK MOVE_FACTOR_X/2
+#define TRACK_FLAG "-track"     //start with tracking on, for unattended runs such as against the owl simulator
+#define FACE_FLAG "-face"       //start following faces instead of the colour
+#define CASCADE_FLAG "-cascade=" //cascade file for face following, FACE_CASCADE_FILEPATH otherwise
+#define TELEMETRY_TOOL "task2"  //ring name the telemetry viewer is pointed at
 
 static const String kWinTitleRaw      = "left";
 static const String kWinTitleFiltered = "left filtered";
 
 static HSVConfig hsv;
+static mutex hsvMutex; //the trackbars change hsv on the display stage while the threshold stage reads it
 
-static void onLowHueThreshTrackbar(int, void *);
-static void onHighHueThreshTrackbar(int, void *);
-static void onLowSatThreshTrackbar(int, void *);
-static void onHighSatThreshTrackbar(int, void *);
-static void onLowValThreshTrackbar(int, void *);
-static void onHighValThreshTrackbar(int, void *);
+//one frame on its way through the pipeline
+struct TrackFrame {
+    Mat left, right, hsvLeft, filteredLeft;
+    Point center;
+    Rect face;
+    bool tracking = false;
+    bool faces = false;
+    TelemetryRecord telemetry;
+};
+
+static void onLowHueThreshTrackbar(int pos, DisplayService& display);
+static void onHighHueThreshTrackbar(int pos, DisplayService& display);
+static void onLowSatThreshTrackbar(int pos, DisplayService& display);
+static void onHighSatThreshTrackbar(int pos, DisplayService& display);
+static void onLowValThreshTrackbar(int pos, DisplayService& display);
+static void onHighValThreshTrackbar(int pos, DisplayService& display);
+static void onTrackbar(const DisplayEvent& event, DisplayService& display);
 
-int main()
+int main(int argc, char** argv)
 {
     //connect with the owl and load calibration values
     robotOwl owl(1500, 1475, 1520, 1525, 1520);
 
+    //windows are drawn on their own thread, trackbar moves come back as events
+    DisplayService display(displayHeadless(argc, argv));
     hsv = loadConfig(HSV_CONFIG_FILEPATH);
-    namedWindow(kWinTitleRaw);
-    namedWindow(kWinTitleFiltered);
-    createTrackbar("Low Hue",  kWinTitleRaw, &hsv.lh, MAX_H, onLowHueThreshTrackbar);
-    createTrackbar("High Hue", kWinTitleRaw, &hsv.hh, MAX_H, onHighHueThreshTrackbar);
-    createTrackbar("Low Sat",  kWinTitleRaw, &hsv.ls, MAX_SV, onLowSatThreshTrackbar);
-    createTrackbar("High Sat", kWinTitleRaw, &hsv.hs, MAX_SV, onHighSatThreshTrackbar);
-    createTrackbar("Low Val",  kWinTitleRaw, &hsv.lv, MAX_SV, onLowValThreshTrackbar);
-    createTrackbar("High Val", kWinTitleRaw, &hsv.hv, MAX_SV, onHighValThreshTrackbar);
+    display.addTrackbar("Low Hue",  kWinTitleRaw, hsv.lh, MAX_H);
+    display.addTrackbar("High Hue", kWinTitleRaw, hsv.hh, MAX_H);
+    display.addTrackbar("Low Sat",  kWinTitleRaw, hsv.ls, MAX_SV);
+    display.addTrackbar("High Sat", kWinTitleRaw, hsv.hs, MAX_SV);
+    display.addTrackbar("Low Val",  kWinTitleRaw, hsv.lv, MAX_SV);
+    display.addTrackbar("High Val", kWinTitleRaw, hsv.hv, MAX_SV);
 
-    Mat left, right, hsvLeft, filteredLeft;
-    bool running = true;
-    bool tracking = false;
-    while (running) {
-        //read the owls camera frames
-        owl.getCameraFrames(left, right);
+    //capture -> convert -> threshold -> control -> display, each on its own thread so the next frame is
+    //captured and converted while the previous one is still being thresholded or drawn
+    Pipeline pipeline;
+    atomic<bool> tracking(false);
+    atomic<bool> followFaces(false);
+    string cascadePath = FACE_CASCADE_FILEPATH;
+    bool cascadeGiven = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], TRACK_FLAG) == 0)
+            tracking = true;
+        else if (strcmp(argv[i], FACE_FLAG) == 0)
+            followFaces = true;
+        else if (strncmp(argv[i], CASCADE_FLAG, strlen(CASCADE_FLAG)) == 0) {
+            cascadePath = argv[i] + strlen(CASCADE_FLAG);
+            cascadeGiven = true;
+        }
+    }
+    //the cascade is only loaded once faces are asked for, and always before followFaces is set. from then on
+    //only the threshold stage touches the tracker, so it needs no lock
+    FaceTracker faceTracker;
+    if ((followFaces || cascadeGiven) && !faceTracker.load(cascadePath))
+        followFaces = false;
 
-        string trackText = "t = toggle tracking";
-        string saveText = "s = save hsv config";
-        string quitText = "q = quit";
-        putText(left, trackText, {5, 30}, FONT_HERSHEY_PLAIN, 1.5, Scalar(0, 255, 0), 1, LINE_AA); //draw the string containing hsv components to the image
-        putText(left, saveText, {5, 60}, FONT_HERSHEY_PLAIN, 1.5, Scalar(0, 255, 0), 1, LINE_AA); //draw the string containing hsv components to the image
-        putText(left, quitText, {5, 90}, FONT_HERSHEY_PLAIN, 1.5, Scalar(0, 255, 0), 1, LINE_AA); //draw the string containing hsv components to the image
+    auto captured = pipeline.source<TrackFrame>("capture", [&](TrackFrame& frame) {
+        //read the owls camera frames
+        owl.getCameraFrames(frame.left, frame.right);
+        return true;
+    });
+    auto converted = pipeline.stage<TrackFrame>("convert", captured, [&](TrackFrame& frame) {
+        frame.faces = followFaces;
+        if (frame.faces)
+            return true; //the face tracker works on its own downscaled grey image
+        cvtColor(frame.left, frame.hsvLeft, COLOR_BGR2HSV);
+        return true;
+    });
+    auto thresholded = pipeline.stage<TrackFrame>("threshold", converted, [&](TrackFrame& frame) {
+        if (frame.faces) {
+            //steer at the middle of the face, or hold still while there is none
+            float score = 0.f;
+            if (faceTracker.update(frame.left, frame.face, score))
+                frame.center = (frame.face.tl() + frame.face.br())/2;
+            else {
+                frame.face = Rect();
+                frame.center = Point(FRAME_CENTER_X, FRAME_CENTER_Y);
+            }
+            frame.telemetry.confidence = score;
+            return true;
+        }
+        faceTracker.reset();
+        frame.face = Rect();
 
         //your tracking code here
-        cvtColor(left, hsvLeft, COLOR_BGR2HSV);
-        inRange(hsvLeft, Scalar(hsv.lh, hsv.ls, hsv.lv), Scalar(hsv.hh, hsv.hs, hsv.hv), filteredLeft);
+        HSVConfig range;
+        {
+            lock_guard<mutex> lock(hsvMutex);
+            range = hsv;
+        }
+        inRange(frame.hsvLeft, Scalar(range.lh, range.ls, range.lv), Scalar(range.hh, range.hs, range.hv), frame.filteredLeft);
 
-        Moments m = moments(filteredLeft, true);
+        Moments m = moments(frame.filteredLeft, true);
         Point center{int(m.m10/m.m00), int(m.m01/m.m00)};
+        frame.telemetry.confidence = m.m00 > 0 ? 1.f : 0.f;
         // check if the center is out of frame
         center.x = (center.x > FRAME_HEIGHT) || (center.x < -FRAME_HEIGHT) ? FRAME_CENTER_X : center.x;
         center.y = (center.y > FRAME_HEIGHT) || (center.y < -FRAME_HEIGHT) ? FRAME_CENTER_Y : center.y;
-        circle(left, center, 5, Scalar(128), -1);
-        circle(filteredLeft, center, 5, Scalar(128), -1);
-
-        if (tracking) {
-            string statusText = "head tracking enabled";
-            putText(left, statusText, {5, FRAME_HEIGHT - 5}, FONT_HERSHEY_PLAIN, 1.5, Scalar(0, 255, 0), 1, LINE_AA);
+        frame.center = center;
+        return true;
+    });
+    auto controlled = pipeline.stage<TrackFrame>("control", thresholded, [&](TrackFrame& frame) {
+        frame.tracking = tracking;
+        if (frame.tracking) {
 
             int xr, yr, xl, yl, neck;
             owl.getRelativeServoPositions(xr, yr, xl, yl, neck);
-            int xDiff = center.x - FRAME_CENTER_X;
+            int xDiff = frame.center.x - FRAME_CENTER_X;
             int xMove = int(xDiff * MOVE_FACTOR_X);
             int neckMove = (xl < 50) && (xl > -50) ? 0 : int(xl * MOVE_FACTOR_NECK);
 
-            int yDiff = center.y - FRAME_CENTER_Y;
+            int yDiff = frame.center.y - FRAME_CENTER_Y;
             int yMove = int(yDiff * MOVE_FACTOR_Y);
 
             owl.setServoRelativePositions(0, 0, xMove, -yMove, neckMove);
-        } else {
-            string statusText = "head tracking disbaled";
-            putText(left, statusText, {5, FRAME_HEIGHT - 5}, FONT_HERSHEY_PLAIN, 1.5, Scalar(0, 255, 0), 1, LINE_AA);
+        }
+        int32_t* servos = frame.telemetry.servos;
+        owl.getRawServoPositions(servos[0], servos[1], servos[2], servos[3], servos[4]);
+        return true;
+    });
+    TelemetryWriter telemetry;
+    uint64_t frameId = 0;
+    pipeline.sink<TrackFrame>("display", controlled, [&](TrackFrame& frame) {
+        frame.telemetry.frameId = frameId++;
+        pipeline.lastStageTimes(frame.telemetry.stageMs, TELEMETRY_STAGES);
+        telemetry.publish(frame.telemetry);
+
+        if (!display.headless()) {
+            string trackText = "t = toggle tracking";
+            string saveText = "s = save hsv config";
+            string faceText = frame.faces ? "f = follow colour" : "f = follow faces";
+            string quitText = "q = quit";
+            putText(frame.left, trackText, {5, 30}, FONT_HERSHEY_PLAIN, 1.5, Scalar(0, 255, 0), 1, LINE_AA); //draw the string containing hsv components to the image
+            putText(frame.left, saveText, {5, 60}, FONT_HERSHEY_PLAIN, 1.5, Scalar(0, 255, 0), 1, LINE_AA); //draw the string containing hsv components to the image
+            putText(frame.left, faceText, {5, 90}, FONT_HERSHEY_PLAIN, 1.5, Scalar(0, 255, 0), 1, LINE_AA);
+            putText(frame.left, quitText, {5, 120}, FONT_HERSHEY_PLAIN, 1.5, Scalar(0, 255, 0), 1, LINE_AA); //draw the string containing hsv components to the image
+            circle(frame.left, frame.center, 5, Scalar(128), -1);
+            if (frame.face.area() > 0)
+                rectangle(frame.left, frame.face, Scalar(0, 255, 0), 2);
+            if (!frame.faces)
+                circle(frame.filteredLeft, frame.center, 5, Scalar(128), -1);
+            string statusText = frame.tracking ? "head tracking enabled" : "head tracking disbaled";
+            putText(frame.left, statusText, {5, FRAME_HEIGHT - 5}, FONT_HERSHEY_PLAIN, 1.5, Scalar(0, 255, 0), 1, LINE_AA);
         }
 
         //display camera frame
-        imshow(kWinTitleRaw, left);
-        imshow(kWinTitleFiltered, filteredLeft);
-        switch(waitKey(10)) {
-        case 'q':
-        case 27: // ESC
-            running = false;
-            break;
-        case 's':
-            saveConfig(HSV_CONFIG_FILEPATH, hsv);
-            break;
-        case 't':
-            tracking = !tracking;
+        display.show(kWinTitleRaw, frame.left);
+        if (!frame.faces)
+            display.show(kWinTitleFiltered, frame.filteredLeft);
+        DisplayEvent event;
+        while (display.pollEvent(event)) {
+            if (event.type == DisplayEvent::TRACKBAR) {
+                lock_guard<mutex> lock(hsvMutex);
+                onTrackbar(event, display);
+                continue;
+            }
+            if (event.type != DisplayEvent::KEY) {
+                continue;
+            }
+            switch(event.key) {
+            case 'q':
+            case 27: // ESC
+                pipeline.requestStop();
+                break;
+            case 's': {
+                lock_guard<mutex> lock(hsvMutex);
+                saveConfig(HSV_CONFIG_FILEPATH, hsv);
+                break;
+            }
+            case 'p':
+                pipeline.report(cout);
+                owlFramePool().report(cout);
+                break;
+            case 't':
+                tracking = !tracking;
+                break;
+            case 'f':
+                if (faceTracker.loaded() || faceTracker.load(cascadePath))
+                    followFaces = !followFaces;
+            }
         }
-    }
+        return true;
+    });
+
+    if (!telemetry.open(TELEMETRY_TOOL, pipeline.stageNames()))
+        cout << "Telemetry ring unavailable, running without it" << endl;
+    pipeline.start();
+    pipeline.wait();
+    pipeline.report(cout);
+    owlFramePool().report(cout);
+}
 
+static void onTrackbar(const DisplayEvent& event, DisplayService& display)
+{
+    if (event.name == "Low Hue")       onLowHueThreshTrackbar(event.pos, display);
+    else if (event.name == "High Hue") onHighHueThreshTrackbar(event.pos, display);
+    else if (event.name == "Low Sat")  onLowSatThreshTrackbar(event.pos, display);
+    else if (event.name == "High Sat") onHighSatThreshTrackbar(event.pos, display);
+    else if (event.name == "Low Val")  onLowValThreshTrackbar(event.pos, display);
+    else if (event.name == "High Val") onHighValThreshTrackbar(event.pos, display);
 }
 
-static void onLowHueThreshTrackbar(int, void *)
+static void onLowHueThreshTrackbar(int pos, DisplayService& display)
 {
-    hsv.lh = min(hsv.hh-1, hsv.lh);
-    setTrackbarPos("Low Hue", kWinTitleRaw, hsv.lh);
+    hsv.lh = min(hsv.hh-1, pos);
+    if (hsv.lh != pos) //moved past the other end of the range, push the slider back
+        display.setTrackbarPos("Low Hue", kWinTitleRaw, hsv.lh);
 }
-static void onHighHueThreshTrackbar(int, void *)
+static void onHighHueThreshTrackbar(int pos, DisplayService& display)
 {
-    hsv.hh = max(hsv.hh, hsv.lh+1);
-    setTrackbarPos("High Hue", kWinTitleRaw, hsv.hh);
+    hsv.hh = max(pos, hsv.lh+1);
+    if (hsv.hh != pos)
+        display.setTrackbarPos("High Hue", kWinTitleRaw, hsv.hh);
 }
-static void onLowSatThreshTrackbar(int, void *)
+static void onLowSatThreshTrackbar(int pos, DisplayService& display)
 {
-    hsv.ls = min(hsv.hs-1, hsv.ls);
-    setTrackbarPos("Low Sat", kWinTitleRaw, hsv.ls);
+    hsv.ls = min(hsv.hs-1, pos);
+    if (hsv.ls != pos)
+        display.setTrackbarPos("Low Sat", kWinTitleRaw, hsv.ls);
 }
-static void onHighSatThreshTrackbar(int, void *)
+static void onHighSatThreshTrackbar(int pos, DisplayService& display)
 {
-    hsv.hs = max(hsv.hs, hsv.ls+1);
-    setTrackbarPos("High Sat", kWinTitleRaw, hsv.hs);
+    hsv.hs = max(pos, hsv.ls+1);
+    if (hsv.hs != pos)
+        display.setTrackbarPos("High Sat", kWinTitleRaw, hsv.hs);
 }
-static void onLowValThreshTrackbar(int, void *)
+static void onLowValThreshTrackbar(int pos, DisplayService& display)
 {
-    hsv.lv = min(hsv.hv-1, hsv.lv);
-    setTrackbarPos("Low Val", kWinTitleRaw, hsv.lv);
+    hsv.lv = min(hsv.hv-1, pos);
+    if (hsv.lv != pos)
+        display.setTrackbarPos("Low Val", kWinTitleRaw, hsv.lv);
 }
-static void onHighValThreshTrackbar(int, void *)
+static void onHighValThreshTrackbar(int pos, DisplayService& display)
 {
-    hsv.hv = max(hsv.hv, hsv.lv+1);
-    setTrackbarPos("High Val", kWinTitleRaw, hsv.hv);
+    hsv.hv = max(pos, hsv.lv+1);
+    if (hsv.hv != pos)
+        display.setTrackbarPos("High Val", kWinTitleRaw, hsv.hv);
 }
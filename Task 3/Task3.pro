@@ -24,4 +24,10 @@ SOURCES += \
 
 HEADERS += \
     ..\owl.h \
+    ..\frame_pool.h \
+    ..\telemetry.h \
+    ..\stream_stats.h \
+    ..\display_service.h \
+    ..\hud_overlay.h \
+    ..\pipeline.h \
 
@@ -6,9 +6,16 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <atomic>
+#include <mutex>
 #include <cmath>
 
 #include "../owl.h"
+#include "../stream_stats.h"
+#include "../display_service.h"
+#include "../hud_overlay.h"
+#include "../pipeline.h"
+#include "../telemetry.h"
 
 using namespace std;
 using namespace cv;
@@ -19,83 +26,168 @@ using namespace cv;
 #define MOVE_FACTOR 0.1f
 #define INTER_EYE_DIST 67
 #define SERVO_UPDATE_INTERVAL 250ms
+#define DISTANCE_WINDOW 15     // median over the last half second of frames
+#define DISTANCE_ALPHA 0.2     // smoothing applied on top of the median
+#define DISTANCE_MAX 10000.f   // nearly parallel eyes give huge or infinite ranges, drop them
+#define TRACK_FLAG "-track"    // take the target from the middle of the view and track it, for unattended runs
+#define TRACK_START_FRAMES 15  // frames -track waits for the stream and the servos to settle first
+#define TELEMETRY_TOOL "task3" // ring name the telemetry viewer is pointed at
 
 int   calculate_servo_movement(const Point& min_loc);
 float calculate_distance(float left_angle, float right_angle);
 void  draw_selection_overlay(Mat& left, const Rect& target_pos);
 void  draw_target_overlay(Mat& left, Mat& right, const Point& l_min_loc, const Point& r_min_loc, float distance);
-void  draw_tracking_overlay(Mat& left, Mat& right, bool tracking);
-void  draw_help_overlay(Mat& left, Mat& right);
 
-int main()
+// one frame on its way through the pipeline
+struct TrackFrame {
+    Mat left, right, target, l_match, r_match;
+    bool selecting = true, tracking = false;
+    Point l_min_loc, r_min_loc;
+    float distance = 0.f;
+    TelemetryRecord telemetry;
+};
+
+// static text only needs rasterising once, see hud_overlay.h
+struct HelpOverlay {
+    HudOverlay hud{Size(FRAME_W, FRAME_H)};
+    int tracking_on = 0, tracking_off = 0;
+};
+void  build_help_overlay(HelpOverlay& overlay);
+void  draw_help_overlay(HelpOverlay& overlay, Mat& left, Mat& right, bool tracking);
+
+int main(int argc, char** argv)
 {
     // connect with the owl and load calibration values
     robotOwl owl(1475, 1510, 1550, 1440, 1560);
+    DisplayService display(displayHeadless(argc, argv));
+    HelpOverlay help_overlay;
+    build_help_overlay(help_overlay);
     int rx_rst, ry_rst, lx_rst, ly_rst, neck;
     owl.getRawServoPositions(rx_rst, ry_rst, lx_rst, ly_rst, neck);
 
-    Mat left, right, target, l_match, r_match;
     Rect target_pos(FRAME_W/2 - TARGET_SIZE/2, FRAME_H/2 - TARGET_SIZE/2, TARGET_SIZE, TARGET_SIZE);
 
-    double l_min_val, l_max_val, r_min_val, r_max_val;
-    Point l_min_loc, l_max_loc, r_min_loc, r_max_loc;
+    // the median rejects single frame template mismatches, the ema steadies what is left
+    WindowMedian<float, DISTANCE_WINDOW> distance_median(0.f, DISTANCE_MAX);
+    ExponentialAverage<double> distance_smooth(DISTANCE_ALPHA);
 
-    bool running = true, selecting = true, tracking = false;
+    // set by the keys on the display stage, acted on by the stage that owns the resource
+    atomic<bool> selecting(true), tracking(false), reset_servos(false), clear_distance(false);
+    int auto_track_frames = -1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], TRACK_FLAG) == 0) {
+            auto_track_frames = TRACK_START_FRAMES;
+        }
+    }
+    mutex target_mutex;
+    Mat target;
     auto time_prev = chrono::high_resolution_clock::now();
     chrono::milliseconds time_elap = 0ms;
 
-    while (running)
-    {
-        // read the owls camera frames
-        owl.getCameraFrames(left, right);
+    // capture -> match -> control -> display on their own threads, matching the next frame overlaps drawing this one
+    Pipeline pipeline;
+    auto captured = pipeline.source<TrackFrame>("capture", [&](TrackFrame& frame) {
+        // read the owls camera frames, the frame carries the mode and target it was taken under
+        owl.getCameraFrames(frame.left, frame.right);
+        if (auto_track_frames >= 0 && auto_track_frames-- == 0) {
+            lock_guard<mutex> lock(target_mutex);
+            target = frame.left(target_pos).clone();
+            selecting = false;
+            tracking = true;
+        }
+        frame.selecting = selecting;
+        frame.tracking = tracking;
+        lock_guard<mutex> lock(target_mutex);
+        frame.target = target;
+        return true;
+    });
+    auto matched = pipeline.stage<TrackFrame>("match", captured, [](TrackFrame& frame) {
+        if (frame.selecting || frame.target.empty()) {
+            return true;
+        }
+        // match target image to frames and min target in location
+        double l_min_val, l_max_val, r_min_val, r_max_val;
+        Point l_max_loc, r_max_loc;
+        matchTemplate(frame.left, frame.target, frame.l_match, TM_SQDIFF_NORMED);
+        matchTemplate(frame.right, frame.target, frame.r_match, TM_SQDIFF_NORMED);
+        minMaxLoc(frame.l_match, &l_min_val, &l_max_val, &frame.l_min_loc, &l_max_loc);
+        minMaxLoc(frame.r_match, &r_min_val, &r_max_val, &frame.r_min_loc, &r_max_loc);
+        // the worse of the two eyes, a normalised squared difference of 0 is a perfect match
+        frame.telemetry.confidence = float(1.0 - max(l_min_val, r_min_val));
+        return true;
+    });
+    auto controlled = pipeline.stage<TrackFrame>("control", matched, [&](TrackFrame& frame) {
+        // servo commands all go out from this stage so they never interleave
+        if (reset_servos.exchange(false)) {
+            owl.setServoRawPositions(rx_rst, ry_rst, lx_rst, ly_rst, neck);
+        }
+        if (clear_distance.exchange(false)) {
+            distance_median.clear();
+            distance_smooth.clear();
+        }
+        int32_t* servos = frame.telemetry.servos;
+        owl.getRawServoPositions(servos[0], servos[1], servos[2], servos[3], servos[4]);
+        if (frame.selecting) {
+            return true;
+        }
+
+        // get servo control parameters
+        int l_move = calculate_servo_movement(frame.l_min_loc);
+        int r_move = calculate_servo_movement(frame.r_min_loc);
 
-        // selection mode or tracking mode
-        if (selecting) {
-            draw_selection_overlay(left, target_pos);
-            imshow("left", left);
-        } else {
-            // match target image to frames and min target in location
-            matchTemplate(left, target, l_match, TM_SQDIFF_NORMED);
-            matchTemplate(right, target, r_match, TM_SQDIFF_NORMED);
-            minMaxLoc(l_match, &l_min_val, &l_max_val, &l_min_loc, &l_max_loc);
-            minMaxLoc(r_match, &r_min_val, &r_max_val, &r_min_loc, &r_max_loc);
-
-            // get servo control parameters
-            int l_move = calculate_servo_movement(l_min_loc);
-            int r_move = calculate_servo_movement(r_min_loc);
-
-            // move servos if tracking is enabled
-            if (tracking) {
-                time_elap += chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - time_prev);
-                if (time_elap >= SERVO_UPDATE_INTERVAL) {
-                    owl.setServoRelativePositions(r_move, 0, l_move, 0, 0);
-                    time_elap = 0ms;
-                }
-                time_prev = chrono::high_resolution_clock::now();
+        // move servos if tracking is enabled
+        if (frame.tracking) {
+            time_elap += chrono::duration_cast<chrono::milliseconds>(chrono::high_resolution_clock::now() - time_prev);
+            if (time_elap >= SERVO_UPDATE_INTERVAL) {
+                owl.setServoRelativePositions(r_move, 0, l_move, 0, 0);
+                time_elap = 0ms;
             }
+            time_prev = chrono::high_resolution_clock::now();
+        }
 
-            // calculate distance from servo angles
-            float l_angle, r_angle, distance;
-            owl.getServoAngles(l_angle, r_angle);
-            distance = calculate_distance(l_angle, r_angle);
-
-            // display camera frames
-            draw_target_overlay(left, right, l_min_loc, r_min_loc, distance);
-            draw_tracking_overlay(left, right, tracking);
-            draw_help_overlay(left, right);
-            imshow("left", left);
-            imshow("right", right);
+        // calculate distance from servo angles
+        float l_angle, r_angle;
+        owl.getServoAngles(l_angle, r_angle);
+        float distance = calculate_distance(l_angle, r_angle);
+        if (distance_median.push(distance)) {
+            distance_smooth.push(distance_median.median());
+        }
+        frame.distance = float(distance_smooth.value());
+        frame.telemetry.distance = frame.distance;
+        return true;
+    });
+    TelemetryWriter telemetry;
+    uint64_t frame_id = 0;
+    pipeline.sink<TrackFrame>("display", controlled, [&](TrackFrame& frame) {
+        frame.telemetry.frameId = frame_id++;
+        pipeline.lastStageTimes(frame.telemetry.stageMs, TELEMETRY_STAGES);
+        telemetry.publish(frame.telemetry);
+
+        // selection mode or tracking mode
+        if (!display.headless()) {
+            if (frame.selecting) {
+                draw_selection_overlay(frame.left, target_pos);
+                display.show("left", frame.left);
+            } else {
+                // display camera frames
+                draw_target_overlay(frame.left, frame.right, frame.l_min_loc, frame.r_min_loc, frame.distance);
+                draw_help_overlay(help_overlay, frame.left, frame.right, frame.tracking);
+                display.show("left", frame.left);
+                display.show("right", frame.right);
+            }
         }
 
         // process user control
-        switch (waitKey(10)) {
+        switch (display.pollKey()) {
         case ' ':
             if (selecting) {
-                left(target_pos).copyTo(target);
-                imshow("target", target);
+                lock_guard<mutex> lock(target_mutex);
+                target = frame.left(target_pos).clone();
+                display.show("target", target);
             } else {
                 tracking = false;
-                owl.setServoRawPositions(rx_rst, ry_rst, lx_rst, ly_rst, neck);
+                reset_servos = true;
+                clear_distance = true;
             }
             selecting = !selecting;
             break;
@@ -103,14 +195,27 @@ int main()
             tracking = !tracking;
             break;
         case 'r':
-            owl.setServoRawPositions(rx_rst, ry_rst, lx_rst, ly_rst, neck);
+            reset_servos = true;
+            break;
+        case 'p':
+            pipeline.report(cout);
+            owlFramePool().report(cout);
             break;
         case 'q':
         case 27:
-            running = false;
+            pipeline.requestStop();
             break;
         }
+        return true;
+    });
+
+    if (!telemetry.open(TELEMETRY_TOOL, pipeline.stageNames())) {
+        cout << "Telemetry ring unavailable, running without it" << endl;
     }
+    pipeline.start();
+    pipeline.wait();
+    pipeline.report(cout);
+    owlFramePool().report(cout);
 }
 
 // calculate how much to move servos to bring the target into the center of the frame
@@ -136,6 +241,7 @@ float calculate_distance(float left_angle, float right_angle) {
     float eye_angle = float(M_PI) - left_angle - right_angle;
     // calculate left eye distance using sine laws
     float left_dist = INTER_EYE_DIST*sin(right_angle)/sin(eye_angle);
+    return left_dist;
 }
 
 // draw target selection box and key binding info text
@@ -152,25 +258,25 @@ void draw_target_overlay(Mat& left, Mat& right, const Point& l_min_loc, const Po
     putText(right, to_string(distance) + "mm", {r_min_loc.x, r_min_loc.y-5}, FONT_HERSHEY_PLAIN, 1.5, Scalar(0, 255, 0), 1, LINE_AA);
 }
 
-// draw tracking status info
-void draw_tracking_overlay(Mat& left, Mat& right, bool tracking) {
-    if (tracking) {
-        putText(left, "tracking enabled", {5, FRAME_H-85}, FONT_HERSHEY_PLAIN, 1.5, Scalar(0, 255, 0), 1, LINE_AA);
-        putText(right, "tracking enabled", {5, FRAME_H-85}, FONT_HERSHEY_PLAIN, 1.5, Scalar(0, 255, 0), 1, LINE_AA);
-    } else {
-        putText(left, "tracking disbaled", {5, FRAME_H-85}, FONT_HERSHEY_PLAIN, 1.5, Scalar(0, 0, 255), 1, LINE_AA);
-        putText(right, "tracking disbaled", {5, FRAME_H-85}, FONT_HERSHEY_PLAIN, 1.5, Scalar(0, 0, 255), 1, LINE_AA);
-    }
+// help and tracking status text, rasterised once and blended over both eyes
+void build_help_overlay(HelpOverlay& overlay) {
+    auto text = [](const string& line, int y) {
+        return [line, y](Mat& mask, int) {
+            putText(mask, line, {5, y}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255), 1, LINE_AA);
+        };
+    };
+    overlay.tracking_on = overlay.hud.add(text("tracking enabled", FRAME_H-85), Scalar(0, 255, 0));
+    overlay.tracking_off = overlay.hud.add(text("tracking disbaled", FRAME_H-85), Scalar(0, 0, 255));
+    overlay.hud.add(text("press t to toggle tracking", FRAME_H-65), Scalar(255, 255, 0));
+    overlay.hud.add(text("press r to reset servos", FRAME_H-45), Scalar(255, 255, 0));
+    overlay.hud.add(text("press space to select new target", FRAME_H-25), Scalar(255, 255, 0));
+    overlay.hud.add(text("press q to quit", FRAME_H-5), Scalar(255, 255, 0));
 }
 
-// draw key binding help
-void draw_help_overlay(Mat& left, Mat& right) {
-    putText(left, "press t to toggle tracking", {5, FRAME_H-65}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 0), 1, LINE_AA);
-    putText(right, "press t to toggle tracking", {5, FRAME_H-65}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 0), 1, LINE_AA);
-    putText(left, "press r to reset servos", {5, FRAME_H-45}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 0), 1, LINE_AA);
-    putText(right, "press r to reset servos", {5, FRAME_H-45}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 0), 1, LINE_AA);
-    putText(left, "press space to select new target", {5, FRAME_H-25}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 0), 1, LINE_AA);
-    putText(right, "press space to select new target", {5, FRAME_H-25}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 0), 1, LINE_AA);
-    putText(left, "press q to quit", {5, FRAME_H-5}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 0), 1, LINE_AA);
-    putText(right, "press q to quit", {5, FRAME_H-5}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 0), 1, LINE_AA);
+// draw tracking status and key binding help
+void draw_help_overlay(HelpOverlay& overlay, Mat& left, Mat& right, bool tracking) {
+    overlay.hud.setVisible(overlay.tracking_on, tracking);
+    overlay.hud.setVisible(overlay.tracking_off, !tracking);
+    overlay.hud.compose(left);
+    overlay.hud.compose(right);
 }
@@ -17,12 +17,34 @@ LIBS +=    -lopencv_core411 \
     -lopencv_imgcodecs411 \
     -lopencv_face411 \
     -lopencv_objdetect411 \
+    -lopencv_ximgproc411 \
 
 LIBS += -lws2_32
 
 #====================Project Includes======================
 SOURCES += \
-    main.cpp
+    main.cpp \
+    census_stereo.cpp \
+    depth_map.cpp \
+    disparity_recorder.cpp \
+    hierarchical_stereo.cpp \
+    point_cloud.cpp \
+    stereo_engine.cpp \
+    temporal_stereo.cpp \
+    wls_stereo.cpp
 
 HEADERS += \
-    ../owl.h
+    ../owl.h \
+    ../frame_pool.h \
+    ../telemetry.h \
+    ../display_service.h \
+    ../fnv1a.h \
+    ../rectification.h \
+    ../stream_stats.h \
+    ../pipeline.h \
+    census.h \
+    depth_map.h \
+    disparity_recorder.h \
+    point_cloud.h \
+    stereo_engine.h \
+    temporal_stereo.h
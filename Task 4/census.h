@@ -0,0 +1,25 @@
+#ifndef CENSUS_H
+#define CENSUS_H
+
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+#define CENSUS_RADIUS 2            // 5x5 census window, 24 comparison bits per pixel
+#define CENSUS_MAX_COST 24
+
+static inline int popcount32(uint32_t v) {
+#if defined(__GNUC__)
+    return __builtin_popcount(v);
+#else
+    v = v - ((v >> 1) & 0x55555555u);
+    v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+    return int((((v + (v >> 4)) & 0x0f0f0f0fu)*0x01010101u) >> 24);
+#endif
+}
+
+// each pixel of an 8-bit grey image becomes a bit string (CV_32S) recording which neighbours are darker than it
+void census_transform(const cv::Mat& grey, cv::Mat& census);
+// out[x] = number of differing bits between a[x] and b[x], vectorised where the cpu allows
+void hamming_row(const uint32_t* a, const uint32_t* b, uchar* out, int n);
+
+#endif // CENSUS_H
@@ -0,0 +1,260 @@
+#include "stereo_engine.h"
+#include "census.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <opencv2/imgproc.hpp>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CENSUS_X86_SIMD
+// mingw-w64 gcc only keeps the stack 16 byte aligned (gcc bug 54412), so spilled __m256i temporaries in an
+// unoptimised debug build crash on the aligned moves. windows builds stay on the 128-bit path
+#ifndef __MINGW32__
+#define CENSUS_AVX2
+#endif
+#endif
+
+using namespace cv;
+using namespace std;
+
+#define CENSUS_STRIPE_ROWS 32      // rows matched per parallel job
+#define CENSUS_UNIQUENESS 10       // percent margin the best cost needs over the next best
+#define CENSUS_SPECKLE_WINDOW 100
+#define CENSUS_SPECKLE_RANGE 2     // pixels
+
+#ifdef CENSUS_AVX2
+// same as the ssse3 version below, 8 words at a time
+__attribute__((target("avx2")))
+static int hamming_row_avx2(const uint32_t* a, const uint32_t* b, uchar* out, int n) {
+    const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4, 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    const __m256i ones8 = _mm256_set1_epi8(1);
+    const __m256i ones16 = _mm256_set1_epi16(1);
+    const __m256i pack = _mm256_setr_epi8(0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+                                          0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + x)),
+                                     _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + x)));
+        __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, low_mask)),
+                                        _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask)));
+        __m256i sums = _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, ones8), ones16);
+        __m256i packed = _mm256_shuffle_epi8(sums, pack);
+        uint32_t lo = uint32_t(_mm256_extract_epi32(packed, 0));
+        uint32_t hi = uint32_t(_mm256_extract_epi32(packed, 4));
+        memcpy(out + x, &lo, 4);
+        memcpy(out + x + 4, &hi, 4);
+    }
+    return x;
+}
+#endif
+
+#ifdef CENSUS_X86_SIMD
+// popcount of 4 xor'd census words at a time. per byte counts come from a nibble lookup with pshufb,
+// maddubs/madd add them up per 32-bit lane and a final shuffle packs the 4 results into bytes.
+__attribute__((target("ssse3")))
+static int hamming_row_ssse3(const uint32_t* a, const uint32_t* b, uchar* out, int n) {
+    const __m128i lut = _mm_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    const __m128i ones8 = _mm_set1_epi8(1);
+    const __m128i ones16 = _mm_set1_epi16(1);
+    const __m128i pack = _mm_setr_epi8(0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+    int x = 0;
+    for (; x + 4 <= n; x += 4) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x)),
+                                  _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x)));
+        __m128i bytes = _mm_add_epi8(_mm_shuffle_epi8(lut, _mm_and_si128(v, low_mask)),
+                                     _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), low_mask)));
+        __m128i sums = _mm_madd_epi16(_mm_maddubs_epi16(bytes, ones8), ones16);
+        uint32_t packed = uint32_t(_mm_cvtsi128_si32(_mm_shuffle_epi8(sums, pack)));
+        memcpy(out + x, &packed, 4);
+    }
+    return x;
+}
+#endif
+
+typedef int (*HammingRowFn)(const uint32_t*, const uint32_t*, uchar*, int);
+
+static HammingRowFn select_hamming_row() {
+    // avx2 is left out of mingw builds, see CENSUS_AVX2
+#ifdef CENSUS_AVX2
+    if (checkHardwareSupport(CV_CPU_AVX2)) {
+        return hamming_row_avx2;
+    }
+#endif
+#ifdef CENSUS_X86_SIMD
+    if (checkHardwareSupport(CV_CPU_SSSE3)) {
+        return hamming_row_ssse3;
+    }
+#endif
+    return nullptr;
+}
+
+void hamming_row(const uint32_t* a, const uint32_t* b, uchar* out, int n) {
+    static const HammingRowFn simd = select_hamming_row();
+    int x = simd ? simd(a, b, out, n) : 0;
+    for (; x < n; x++) {
+        out[x] = uchar(popcount32(a[x] ^ b[x]));
+    }
+}
+
+void census_transform(const Mat& grey, Mat& census) {
+    Mat padded;
+    copyMakeBorder(grey, padded, CENSUS_RADIUS, CENSUS_RADIUS, CENSUS_RADIUS, CENSUS_RADIUS, BORDER_REPLICATE);
+    census.create(grey.size(), CV_32S);
+    parallel_for_(Range(0, grey.rows), [&](const Range& range) {
+        for (int y = range.start; y < range.end; y++) {
+            uint32_t* out = census.ptr<uint32_t>(y);
+            for (int x = 0; x < grey.cols; x++) {
+                uchar centre = padded.at<uchar>(y + CENSUS_RADIUS, x + CENSUS_RADIUS);
+                uint32_t bits = 0;
+                for (int dy = -CENSUS_RADIUS; dy <= CENSUS_RADIUS; dy++) {
+                    const uchar* row = padded.ptr<uchar>(y + CENSUS_RADIUS + dy) + x + CENSUS_RADIUS;
+                    for (int dx = -CENSUS_RADIUS; dx <= CENSUS_RADIUS; dx++) {
+                        if (dx != 0 || dy != 0) {
+                            bits = (bits << 1) | uint32_t(row[dx] < centre);
+                        }
+                    }
+                }
+                out[x] = bits;
+            }
+        }
+    });
+}
+
+// census transform + hamming cost block matcher. no smoothness term like SGBM, so it is noisier on
+// weak texture but only needs a popcount and a box filter per disparity.
+class CensusEngine : public StereoEngine {
+public:
+    CensusEngine(int block_size, int num_disparities)
+        : block_size_(block_size), num_disparities_(num_disparities) {
+    }
+    string name() const override { return "census"; }
+    void compute(const Mat& left, const Mat& right, Mat& disp) override;
+    Ptr<StereoEngine> clone() const override {
+        Ptr<StereoEngine> engine = makePtr<CensusEngine>(block_size_, num_disparities_);
+        engine->set_min_disparity(min_disparity_);
+        return engine;
+    }
+    void set_block_size(int block_size) override { block_size_ = block_size | 1; }
+    void set_num_disparities(int num_disparities) override { num_disparities_ = num_disparities; }
+    // the cost loop indexes the right image at x-d, so negative disparities are not supported
+    void set_min_disparity(int min_disparity) override { min_disparity_ = max(0, min_disparity); }
+    int block_size() const override { return block_size_; }
+    int num_disparities() const override { return num_disparities_; }
+    int min_disparity() const override { return min_disparity_; }
+
+private:
+    void match_stripe(int y0, int y1, Mat& disp) const;
+
+    int block_size_, num_disparities_, min_disparity_ = 0;
+    Mat left_grey_, right_grey_, census_left_, census_right_;
+};
+
+void CensusEngine::compute(const Mat& left, const Mat& right, Mat& disp) {
+    if (left.channels() == 3) {
+        cvtColor(left, left_grey_, COLOR_BGR2GRAY);
+        cvtColor(right, right_grey_, COLOR_BGR2GRAY);
+    } else {
+        left_grey_ = left;
+        right_grey_ = right;
+    }
+    census_transform(left_grey_, census_left_);
+    census_transform(right_grey_, census_right_);
+
+    disp.create(left.size(), CV_16S);
+    int stripes = (left.rows + CENSUS_STRIPE_ROWS - 1)/CENSUS_STRIPE_ROWS;
+    parallel_for_(Range(0, stripes), [&](const Range& range) {
+        for (int s = range.start; s < range.end; s++) {
+            match_stripe(s*CENSUS_STRIPE_ROWS, min(left.rows, (s + 1)*CENSUS_STRIPE_ROWS), disp);
+        }
+    });
+
+    filterSpeckles(disp, (min_disparity_ - 1)*16, CENSUS_SPECKLE_WINDOW, CENSUS_SPECKLE_RANGE*16);
+}
+
+// winner-takes-all over the aggregated hamming costs for rows [y0, y1). the costs either side of the
+// winner are kept for a parabolic sub-pixel fit.
+void CensusEngine::match_stripe(int y0, int y1, Mat& disp) const {
+    const int cols = census_left_.cols;
+    const int radius = block_size_/2;
+    const int ext0 = max(0, y0 - radius), ext1 = min(census_left_.rows, y1 + radius);
+    const int rows = y1 - y0;
+    const int max_disp = min_disparity_ + num_disparities_;
+
+    Mat cost(ext1 - ext0, cols, CV_8U), agg;
+    Mat best_cost(rows, cols, CV_16U, Scalar(USHRT_MAX)), second_cost(rows, cols, CV_16U, Scalar(USHRT_MAX));
+    Mat prev_cost(rows, cols, CV_16U, Scalar(USHRT_MAX)), next_cost(rows, cols, CV_16U, Scalar(USHRT_MAX));
+    Mat last_agg(rows, cols, CV_16U, Scalar(USHRT_MAX));
+    Mat best_disp(rows, cols, CV_16S, Scalar(min_disparity_ - 1));
+
+    for (int d = min_disparity_; d < max_disp; d++) {
+        for (int r = 0; r < cost.rows; r++) {
+            uchar* c = cost.ptr<uchar>(r);
+            int blank = min(d, cols);
+            memset(c, CENSUS_MAX_COST, size_t(blank));
+            if (blank < cols) {
+                hamming_row(census_left_.ptr<uint32_t>(ext0 + r) + d, census_right_.ptr<uint32_t>(ext0 + r),
+                            c + d, cols - d);
+            }
+        }
+        boxFilter(cost, agg, CV_16U, Size(block_size_, block_size_), Point(-1, -1), false, BORDER_REPLICATE);
+
+        for (int i = 0; i < rows; i++) {
+            const ushort* a = agg.ptr<ushort>(y0 - ext0 + i);
+            ushort* bc = best_cost.ptr<ushort>(i);
+            ushort* sc = second_cost.ptr<ushort>(i);
+            ushort* pc = prev_cost.ptr<ushort>(i);
+            ushort* nc = next_cost.ptr<ushort>(i);
+            ushort* la = last_agg.ptr<ushort>(i);
+            short* bd = best_disp.ptr<short>(i);
+            for (int x = 0; x < cols; x++) {
+                ushort c = a[x];
+                if (c < bc[x]) {
+                    // the old winner only counts as a rival if it is not right next to the new one
+                    if (bd[x] != d - 1) {
+                        sc[x] = min(sc[x], bc[x]);
+                    }
+                    bc[x] = c;
+                    bd[x] = short(d);
+                    pc[x] = la[x];
+                    nc[x] = USHRT_MAX;
+                } else if (bd[x] == d - 1) {
+                    nc[x] = c;
+                } else {
+                    sc[x] = min(sc[x], c);
+                }
+                la[x] = c;
+            }
+        }
+    }
+
+    const short invalid = short((min_disparity_ - 1)*16);
+    for (int i = 0; i < rows; i++) {
+        const ushort* bc = best_cost.ptr<ushort>(i);
+        const ushort* sc = second_cost.ptr<ushort>(i);
+        const ushort* pc = prev_cost.ptr<ushort>(i);
+        const ushort* nc = next_cost.ptr<ushort>(i);
+        const short* bd = best_disp.ptr<short>(i);
+        short* out = disp.ptr<short>(y0 + i);
+        for (int x = 0; x < cols; x++) {
+            // same validity rules as SGBM: no output until the whole range fits, and a unique minimum
+            if (x < max_disp || int(sc[x])*(100 - CENSUS_UNIQUENESS) < int(bc[x])*100) {
+                out[x] = invalid;
+                continue;
+            }
+            int d16 = bd[x]*16;
+            if (pc[x] != USHRT_MAX && nc[x] != USHRT_MAX) {
+                int denom2 = max(int(pc[x]) + int(nc[x]) - 2*int(bc[x]), 1);
+                d16 += ((int(pc[x]) - int(nc[x]))*16 + denom2)/(denom2*2);
+            }
+            out[x] = short(d16);
+        }
+    }
+}
+
+Ptr<StereoEngine> create_census_engine(int block_size, int num_disparities) {
+    return makePtr<CensusEngine>(block_size, num_disparities);
+}
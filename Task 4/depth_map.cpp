@@ -0,0 +1,71 @@
+#include "depth_map.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace cv;
+using namespace std;
+
+#define DEPTH_STRIPE_ROWS 32
+
+DepthModel::DepthModel(double a, double d0)
+    : a_(a), d0_(d0), lut_(DEPTH_LUT_SIZE) {
+    build_lut();
+}
+
+bool DepthModel::fit(const vector<Point2d>& samples) {
+    if (samples.size() < DEPTH_MIN_SAMPLES) {
+        return false;
+    }
+    // regress disparity on inverse depth
+    double n = double(samples.size());
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (const Point2d& s : samples) {
+        double x = 1./s.y, y = s.x;
+        sx += x;
+        sy += y;
+        sxx += x*x;
+        sxy += x*y;
+    }
+    double denom = n*sxx - sx*sx;
+    if (fabs(denom) <= 1e-12*n*sxx) {
+        double product = 0;
+        for (const Point2d& s : samples) {
+            product += s.x*s.y;
+        }
+        a_ = product/n;
+        d0_ = 0.;
+    } else {
+        a_ = (n*sxy - sx*sy)/denom;
+        d0_ = (sy - a_*sx)/n;
+    }
+    build_lut();
+    return true;
+}
+
+void DepthModel::build_lut() {
+    // index is the raw 16-bit pattern, so negative disparities land in the upper half of the table
+    for (int i = 0; i < DEPTH_LUT_SIZE; i++) {
+        double d = double(short(uint16_t(i)));
+        double z = d > d0_ ? a_/(d - d0_) : 0.;
+        lut_[size_t(i)] = (z > 0. && z <= DEPTH_MAX_MM) ? uint16_t(lround(z)) : uint16_t(0);
+    }
+}
+
+void DepthModel::convert(const Mat& disp, Mat& depth) const {
+    CV_Assert(disp.type() == CV_16S);
+    depth.create(disp.size(), CV_16U);
+    const uint16_t* lut = lut_.data();
+    const int stripes = (disp.rows + DEPTH_STRIPE_ROWS - 1)/DEPTH_STRIPE_ROWS;
+    parallel_for_(Range(0, stripes), [&](const Range& range) {
+        int y_end = min(disp.rows, range.end*DEPTH_STRIPE_ROWS);
+        for (int y = range.start*DEPTH_STRIPE_ROWS; y < y_end; y++) {
+            const uint16_t* d = disp.ptr<uint16_t>(y);
+            uint16_t* z = depth.ptr<uint16_t>(y);
+            // the table covers all 65536 inputs, so the loop is branch free
+            for (int x = 0; x < disp.cols; x++) {
+                z[x] = lut[d[x]];
+            }
+        }
+    });
+}
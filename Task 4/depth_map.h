@@ -0,0 +1,40 @@
+#ifndef DEPTH_MAP_H
+#define DEPTH_MAP_H
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#define DEPTH_LUT_SIZE 65536        // one entry per CV_16S disparity value, indexed by its bit pattern
+#define DEPTH_MAX_MM 65535          // largest range a CV_16U depth pixel can hold
+#define DEPTH_MIN_SAMPLES 2         // the two parameter fit needs at least two distinct distances
+
+// disparity to metric depth using depth = a/(d - d0), d in the 1/16 pixel units the engines output.
+// a is the baseline*focal product and d0 absorbs any constant disparity offset from rectification or the
+// matcher. the model is baked into a table covering every 16-bit disparity, so converting a whole map is a
+// single lookup per pixel and invalid (negative or too small) disparities come out as 0mm.
+class DepthModel {
+public:
+    explicit DepthModel(double a, double d0 = 0.);
+
+    // least squares fit of d = a*(1/depth) + d0 over calibration samples (disparity, depth in mm), which is
+    // linear in the unknowns and weights the error in disparity where the matcher noise actually is.
+    // falls back to the d0 = 0 product average if the samples all sit at one distance. returns false and
+    // leaves the model unchanged if there are not enough samples.
+    bool fit(const std::vector<cv::Point2d>& samples);
+
+    // CV_16S disparity to CV_16U depth in millimetres, 0 where there is no valid range
+    void convert(const cv::Mat& disp, cv::Mat& depth) const;
+    uint16_t depth_at(short disparity) const { return lut_[uint16_t(disparity)]; }
+
+    double a() const { return a_; }
+    double d0() const { return d0_; }
+
+private:
+    void build_lut();
+
+    double a_, d0_;
+    std::vector<uint16_t> lut_;
+};
+
+#endif // DEPTH_MAP_H
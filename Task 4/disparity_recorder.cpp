@@ -0,0 +1,383 @@
+#include "disparity_recorder.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace cv;
+using namespace std;
+
+#define RECORD_BIG_RESIDUAL 64         // residuals past this need a second varint byte, the row cost counts them twice
+
+enum RowMode { ROW_SPATIAL = 0, ROW_TEMPORAL = 1 };
+
+// median edge predictor from LOCO-I: picks the left or upper neighbour across an edge, the planar estimate
+// elsewhere. disparity maps are mostly smooth surfaces cut by sharp edges, which is what it is built for
+static inline int predict_med(int left, int up, int up_left) {
+    int lo = min(left, up), hi = max(left, up);
+    if (up_left >= hi) {
+        return lo;
+    }
+    if (up_left <= lo) {
+        return hi;
+    }
+    return left + up - up_left;
+}
+
+// residuals wrap at 16 bits, so any predictor stays lossless and the stored value never needs more than 16 bits
+static inline uint32_t zigzag(int value, int prediction) {
+    int16_t r = int16_t(uint16_t(value - prediction));
+    return uint16_t((uint16_t(r) << 1) ^ uint16_t(r >> 15));
+}
+
+static inline int unzigzag(uint32_t code, int prediction) {
+    int r = int(code >> 1) ^ -int(code & 1);
+    return prediction + r;
+}
+
+static inline void put_varint(vector<uint8_t>& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back(uint8_t(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(uint8_t(v));
+}
+
+static inline bool get_varint(const uint8_t*& p, const uint8_t* end, uint32_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 32 && p < end; shift += 7) {
+        uint8_t byte = *p++;
+        v |= uint32_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// spatial prediction of pixel x in row y, the neighbours that do not exist fall back to the ones that do
+template <typename T>
+static inline int predict_spatial(const T* row, const T* up, int x) {
+    if (!up) {
+        return x > 0 ? row[x-1] : 0;
+    }
+    if (x == 0) {
+        return up[0];
+    }
+    return predict_med(row[x-1], up[x], up[x-1]);
+}
+
+// rough coded size of a row under each predictor, zeros are nearly free inside runs
+template <typename T>
+static RowMode choose_mode(const T* row, const T* up, const T* prev, int cols) {
+    int spatial = 0, temporal = 0;
+    for (int x = 0; x < cols; x++) {
+        int s = abs(int(int16_t(uint16_t(row[x] - predict_spatial(row, up, x)))));
+        int t = abs(int(int16_t(uint16_t(row[x] - prev[x]))));
+        spatial += (s != 0) + (s >= RECORD_BIG_RESIDUAL);
+        temporal += (t != 0) + (t >= RECORD_BIG_RESIDUAL);
+    }
+    return temporal < spatial ? ROW_TEMPORAL : ROW_SPATIAL;
+}
+
+template <typename T>
+static void encode_frame(const Mat& frame, const Mat& previous, bool key, vector<uint8_t>& out) {
+    const int rows = frame.rows, cols = frame.cols;
+    // one mode bit per row up front, then a single residual stream so runs carry on from row to row
+    size_t modes_at = out.size();
+    out.resize(modes_at + size_t(rows + 7)/8, 0);
+
+    uint32_t run = 0;
+    for (int y = 0; y < rows; y++) {
+        const T* row = frame.ptr<T>(y);
+        const T* up = y > 0 ? frame.ptr<T>(y-1) : nullptr;
+        const T* prev = key ? nullptr : previous.ptr<T>(y);
+        RowMode mode = prev ? choose_mode(row, up, prev, cols) : ROW_SPATIAL;
+        if (mode == ROW_TEMPORAL) {
+            out[modes_at + size_t(y)/8] |= uint8_t(1 << (y % 8));
+        }
+        for (int x = 0; x < cols; x++) {
+            int prediction = mode == ROW_TEMPORAL ? prev[x] : predict_spatial(row, up, x);
+            uint32_t code = zigzag(row[x], prediction);
+            if (code == 0) {
+                run++;
+                continue;
+            }
+            // a zero token is followed by the run length, anything else is a residual
+            if (run > 0) {
+                put_varint(out, 0);
+                put_varint(out, run - 1);
+                run = 0;
+            }
+            put_varint(out, code);
+        }
+    }
+    if (run > 0) {
+        put_varint(out, 0);
+        put_varint(out, run - 1);
+    }
+}
+
+template <typename T>
+static bool decode_frame(const uint8_t* data, size_t size, const Mat& previous, bool key, Mat& frame) {
+    const int rows = frame.rows, cols = frame.cols;
+    size_t mode_bytes = size_t(rows + 7)/8;
+    if (size < mode_bytes || (!key && previous.size() != frame.size())) {
+        return false;
+    }
+    const uint8_t* modes = data;
+    const uint8_t* p = data + mode_bytes;
+    const uint8_t* end = data + size;
+
+    uint32_t run = 0;
+    for (int y = 0; y < rows; y++) {
+        T* row = frame.ptr<T>(y);
+        const T* up = y > 0 ? frame.ptr<T>(y-1) : nullptr;
+        bool temporal = (modes[y/8] >> (y % 8)) & 1;
+        if (temporal && key) {
+            return false;
+        }
+        const T* prev = temporal ? previous.ptr<T>(y) : nullptr;
+        for (int x = 0; x < cols; x++) {
+            int prediction = temporal ? prev[x] : predict_spatial(row, up, x);
+            uint32_t code = 0;
+            if (run > 0) {
+                run--;
+            } else {
+                if (!get_varint(p, end, code)) {
+                    return false;
+                }
+                if (code == 0) {
+                    if (!get_varint(p, end, run)) {
+                        return false;
+                    }
+                }
+            }
+            row[x] = T(unzigzag(code, prediction));
+        }
+    }
+    return run == 0 && p == end;
+}
+
+void encode_depth_frame(const Mat& frame, const Mat& previous, bool key, vector<uint8_t>& out) {
+    CV_Assert(frame.type() == CV_16S || frame.type() == CV_16U);
+    CV_Assert(key || (previous.size() == frame.size() && previous.type() == frame.type()));
+    out.clear();
+    if (frame.type() == CV_16S) {
+        encode_frame<int16_t>(frame, previous, key, out);
+    } else {
+        encode_frame<uint16_t>(frame, previous, key, out);
+    }
+}
+
+bool decode_depth_frame(const uint8_t* data, size_t size, const Mat& previous, bool key, Mat& frame) {
+    if (frame.type() == CV_16S) {
+        return decode_frame<int16_t>(data, size, previous, key, frame);
+    }
+    if (frame.type() == CV_16U) {
+        return decode_frame<uint16_t>(data, size, previous, key, frame);
+    }
+    return false;
+}
+
+//==================================================Recorder=========================================================
+
+DepthRecorder::DepthRecorder(int key_interval, size_t queue_depth)
+    : key_interval_(max(1, key_interval)), queue_depth_(max<size_t>(1, queue_depth)) {
+}
+
+bool DepthRecorder::open(const string& path, Size size, int type) {
+    close();
+    CV_Assert(type == CV_16S || type == CV_16U);
+    out_.open(path, ios::binary | ios::trunc);
+    if (!out_.is_open()) {
+        return false;
+    }
+    header_.magic = RECORD_FILE_MAGIC;
+    header_.version = RECORD_VERSION;
+    header_.type = type;
+    header_.width = size.width;
+    header_.height = size.height;
+    header_.key_interval = uint32_t(key_interval_);
+    out_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+
+    index_.clear();
+    frames_ = raw_bytes_ = encoded_bytes_ = 0;
+    start_ticks_ = getTickCount();
+    recycler_ = make_shared<Recycler<Pending>>();
+    queue_ = make_shared<BoundedQueue<Pending>>(queue_depth_, QueuePolicy::DROP_OLDEST, recycler_);
+    worker_ = thread(&DepthRecorder::run, this);
+    return true;
+}
+
+void DepthRecorder::close() {
+    if (!worker_.joinable()) {
+        return;
+    }
+    queue_->close();
+    worker_.join();
+
+    IndexFooter footer;
+    footer.offset = uint64_t(out_.tellp());
+    footer.count = uint32_t(index_.size());
+    footer.magic = RECORD_INDEX_MAGIC;
+    out_.write(reinterpret_cast<const char*>(index_.data()), streamsize(index_.size()*sizeof(IndexEntry)));
+    out_.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+    out_.close();
+}
+
+void DepthRecorder::push(uint32_t frame_id, const Mat& frame) {
+    if (!is_open() || frame.size() != Size(header_.width, header_.height) || frame.type() != header_.type) {
+        return;
+    }
+    Pending pending = recycler_->acquire();
+    frame.copyTo(pending.frame);
+    pending.frame_id = frame_id;
+    pending.timestamp = double(getTickCount() - start_ticks_)/getTickFrequency();
+    queue_->push(move(pending));
+}
+
+// key frames are counted in written frames, dropped ones never become the reference for the next
+void DepthRecorder::run() {
+    Mat previous;
+    vector<uint8_t> payload;
+    Pending pending;
+    while (queue_->pop(pending)) {
+        bool key = index_.size() % size_t(key_interval_) == 0;
+        encode_depth_frame(pending.frame, previous, key, payload);
+
+        IndexEntry entry;
+        entry.offset = uint64_t(out_.tellp());
+        entry.frame_id = pending.frame_id;
+        entry.key = key;
+        entry.timestamp = pending.timestamp;
+        index_.push_back(entry);
+
+        RecordHeader record;
+        record.magic = RECORD_FRAME_MAGIC;
+        record.frame_id = pending.frame_id;
+        record.timestamp = pending.timestamp;
+        record.bytes = uint32_t(payload.size());
+        record.key = key;
+        out_.write(reinterpret_cast<const char*>(&record), sizeof(record));
+        out_.write(reinterpret_cast<const char*>(payload.data()), streamsize(payload.size()));
+
+        frames_++;
+        raw_bytes_ += pending.frame.total()*pending.frame.elemSize();
+        encoded_bytes_ += payload.size();
+        // keep the buffer that was just encoded as the reference, hand the old reference back for reuse
+        swap(previous, pending.frame);
+        queue_->recycle(move(pending));
+    }
+}
+
+//==================================================Reader===========================================================
+
+bool DepthReader::open(const string& path) {
+    close();
+    in_.open(path, ios::binary);
+    if (!in_.is_open()) {
+        return false;
+    }
+    if (!in_.read(reinterpret_cast<char*>(&header_), sizeof(header_)) || header_.magic != RECORD_FILE_MAGIC
+        || header_.version != RECORD_VERSION || (header_.type != CV_16S && header_.type != CV_16U)) {
+        close();
+        return false;
+    }
+    current_.create(header_.height, header_.width, header_.type);
+    previous_.create(header_.height, header_.width, header_.type);
+
+    // the index written by close(), or a scan if the recording never got that far
+    DepthRecorder::IndexFooter footer;
+    in_.seekg(-streamoff(sizeof(footer)), ios::end);
+    if (in_.read(reinterpret_cast<char*>(&footer), sizeof(footer)) && footer.magic == RECORD_INDEX_MAGIC) {
+        index_.resize(footer.count);
+        in_.seekg(streamoff(footer.offset));
+        if (in_.read(reinterpret_cast<char*>(index_.data()), streamsize(index_.size()*sizeof(DepthRecorder::IndexEntry)))) {
+            return true;
+        }
+    }
+    in_.clear();
+    return scan();
+}
+
+void DepthReader::close() {
+    if (in_.is_open()) {
+        in_.close();
+    }
+    in_.clear();
+    index_.clear();
+    decoded_ = SIZE_MAX;
+}
+
+bool DepthReader::scan() {
+    index_.clear();
+    in_.seekg(0, ios::end);
+    streamoff file_size = in_.tellg();
+    streamoff offset = streamoff(sizeof(header_));
+    DepthRecorder::RecordHeader record;
+    while (true) {
+        in_.seekg(offset);
+        if (!in_.read(reinterpret_cast<char*>(&record), sizeof(record)) || record.magic != RECORD_FRAME_MAGIC) {
+            break;
+        }
+        streamoff next = offset + streamoff(sizeof(record)) + streamoff(record.bytes);
+        if (next > file_size) {
+            break;
+        }
+        DepthRecorder::IndexEntry entry;
+        entry.offset = uint64_t(offset);
+        entry.frame_id = record.frame_id;
+        entry.key = record.key;
+        entry.timestamp = record.timestamp;
+        index_.push_back(entry);
+        offset = next;
+    }
+    in_.clear();
+    // a recording has to start with a key frame to be decodable at all
+    return !index_.empty() && index_.front().key;
+}
+
+bool DepthReader::decode(size_t index) {
+    const DepthRecorder::IndexEntry& entry = index_[index];
+    DepthRecorder::RecordHeader record;
+    in_.seekg(streamoff(entry.offset));
+    if (!in_.read(reinterpret_cast<char*>(&record), sizeof(record)) || record.magic != RECORD_FRAME_MAGIC) {
+        in_.clear();
+        return false;
+    }
+    payload_.resize(record.bytes);
+    if (!in_.read(reinterpret_cast<char*>(payload_.data()), streamsize(payload_.size()))) {
+        in_.clear();
+        return false;
+    }
+    swap(current_, previous_);
+    if (!decode_depth_frame(payload_.data(), payload_.size(), previous_, record.key != 0, current_)) {
+        decoded_ = SIZE_MAX;
+        return false;
+    }
+    decoded_ = index;
+    return true;
+}
+
+bool DepthReader::read(size_t index, Mat& frame) {
+    if (index >= index_.size()) {
+        return false;
+    }
+    if (decoded_ != index) {
+        // carry on from the frame already decoded if it is on the way, else from the key frame before
+        size_t from = index;
+        while (from > 0 && !index_[from].key) {
+            from--;
+        }
+        if (decoded_ != SIZE_MAX && decoded_ >= from && decoded_ < index) {
+            from = decoded_ + 1;
+        }
+        for (size_t i = from; i <= index; i++) {
+            if (!decode(i)) {
+                return false;
+            }
+        }
+    }
+    frame = current_;
+    return true;
+}
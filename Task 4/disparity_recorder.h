@@ -0,0 +1,129 @@
+#ifndef DISPARITY_RECORDER_H
+#define DISPARITY_RECORDER_H
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "../pipeline.h"
+
+#define RECORD_FILE_MAGIC 0x444c574f   // "OWLD"
+#define RECORD_FRAME_MAGIC 0x464c574f  // "OWLF"
+#define RECORD_INDEX_MAGIC 0x494c574f  // "OWLI"
+#define RECORD_VERSION 1
+#define RECORD_KEY_INTERVAL 30         // a self contained frame every second, the furthest a seek has to decode
+#define RECORD_QUEUE_DEPTH 4           // frames waiting for the encoder before the oldest is dropped
+
+// lossless coding of one CV_16S disparity or CV_16U depth map. every row is predicted either spatially
+// (median edge predictor on the left, upper and upper left neighbours) or from the same row of the previous
+// frame, whichever leaves the smaller residuals. residuals are zigzag varints and runs of zeros, the static
+// background and the invalid regions, collapse into a single run that carries on across rows.
+// key frames only use the spatial predictor so they decode without the frame before them
+void encode_depth_frame(const cv::Mat& frame, const cv::Mat& previous, bool key, std::vector<uint8_t>& out);
+// previous has to be the frame decoded before this one unless it is a key frame. false if data is malformed
+bool decode_depth_frame(const uint8_t* data, size_t size, const cv::Mat& previous, bool key, cv::Mat& frame);
+
+// streams a sequence of disparity or depth maps to disk. push() copies the frame into a recycled buffer and
+// returns straight away, encoding and writing happen on a thread of its own. if the encoder falls behind the
+// oldest waiting frame is dropped rather than slowing the caller down. close() writes an index of every
+// frame so the reader can seek without scanning the file
+class DepthRecorder {
+public:
+    struct FileHeader {
+        uint32_t magic;
+        uint32_t version;
+        int32_t type;            // CV_16S or CV_16U
+        int32_t width, height;
+        uint32_t key_interval;
+    };
+    struct RecordHeader {
+        uint32_t magic;
+        uint32_t frame_id;
+        double timestamp;        // seconds since the recording was opened
+        uint32_t bytes;          // encoded payload that follows
+        uint32_t key;
+    };
+    struct IndexEntry {
+        uint64_t offset;         // of the record header
+        uint32_t frame_id;
+        uint32_t key;
+        double timestamp;
+    };
+    struct IndexFooter {
+        uint64_t offset;         // of the first IndexEntry
+        uint32_t count;
+        uint32_t magic;
+    };
+
+    explicit DepthRecorder(int key_interval = RECORD_KEY_INTERVAL, size_t queue_depth = RECORD_QUEUE_DEPTH);
+    ~DepthRecorder() { close(); }
+
+    bool open(const std::string& path, cv::Size size, int type);
+    // encodes what is still queued, writes the index and joins the encoder
+    void close();
+    bool is_open() const { return worker_.joinable(); }
+
+    void push(uint32_t frame_id, const cv::Mat& frame);
+
+    uint64_t frames_written() const { return frames_; }
+    uint64_t dropped() const { return queue_ ? queue_->dropped() : 0; }
+    // encoded against raw 16-bit size, payloads only
+    double compression_ratio() const { return encoded_bytes_ ? double(raw_bytes_)/encoded_bytes_ : 0.; }
+
+private:
+    struct Pending {
+        cv::Mat frame;
+        uint32_t frame_id = 0;
+        double timestamp = 0.;
+    };
+
+    void run();
+
+    int key_interval_;
+    size_t queue_depth_;
+    std::ofstream out_;
+    FileHeader header_;
+    int64_t start_ticks_ = 0;
+    std::shared_ptr<BoundedQueue<Pending>> queue_;
+    std::shared_ptr<Recycler<Pending>> recycler_;
+    std::thread worker_;
+    std::vector<IndexEntry> index_;
+    std::atomic<uint64_t> frames_{0}, raw_bytes_{0}, encoded_bytes_{0};
+};
+
+// random access to a recording. read() decodes forward from the nearest key frame at or before the one asked
+// for, and reading frames in order only decodes each once. a recording that was cut short, without its index,
+// is scanned instead, up to the last complete frame
+class DepthReader {
+public:
+    bool open(const std::string& path);
+    void close();
+    bool is_open() const { return in_.is_open(); }
+
+    size_t frame_count() const { return index_.size(); }
+    cv::Size size() const { return cv::Size(header_.width, header_.height); }
+    int type() const { return header_.type; }
+    uint32_t frame_id(size_t index) const { return index_[index].frame_id; }
+    double timestamp(size_t index) const { return index_[index].timestamp; }
+
+    // the returned map is only valid until the next call
+    bool read(size_t index, cv::Mat& frame);
+
+private:
+    bool decode(size_t index);
+    bool scan();
+
+    std::ifstream in_;
+    DepthRecorder::FileHeader header_;
+    std::vector<DepthRecorder::IndexEntry> index_;
+    std::vector<uint8_t> payload_;
+    cv::Mat current_, previous_;
+    size_t decoded_ = SIZE_MAX;    // index held in current_
+};
+
+#endif // DISPARITY_RECORDER_H
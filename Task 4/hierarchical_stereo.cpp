@@ -0,0 +1,191 @@
+#include "stereo_engine.h"
+#include "census.h"
+
+#include <algorithm>
+#include <climits>
+#include <opencv2/imgproc.hpp>
+
+using namespace cv;
+using namespace std;
+
+#define HIER_LEVELS 3             // full, 1/2 and 1/4 resolution
+#define HIER_REFINE_RADIUS 3      // finer levels search +-3 pixels around the upsampled estimate
+#define HIER_UNIQUENESS 10
+#define HIER_SPECKLE_WINDOW 100
+#define HIER_SPECKLE_RANGE 2      // pixels
+
+// replace invalid disparities with the nearest valid value to their left (the background side of an
+// occlusion), so every pixel has a starting point for the next level
+static void fill_invalid(Mat& disp, short invalid) {
+    for (int y = 0; y < disp.rows; y++) {
+        short* row = disp.ptr<short>(y);
+        int first = 0;
+        while (first < disp.cols && row[first] <= invalid) {
+            first++;
+        }
+        if (first == disp.cols) {
+            std::fill(row, row + disp.cols, short(invalid + 16));
+            continue;
+        }
+        std::fill(row, row + first, row[first]);
+        for (int x = first + 1; x < disp.cols; x++) {
+            if (row[x] <= invalid) {
+                row[x] = row[x-1];
+            }
+        }
+    }
+}
+
+// search each pixel only over +-HIER_REFINE_RADIUS around its prior. the cost for offset k is built as one
+// image (pixel x compared with x - prior(x) - k) and box filtered, so the work is independent of the range.
+static void refine_disparity(const Mat& census_left, const Mat& census_right, const Mat& prior,
+                             int block_size, int min_disp, int max_disp, Mat& disp) {
+    const int rows = census_left.rows, cols = census_left.cols;
+    const int offsets = 2*HIER_REFINE_RADIUS + 1;
+
+    Mat base(rows, cols, CV_32S);
+    for (int y = 0; y < rows; y++) {
+        const short* p = prior.ptr<short>(y);
+        int* b = base.ptr<int>(y);
+        for (int x = 0; x < cols; x++) {
+            b[x] = (p[x] + 8) >> 4;
+        }
+    }
+
+    vector<Mat> agg(offsets);
+    Mat cost(rows, cols, CV_8U);
+    for (int k = 0; k < offsets; k++) {
+        const int offset = k - HIER_REFINE_RADIUS;
+        parallel_for_(Range(0, rows), [&](const Range& range) {
+            for (int y = range.start; y < range.end; y++) {
+                const uint32_t* cl = census_left.ptr<uint32_t>(y);
+                const uint32_t* cr = census_right.ptr<uint32_t>(y);
+                const int* b = base.ptr<int>(y);
+                uchar* c = cost.ptr<uchar>(y);
+                for (int x = 0; x < cols; x++) {
+                    int d = b[x] + offset;
+                    int xr = x - d;
+                    c[x] = (d >= min_disp && d < max_disp && xr >= 0 && xr < cols)
+                         ? uchar(popcount32(cl[x] ^ cr[xr])) : uchar(CENSUS_MAX_COST);
+                }
+            }
+        });
+        boxFilter(cost, agg[size_t(k)], CV_16U, Size(block_size, block_size), Point(-1, -1), false, BORDER_REPLICATE);
+    }
+
+    const short invalid = short((min_disp - 1)*16);
+    disp.create(rows, cols, CV_16S);
+    parallel_for_(Range(0, rows), [&](const Range& range) {
+        vector<const ushort*> a(size_t(offsets), nullptr);
+        for (int y = range.start; y < range.end; y++) {
+            for (int k = 0; k < offsets; k++) {
+                a[size_t(k)] = agg[size_t(k)].ptr<ushort>(y);
+            }
+            const int* b = base.ptr<int>(y);
+            short* out = disp.ptr<short>(y);
+            for (int x = 0; x < cols; x++) {
+                int best = 0;
+                for (int k = 1; k < offsets; k++) {
+                    if (a[size_t(k)][x] < a[size_t(best)][x]) {
+                        best = k;
+                    }
+                }
+                int best_cost = a[size_t(best)][x];
+                int second_cost = INT_MAX;
+                for (int k = 0; k < offsets; k++) {
+                    if (abs(k - best) > 1) {
+                        second_cost = min(second_cost, int(a[size_t(k)][x]));
+                    }
+                }
+                int d = b[x] + best - HIER_REFINE_RADIUS;
+                if (d < min_disp || d >= max_disp || x - d < 0
+                        || (second_cost != INT_MAX && second_cost*(100 - HIER_UNIQUENESS) < best_cost*100)) {
+                    out[x] = invalid;
+                    continue;
+                }
+                int d16 = d*16;
+                if (best > 0 && best < offsets - 1) {
+                    int p = a[size_t(best - 1)][x], n = a[size_t(best + 1)][x];
+                    int denom2 = max(p + n - 2*best_cost, 1);
+                    d16 += ((p - n)*16 + denom2)/(denom2*2);
+                }
+                out[x] = short(d16);
+            }
+        }
+    });
+}
+
+// coarse-to-fine matcher: the coarse engine searches the full range at 1/4 resolution, then each finer
+// level only refines a small window around the upsampled estimate. the coarse level costs 1/64 of a full
+// resolution match and the refinement does not depend on the number of disparities at all.
+class HierarchicalEngine : public StereoEngine {
+public:
+    HierarchicalEngine(Ptr<StereoEngine> coarse, int block_size, int num_disparities)
+        : coarse_(coarse), block_size_(block_size), num_disparities_(num_disparities) {
+    }
+    string name() const override { return "hierarchical"; }
+    void compute(const Mat& left, const Mat& right, Mat& disp) override;
+    Ptr<StereoEngine> clone() const override {
+        Ptr<StereoEngine> engine = makePtr<HierarchicalEngine>(coarse_->clone(), block_size_, num_disparities_);
+        engine->set_min_disparity(min_disparity_);
+        return engine;
+    }
+    void set_block_size(int block_size) override { block_size_ = block_size | 1; }
+    void set_num_disparities(int num_disparities) override { num_disparities_ = num_disparities; }
+    void set_min_disparity(int min_disparity) override { min_disparity_ = max(0, min_disparity); }
+    int block_size() const override { return block_size_; }
+    int num_disparities() const override { return num_disparities_; }
+    int min_disparity() const override { return min_disparity_; }
+
+private:
+    Ptr<StereoEngine> coarse_;
+    int block_size_, num_disparities_, min_disparity_ = 0;
+    Mat grey_left_[HIER_LEVELS], grey_right_[HIER_LEVELS];
+    Mat census_left_, census_right_, prior_;
+};
+
+void HierarchicalEngine::compute(const Mat& left, const Mat& right, Mat& disp) {
+    if (left.channels() == 3) {
+        cvtColor(left, grey_left_[0], COLOR_BGR2GRAY);
+        cvtColor(right, grey_right_[0], COLOR_BGR2GRAY);
+    } else {
+        left.copyTo(grey_left_[0]);
+        right.copyTo(grey_right_[0]);
+    }
+    for (int level = 1; level < HIER_LEVELS; level++) {
+        pyrDown(grey_left_[level-1], grey_left_[level]);
+        pyrDown(grey_right_[level-1], grey_right_[level]);
+    }
+
+    // full range search at the coarsest level
+    const int scale = 1 << (HIER_LEVELS - 1);
+    const int coarse_min = min_disparity_/scale;
+    const int coarse_max = (min_disparity_ + num_disparities_ + scale - 1)/scale;
+    coarse_->set_block_size(max(3, (block_size_/2) | 1));
+    coarse_->set_min_disparity(coarse_min);
+    coarse_->set_num_disparities(max(16, (coarse_max - coarse_min + 15) & ~15));
+    coarse_->compute(grey_left_[HIER_LEVELS-1], grey_right_[HIER_LEVELS-1], disp);
+    short invalid = short((coarse_->min_disparity() - 1)*16);
+
+    for (int level = HIER_LEVELS - 2; level >= 0; level--) {
+        fill_invalid(disp, invalid);
+        // twice the resolution means twice the disparity
+        resize(disp, prior_, grey_left_[level].size(), 0, 0, INTER_NEAREST);
+        prior_.convertTo(prior_, CV_16S, 2);
+
+        census_transform(grey_left_[level], census_left_);
+        census_transform(grey_right_[level], census_right_);
+        int level_scale = 1 << level;
+        int level_min = min_disparity_/level_scale;
+        int level_max = (min_disparity_ + num_disparities_ + level_scale - 1)/level_scale;
+        refine_disparity(census_left_, census_right_, prior_, level == 0 ? block_size_ : max(3, (block_size_/2) | 1),
+                         level_min, level_max, disp);
+        invalid = short((level_min - 1)*16);
+    }
+
+    filterSpeckles(disp, (min_disparity_ - 1)*16, HIER_SPECKLE_WINDOW, HIER_SPECKLE_RANGE*16);
+}
+
+Ptr<StereoEngine> create_hierarchical_engine(int block_size, int num_disparities) {
+    return makePtr<HierarchicalEngine>(create_sgbm_engine(block_size, num_disparities), block_size, num_disparities);
+}
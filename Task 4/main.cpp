@@ -10,11 +10,20 @@
 
 #include <iostream>
 #include <fstream>
-#include <type_traits>
+#include <atomic>
 #include <opencv2/opencv.hpp>
-#include <opencv2/ximgproc/disparity_filter.hpp>
 
 #include "../owl.h"
+#include "../display_service.h"
+#include "../rectification.h"
+#include "../stream_stats.h"
+#include "../pipeline.h"
+#include "../telemetry.h"
+#include "depth_map.h"
+#include "disparity_recorder.h"
+#include "point_cloud.h"
+#include "stereo_engine.h"
+#include "temporal_stereo.h"
 
 using namespace cv;
 using namespace std;
@@ -23,6 +32,7 @@ using namespace std;
 #define DISP_WIN_NAME "disparity"
 #define SAD_WIN_SIZE_TB_NAME "SAD Window Size"
 #define NUM_DISPARITIES_TB_NAME "Number of Disparities"
+#define ENGINE_TB_NAME "Engine"
 
 #define SAD_WIN_SIZE_MIN 3
 #define SAD_WIN_SIZE_MAX 21
@@ -33,199 +43,422 @@ using namespace std;
 #define CALIB_DIST_START 350
 #define CALIB_DIST_INTERVAL 50
 #define CALIB_COUNT 10
+#define MEASURE_PATCH_RADIUS 2 // disparities are sampled from a 5x5 patch around the measured point
+#define MEASURE_WINDOW 128     // median over roughly the last 5 frames of patch samples
+#define TELEMETRY_TOOL "task4" // ring name the telemetry viewer is pointed at
+
+#define BENCH_DEFAULT_LIST "../Stereo Calibration/image_list.xml"
+#define CLOUD_STREAM_PATH "../pointcloud.bin"
+#define CLOUD_PLY_PATH "../pointcloud.ply"
+#define DEPTH_PNG_PATH "../depth.png"
+#define DISP_RECORD_PATH "../disparity.owld"
+#define DEPTH_RECORD_PATH "../depth.owld"
+#define PLAY_DEPTH_RANGE_MM 4000.  // depth recordings are shown black to white over this range
+
+// the pixels sampled around a point, clipped to the image
+Rect measure_patch(const Point& centre, const Size& size) {
+    return Rect(centre - Point(MEASURE_PATCH_RADIUS, MEASURE_PATCH_RADIUS),
+                Size(2*MEASURE_PATCH_RADIUS+1, 2*MEASURE_PATCH_RADIUS+1)) & Rect(Point(0, 0), size);
+}
 
-template <typename T, size_t N>
-class ContinuousAverage {
-public:
-    ContinuousAverage() {
-        static_assert(std::is_arithmetic<T>::value, "must be built-in arithmetic type.");
-        static_assert(N > 0, "N must be greater than 0");
-        memset(buf_, 0, N*sizeof(T));
-    }
-    void push(T value) {
-        buf_[head_] = value;
-        head_ = (head_+1) % N;
-        if (!full()) {
-            count_++;
-        }
-    }
-    double average() const {
-        T sum = 0;
-        for (size_t i = 0; i < count_; i++) {
-            sum += buf_[i];
+// push the disparities in a small patch around a point, the filter drops invalid matches itself.
+// returns how many of them were valid
+template <size_t N>
+int sample_disparities(const Mat& disp, const Point& centre, WindowMedian<short, N>& filter) {
+    int valid = 0;
+    Rect patch = measure_patch(centre, disp.size());
+    for (int y = patch.y; y < patch.y + patch.height; y++) {
+        const short* row = disp.ptr<short>(y);
+        for (int x = patch.x; x < patch.x + patch.width; x++) {
+            valid += filter.push(row[x]);
         }
-        return static_cast<double>(sum)/count_;
     }
-    size_t count() const {
-        return count_;
-    }
-    bool full() const {
-        if (count_ < N) {
-            return false;
-        }
-        return true;
-    }
-private:
-    T buf_[N];
-    size_t head_ = 0;
-    size_t count_ = 0;
+    return valid;
+}
+
+// one stereo pair on its way through the pipeline, with a snapshot of what the display stage draws
+struct StereoFrame {
+    Mat left, right, grey_left, grey_right, eyes, disp, disp8, depth;
+    bool show_eyes = false, calibrate = false, temporal_mode = false;
+    int num_disparities = 16;
+    string engine_name;
+    int dirty_tiles = 0, total_tiles = 0;
+    int cloud_points = -1;       // -1 while no point cloud is being streamed
+    bool recording = false;
+    Point disp_coords;
+    double distance = 0.;        // measured at disp_coords
+    int calib_distance = 0;      // calibration mode: where to stand and the disparity seen there
+    short calib_disparity = 0;
+    TelemetryRecord telemetry;
 };
 
-void on_tb_sad_window_size(int pos, void* userdata);
-void on_tb_num_disparities(int pos, void* userdata);
-void on_mouse(int event, int x, int y, int flags, void *userdata);
+// the block matchers the engine trackbar switches between
+struct EngineSelection {
+    vector<Ptr<StereoEngine>> engines;
+    Ptr<StereoEngine> current;
+    TemporalStereo* temporal;
+};
+
+void on_tb_sad_window_size(int pos, EngineSelection& selection, DisplayService& display);
+void on_tb_num_disparities(int pos, EngineSelection& selection, DisplayService& display);
+void on_tb_engine(int pos, EngineSelection& selection);
+void on_trackbar(const DisplayEvent& event, EngineSelection& selection, DisplayService& display);
+void on_mouse(const DisplayEvent& event, Point& disp_coords);
 void draw_calibrate_ui(Mat& disp8, int distance, short disparity);
-void draw_measure_ui(Mat& left, Mat& disp8, const Point& disp_coords, double distance);
+void draw_measure_ui(Mat& disp8, const Point& disp_coords, double distance);
+void draw_temporal_ui(Mat& disp8, int dirty_tiles, int total_tiles);
+void draw_engine_ui(Mat& disp8, const string& engine_name);
+void draw_cloud_ui(Mat& disp8, size_t points);
+void draw_record_ui(Mat& disp8);
+int  play_recording(const string& path, bool headless);
 
 int main(int argc, char** argv) {
-    // connect with the owl and load calibration values
-    // robotOwl owl(1475, 1510, 1550, 1440, 1560);
-    robotOwl owl(1485, 1505, 1555, 1445, 1560);
+    // -bench[=<image list>] runs every engine over a recorded image list and exits without connecting to the owl
+    CommandLineParser parser(argc, argv, "{bench||image list to benchmark the engines on}"
+                                         "{play||disparity or depth recording to play back}"
+                                         "{headless||run without windows or overlays}");
+    if (parser.has("play")) {
+        return play_recording(parser.get<string>("play"), parser.has("headless"));
+    }
+    bool bench = parser.has("bench");
+    string bench_list = bench ? parser.get<string>("bench") : "";
+    if (bench_list == "true") {
+        bench_list = BENCH_DEFAULT_LIST;
+    }
+
     // calibration file paths
     string intrinsic_filename = "../intrinsics.xml";
     string extrinsic_filename = "../extrinsics.xml";
 
     //================================================Load Calibration Files===============================================
-    Rect roi1, roi2;
-    Mat Q;
+    // the rectification maps are memory-mapped from a cache next to the xml files unless the calibration changed
     Size img_size = {640,480};
-
-    FileStorage fs(intrinsic_filename, FileStorage::READ);
-    if(!fs.isOpened()){
-        printf("Failed to open file %s\n", intrinsic_filename.c_str());
+    StereoRectification rect;
+    if (!loadRectification(intrinsic_filename, extrinsic_filename, img_size, rect)) {
         return -1;
     }
 
-    Mat M1, D1, M2, D2;
-    fs["M1"] >> M1;
-    fs["D1"] >> D1;
-    fs["M2"] >> M2;
-    fs["D2"] >> D2;
 
-    fs.open(extrinsic_filename, FileStorage::READ);
-    if(!fs.isOpened())
-    {
-        printf("Failed to open file %s\n", extrinsic_filename.c_str());
-        return -1;
-    }
-    Mat R, T, R1, P1, R2, P2;
-    fs["R"] >> R;
-    fs["T"] >> T;
-
-    stereoRectify( M1, D1, M2, D2, img_size, R, T, R1, R2, P1, P2, Q, CALIB_ZERO_DISPARITY, -1, img_size, &roi1, &roi2 );
-
-    Mat map11, map12, map21, map22;
-    initUndistortRectifyMap(M1, D1, R1, P1, img_size, CV_16SC2, map11, map12);
-    initUndistortRectifyMap(M2, D2, R2, P2, img_size, CV_16SC2, map21, map22);
 
-
-
-    //==================================================Create Block Matcher==============================================
+    //==================================================Create Block Matchers=============================================
     int sad_window_size = 7;   //must be an odd number >=3
     int num_disparities = 144; //must be divisable by 16
-    Ptr<StereoSGBM> sgbm = StereoSGBM::create(0,16,3);
-    sgbm->setBlockSize(sad_window_size);
-    sgbm->setPreFilterCap(63);
-    sgbm->setP1(8*3*sad_window_size*sad_window_size);
-    sgbm->setP2(32*3*sad_window_size*sad_window_size);
-    sgbm->setMinDisparity(0);
-    sgbm->setNumDisparities(num_disparities);
-    sgbm->setUniquenessRatio(10);
-    sgbm->setSpeckleWindowSize(100);
-    sgbm->setSpeckleRange(32);
-    sgbm->setDisp12MaxDiff(1);
-    sgbm->setMode(StereoSGBM::MODE_SGBM);
-
-    namedWindow(DISP_WIN_NAME);
-    createTrackbar(SAD_WIN_SIZE_TB_NAME, DISP_WIN_NAME, &sad_window_size, SAD_WIN_SIZE_MAX, on_tb_sad_window_size, &sgbm);
-    setTrackbarMin(SAD_WIN_SIZE_TB_NAME, DISP_WIN_NAME, SAD_WIN_SIZE_MIN);
-    setTrackbarPos(SAD_WIN_SIZE_TB_NAME, DISP_WIN_NAME, sad_window_size);
-    createTrackbar(NUM_DISPARITIES_TB_NAME, DISP_WIN_NAME, &num_disparities, NUM_DISPARITIES_MAX, on_tb_num_disparities, &sgbm);
-    setTrackbarMin(NUM_DISPARITIES_TB_NAME, DISP_WIN_NAME, NUM_DISPARITIES_MIN);
-    setTrackbarPos(NUM_DISPARITIES_TB_NAME, DISP_WIN_NAME, num_disparities);
+    int engine_index = 0;
+    EngineSelection selection;
+    selection.engines = {
+        create_sgbm_engine(sad_window_size, num_disparities),
+        create_bm_engine(sad_window_size, num_disparities),
+        create_census_engine(sad_window_size, num_disparities),
+        create_hierarchical_engine(sad_window_size, num_disparities),
+        create_wls_engine(sad_window_size, num_disparities),
+    };
+    selection.current = selection.engines[size_t(engine_index)];
+    // temporal mode reuses the previous disparity map and only rematches tiles that changed
+    TemporalStereo temporal(selection.current);
+    selection.temporal = &temporal;
+
+    if (bench) {
+        vector<StereoPair> pairs;
+        if (!load_stereo_pairs(bench_list, pairs)) {
+            printf("Failed to load image list %s\n", bench_list.c_str());
+            return -1;
+        }
+        for (StereoPair& pair : pairs) {
+            Mat grey_left, grey_right;
+            rectifyPair(pair.first, pair.second, rect, grey_left, grey_right);
+            pair = StereoPair(grey_left, grey_right);
+        }
+        // sweep the disparity range, flat matchers slow down with it while the hierarchical one should not
+        for (int bench_disparities : {64, 144, 256}) {
+            for (Ptr<StereoEngine>& engine : selection.engines) {
+                engine->set_num_disparities(bench_disparities);
+            }
+            cout << pairs.size() << " pairs, " << bench_disparities << " disparities, block size " << sad_window_size << endl;
+            benchmark_engines(selection.engines, pairs);
+        }
+        return 0;
+    }
+
+    // connect with the owl and load calibration values
+    // robotOwl owl(1475, 1510, 1550, 1440, 1560);
+    robotOwl owl(1485, 1505, 1555, 1445, 1560);
+
+    // windows are drawn on their own thread, trackbar and mouse input comes back as events
+    DisplayService display(parser.has("headless"));
+    display.addTrackbar(SAD_WIN_SIZE_TB_NAME, DISP_WIN_NAME, sad_window_size, SAD_WIN_SIZE_MAX, SAD_WIN_SIZE_MIN);
+    display.addTrackbar(NUM_DISPARITIES_TB_NAME, DISP_WIN_NAME, num_disparities, NUM_DISPARITIES_MAX, NUM_DISPARITIES_MIN);
+    display.addTrackbar(ENGINE_TB_NAME, DISP_WIN_NAME, engine_index, int(selection.engines.size()) - 1);
 
     Point disp_coords = Point(img_size/2);
-    setMouseCallback(DISP_WIN_NAME, on_mouse, &disp_coords);
+    display.trackMouse(DISP_WIN_NAME);
+
+    // voxelised point clouds from the disparity map, only built while streaming or saving
+    PointCloudBuilder cloud_builder(rect.Q, img_size, NUM_DISPARITIES_MAX);
+    PointCloudWriter cloud_writer;
+    vector<Point3f> cloud;
+    uint32_t frame_id = 0;
+    bool save_cloud = false;
+    // lossless disparity and depth sequences, encoded on threads of their own
+    DepthRecorder disp_recorder, depth_recorder;
 
-    Mat left, right, eyes, disp, disp8;
-    ContinuousAverage<double, 16> distance;
+    // zero and negative disparities are failed matches, the filters skip them instead of dividing by them
+    WindowMedian<short, MEASURE_WINDOW> measured(1);
 
-    double base_focal_product = DEFAULT_BASE_FOCAL_PRODUCT;
-    ContinuousAverage<short, 16> disparity;
-    ContinuousAverage<double, CALIB_COUNT> calibrations;
+    // depth = a/(d - d0), refitted from the (disparity, distance) samples taken in calibration mode
+    DepthModel depth_model(DEFAULT_BASE_FOCAL_PRODUCT);
+    WindowMedian<short, MEASURE_WINDOW> disparity(1);
+    vector<Point2d> calibrations;
 
     int key_press = -1;
-    bool running = true, calibrate = false;
-    while (running) {
+    bool calibrate = false, temporal_mode = false;
+    atomic<bool> show_eyes(!display.headless());
 
+    // capture -> rectify -> match -> display, each on its own thread. rectifying the next pair overlaps matching
+    // this one. input events are handled on the match stage, so the engines are still never changed mid-match
+    Pipeline pipeline;
+    auto captured = pipeline.source<StereoFrame>("capture", [&](StereoFrame& frame) {
         // read the owls camera frames
-        owl.getCameraFrames(left, right);
-
-        // distort images to correct for lens/positional distortion
-        remap(left, left, map11, map12, INTER_LINEAR);
-        remap(right, right, map21, map22, INTER_LINEAR);
-
+        owl.getCameraFrames(frame.left, frame.right);
+        return true;
+    });
+    auto rectified = pipeline.stage<StereoFrame>("rectify", captured, [&](StereoFrame& frame) {
+        // distort images to correct for lens/positional distortion, matching only needs the greyscale images
+        // so the colour ones are only rectified while the eyes window is open
+        frame.show_eyes = show_eyes;
+        if (frame.show_eyes) {
+            rectifyPair(frame.left, frame.right, rect, frame.grey_left, frame.grey_right, &frame.left, &frame.right);
+        } else {
+            rectifyPair(frame.left, frame.right, rect, frame.grey_left, frame.grey_right);
+        }
+        return true;
+    });
+    auto matched = pipeline.stage<StereoFrame>("match", rectified, [&](StereoFrame& frame) {
         // match left and right images to create disparity image
-        sgbm->compute(left, right, disp);
-        // convert disparity map to an 8-bit greyscale image so it can be displayed (do not use for mesurements)
-        disp.convertTo(disp8, CV_8U, 255/(num_disparities*16.));
+        Mat& disp = frame.disp;
+        if (temporal_mode) {
+            temporal.compute(frame.grey_left, frame.grey_right, disp);
+        } else {
+            selection.current->compute(frame.grey_left, frame.grey_right, disp);
+        }
+        if (cloud_writer.is_open() || save_cloud) {
+            cloud_builder.build(disp, cloud);
+            cloud_writer.write_frame(frame_id, cloud);
+            if (save_cloud) {
+                PointCloudWriter::write_ply(CLOUD_PLY_PATH, cloud);
+                cout << "saved " << cloud.size() << " points to " << CLOUD_PLY_PATH << endl;
+                save_cloud = false;
+            }
+        }
+
+        // every pixel gets a range for the cost of one table lookup
+        depth_model.convert(disp, frame.depth);
+        if (disp_recorder.is_open()) {
+            disp_recorder.push(frame_id, disp);
+            depth_recorder.push(frame_id, frame.depth);
+        }
+        frame_id++;
+
+        // snapshot what the display stage draws, the engine and filters keep changing behind it
+        frame.calibrate = calibrate;
+        frame.temporal_mode = temporal_mode;
+        frame.num_disparities = selection.current->num_disparities();
+        frame.engine_name = selection.current->name();
+        frame.dirty_tiles = temporal.dirty_tiles();
+        frame.total_tiles = temporal.total_tiles();
+        frame.cloud_points = cloud_writer.is_open() ? int(cloud.size()) : -1;
+        frame.recording = disp_recorder.is_open();
+        frame.disp_coords = disp_coords;
 
         if (calibrate) {
-            short distance = CALIB_DIST_START + CALIB_DIST_INTERVAL*short(calibrations.count());
-            disparity.push(disp.at<short>(img_size/2));
-            if (key_press == ' ') {
-                calibrations.push(distance*disparity.average());
-                if (calibrations.full()) {
-                    base_focal_product = calibrations.average();
+            short distance = CALIB_DIST_START + CALIB_DIST_INTERVAL*short(calibrations.size());
+            sample_disparities(disp, Point(img_size/2), disparity);
+            if (key_press == ' ' && disparity.count() > 0) {
+                calibrations.push_back(Point2d(disparity.median(), distance));
+                if (calibrations.size() >= CALIB_COUNT) {
+                    depth_model.fit(calibrations);
+                    cout << "depth = " << depth_model.a() << "/(d - " << depth_model.d0() << ")" << endl;
                     calibrate = false;
                 }
             }
-            draw_calibrate_ui(disp8, distance, short(disparity.average()));
+            frame.calib_distance = distance;
+            frame.calib_disparity = short(disparity.median());
         } else {
-            distance.push(base_focal_product/disp.at<short>(disp_coords));
-            draw_measure_ui(disp8, disp_coords, distance.average());
+            // no valid match at the point this frame means no measurement, not the last one that was made
+            int valid = sample_disparities(disp, disp_coords, measured);
+            frame.distance = valid > 0 ? depth_model.depth_at(short(measured.median())) : 0.;
+            // share of this frame's patch that matched, -1 with the point outside the image
+            int total = measure_patch(disp_coords, disp.size()).area();
+            frame.telemetry.confidence = total > 0 ? float(valid)/total : -1.f;
+            frame.telemetry.distance = float(frame.distance);
         }
 
-        // display images
-        hconcat(left, right, eyes); // combine left and right into one window
-        imshow(EYES_WIN_NAME, eyes);
-        imshow(DISP_WIN_NAME, disp8);
+        key_press = -1;
+        DisplayEvent event;
+        while (display.pollEvent(event)) {
+            if (event.type == DisplayEvent::TRACKBAR) {
+                on_trackbar(event, selection, display);
+                continue;
+            }
+            if (event.type == DisplayEvent::MOUSE) {
+                Point previous = disp_coords;
+                on_mouse(event, disp_coords);
+                if (disp_coords != previous) {
+                    measured.clear(); // samples of the old point say nothing about the new one
+                }
+                continue;
+            }
+            switch (key_press = event.key) {
+            case 'c':
+                calibrate = true;
+                calibrations.clear();
+                disparity.clear();
+                break;
+            case 'e':
+                show_eyes = !show_eyes;
+                if (!show_eyes) {
+                    display.closeWindow(EYES_WIN_NAME);
+                }
+                break;
+            case 't':
+                temporal_mode = !temporal_mode;
+                temporal.reset();
+                break;
+            case 'p':
+                // toggle streaming one compact point cloud record per frame
+                if (cloud_writer.is_open()) {
+                    cloud_writer.close();
+                } else if (!cloud_writer.open(CLOUD_STREAM_PATH)) {
+                    cout << "could not open: " << CLOUD_STREAM_PATH << endl;
+                }
+                break;
+            case 's':
+                save_cloud = true;
+                break;
+            case 'v':
+                // toggle recording the disparity and depth maps
+                if (disp_recorder.is_open()) {
+                    disp_recorder.close();
+                    depth_recorder.close();
+                    cout << "recorded " << disp_recorder.frames_written() << " frames, " << disp_recorder.dropped() << " dropped, "
+                         << "disparity " << disp_recorder.compression_ratio() << ":1, depth " << depth_recorder.compression_ratio() << ":1" << endl;
+                } else if (!disp_recorder.open(DISP_RECORD_PATH, disp.size(), disp.type())
+                           || !depth_recorder.open(DEPTH_RECORD_PATH, frame.depth.size(), frame.depth.type())) {
+                    cout << "could not open: " << DISP_RECORD_PATH << " or " << DEPTH_RECORD_PATH << endl;
+                    disp_recorder.close();
+                }
+                break;
+            case 'd':
+                // 16-bit png, pixel values are millimetres
+                imwrite(DEPTH_PNG_PATH, frame.depth);
+                cout << "saved depth map to " << DEPTH_PNG_PATH << endl;
+                break;
+            case 'b':
+                // compare all engines on the current frame pair
+                benchmark_engines(selection.engines, {StereoPair(frame.grey_left.clone(), frame.grey_right.clone())});
+                break;
+            case 'r':
+                // time per frame in each pipeline stage and how the camera frame pool is holding up
+                pipeline.report(cout);
+                owlFramePool().report(cout);
+                break;
+            case 'q':
+                pipeline.requestStop();
+                break;
+            }
+        }
+        return true;
+    });
+    TelemetryWriter telemetry;
+    uint64_t telemetry_id = 0;
+    pipeline.sink<StereoFrame>("display", matched, [&](StereoFrame& frame) {
+        frame.telemetry.frameId = telemetry_id++;
+        pipeline.lastStageTimes(frame.telemetry.stageMs, TELEMETRY_STAGES);
+        int32_t* servos = frame.telemetry.servos;
+        owl.getRawServoPositions(servos[0], servos[1], servos[2], servos[3], servos[4]);
+        telemetry.publish(frame.telemetry);
+
+        if (display.headless()) {
+            return true;
+        }
+        // convert disparity map to an 8-bit greyscale image so it can be displayed (do not use for mesurements)
+        frame.disp.convertTo(frame.disp8, CV_8U, 255/(frame.num_disparities*16.));
+        if (frame.calibrate) {
+            draw_calibrate_ui(frame.disp8, frame.calib_distance, frame.calib_disparity);
+        } else {
+            draw_measure_ui(frame.disp8, frame.disp_coords, frame.distance);
+        }
 
-        switch (key_press = waitKey(10)) {
-        case 'c':
-            calibrate = true;
-            break;
-        case 'q':
-            running = false;
-            break;
+        // display images
+        if (frame.temporal_mode) {
+            draw_temporal_ui(frame.disp8, frame.dirty_tiles, frame.total_tiles);
         }
-    }
+        draw_engine_ui(frame.disp8, frame.engine_name);
+        if (frame.cloud_points >= 0) {
+            draw_cloud_ui(frame.disp8, size_t(frame.cloud_points));
+        }
+        if (frame.recording) {
+            draw_record_ui(frame.disp8);
+        }
+        if (frame.show_eyes) {
+            hconcat(frame.left, frame.right, frame.eyes); // combine left and right into one window
+            display.show(EYES_WIN_NAME, frame.eyes);
+        }
+        display.show(DISP_WIN_NAME, frame.disp8);
+        return true;
+    });
 
+    if (!telemetry.open(TELEMETRY_TOOL, pipeline.stageNames())) {
+        cout << "Telemetry ring unavailable, running without it" << endl;
+    }
+    pipeline.start();
+    pipeline.wait();
+    pipeline.report(cout);
+    owlFramePool().report(cout);
     return 0;
 }
 
-void on_tb_sad_window_size(int pos, void* userdata) {
+void on_tb_sad_window_size(int pos, EngineSelection& selection, DisplayService& display) {
     int sad_window_size = (pos%2) ? pos : pos+1;
-    setTrackbarPos(SAD_WIN_SIZE_TB_NAME, DISP_WIN_NAME, sad_window_size);
+    if (sad_window_size != pos) {
+        display.setTrackbarPos(SAD_WIN_SIZE_TB_NAME, DISP_WIN_NAME, sad_window_size);
+    }
 
-    Ptr<StereoSGBM>& sgbm = *static_cast<Ptr<StereoSGBM>*>(userdata);
-    sgbm->setBlockSize(sad_window_size);
-    sgbm->setP1(8*3*sad_window_size*sad_window_size);
-    sgbm->setP2(32*3*sad_window_size*sad_window_size);
+    for (Ptr<StereoEngine>& engine : selection.engines) {
+        engine->set_block_size(sad_window_size);
+    }
 }
 
-void on_tb_num_disparities(int pos, void* userdata) {
-    int num_disparities = pos - pos%16;
-    setTrackbarPos(NUM_DISPARITIES_TB_NAME, DISP_WIN_NAME, num_disparities);
+void on_tb_num_disparities(int pos, EngineSelection& selection, DisplayService& display) {
+    int num_disparities = max(NUM_DISPARITIES_MIN, pos - pos%16);
+    if (num_disparities != pos) {
+        display.setTrackbarPos(NUM_DISPARITIES_TB_NAME, DISP_WIN_NAME, num_disparities);
+    }
+
+    for (Ptr<StereoEngine>& engine : selection.engines) {
+        engine->set_num_disparities(num_disparities);
+    }
+}
 
-    Ptr<StereoSGBM>& sgbm = *static_cast<Ptr<StereoSGBM>*>(userdata);
-    sgbm->setNumDisparities(num_disparities);
+void on_tb_engine(int pos, EngineSelection& selection) {
+    selection.current = selection.engines[size_t(pos)];
+    selection.temporal->set_engine(selection.current);
 }
 
-void on_mouse(int event, int x, int y, int flags, void *userdata) {
-    switch(event) {
+// trackbar moves arrive on the processing thread, so the engines are never changed mid-match
+void on_trackbar(const DisplayEvent& event, EngineSelection& selection, DisplayService& display) {
+    if (event.name == SAD_WIN_SIZE_TB_NAME) {
+        on_tb_sad_window_size(event.pos, selection, display);
+    } else if (event.name == NUM_DISPARITIES_TB_NAME) {
+        on_tb_num_disparities(event.pos, selection, display);
+    } else if (event.name == ENGINE_TB_NAME) {
+        on_tb_engine(event.pos, selection);
+    }
+}
+
+void on_mouse(const DisplayEvent& event, Point& disp_coords) {
+    switch(event.event) {
     case EVENT_LBUTTONDOWN:
-        *static_cast<Point*>(userdata) = Point(x, y);
+        disp_coords = Point(event.x, event.y);
     }
 }
 
@@ -238,7 +471,69 @@ void draw_calibrate_ui(Mat& disp8, int distance, short disparity) {
 
 void draw_measure_ui(Mat& disp8, const Point& disp_coords, double distance) {
         circle(disp8, disp_coords, 8, Scalar(255, 255, 255), 1);
-        putText(disp8, "distance: " + to_string(distance) + "mm", {5, left.rows-45}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 255), 1, LINE_AA);
-        putText(disp8, "press c to calibrate", {5, disp8.rows-25}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 255), 1, LINE_AA);
-        putText(disp8, "press q to quit", {5, disp8.rows-5}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 255), 1, LINE_AA);
+        putText(disp8, "distance: " + to_string(distance) + "mm", {5, disp8.rows-65}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 255), 1, LINE_AA);
+        putText(disp8, "press c to calibrate, d to save depth, p/s for points", {5, disp8.rows-45}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 255), 1, LINE_AA);
+        putText(disp8, "press t for temporal mode, e for eyes, b to benchmark", {5, disp8.rows-25}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 255), 1, LINE_AA);
+        putText(disp8, "press r for stage timings, v to record, q to quit", {5, disp8.rows-5}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 255), 1, LINE_AA);
+}
+
+void draw_temporal_ui(Mat& disp8, int dirty_tiles, int total_tiles) {
+    string tiles = to_string(dirty_tiles) + "/" + to_string(total_tiles);
+    putText(disp8, "temporal mode: " + tiles + " tiles matched", {5, 65}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 255), 1, LINE_AA);
+}
+
+void draw_engine_ui(Mat& disp8, const string& engine_name) {
+    putText(disp8, "engine: " + engine_name, {disp8.cols-160, 25}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 255), 1, LINE_AA);
+}
+
+void draw_cloud_ui(Mat& disp8, size_t points) {
+    putText(disp8, "streaming " + to_string(points) + " points", {disp8.cols-250, 45}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 255), 1, LINE_AA);
+}
+
+void draw_record_ui(Mat& disp8) {
+    putText(disp8, "recording", {disp8.cols-160, 65}, FONT_HERSHEY_PLAIN, 1.5, Scalar(255, 255, 255), 1, LINE_AA);
+}
+
+// shows a recording at the speed it was taken, space pauses and q stops
+int play_recording(const string& path, bool headless) {
+    DepthReader reader;
+    if (!reader.open(path)) {
+        cout << "could not read recording: " << path << endl;
+        return -1;
+    }
+    size_t count = reader.frame_count();
+    double duration = count > 0 ? reader.timestamp(count-1) : 0.;
+    cout << path << ": " << count << " frames over " << duration << "s, "
+         << (reader.type() == CV_16S ? "disparity" : "depth") << endl;
+    if (headless) {
+        return 0;
+    }
+
+    DisplayService display(false);
+    double scale = reader.type() == CV_16S ? 255/(NUM_DISPARITIES_MAX*16.) : 255/PLAY_DEPTH_RANGE_MM;
+    Mat frame, view;
+    bool paused = false;
+    for (size_t i = 0; i < count; ) {
+        if (!paused) {
+            if (!reader.read(i, frame)) {
+                cout << "frame " << i << " is damaged, stopping" << endl;
+                break;
+            }
+            frame.convertTo(view, CV_8U, scale);
+            display.show(path, view);
+            double wait = i + 1 < count ? reader.timestamp(i+1) - reader.timestamp(i) : 0.;
+            this_thread::sleep_for(chrono::duration<double>(min(max(wait, 0.), 1.)));
+            i++;
+        } else {
+            this_thread::sleep_for(chrono::milliseconds(30));
+        }
+        int key = display.pollKey();
+        if (key == 'q' || key == 27) {
+            break;
+        }
+        if (key == ' ') {
+            paused = !paused;
+        }
+    }
+    return 0;
 }
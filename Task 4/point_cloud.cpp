@@ -0,0 +1,172 @@
+#include "point_cloud.h"
+
+#include <cmath>
+
+using namespace cv;
+using namespace std;
+
+#define CLOUD_KEY_BITS 21
+#define CLOUD_KEY_BIAS (1 << (CLOUD_KEY_BITS - 1))
+#define CLOUD_KEY_MASK ((1ull << CLOUD_KEY_BITS) - 1)
+
+PointCloudBuilder::PointCloudBuilder(const Mat& Q, Size size, int max_disparity, float voxel_size)
+    : voxel_size_(voxel_size), table_(size_t(1) << CLOUD_HASH_BITS) {
+    Mat q64;
+    Q.convertTo(q64, CV_64F);
+    Q_ = Matx44d(q64.ptr<double>());
+
+    // stereoRectify gives [1 0 0 -cx; 0 1 0 -cy; 0 0 0 f; 0 0 -1/Tx (cx-cx')/Tx], anything else takes the slow path
+    const Matx44d& q = Q_;
+    separable_ = q(0,1) == 0 && q(0,2) == 0 && q(1,0) == 0 && q(1,2) == 0
+              && q(2,0) == 0 && q(2,1) == 0 && q(2,2) == 0 && q(3,0) == 0 && q(3,1) == 0;
+
+    col_x_.resize(size_t(size.width));
+    for (int x = 0; x < size.width; x++) {
+        col_x_[size_t(x)] = float(q(0,0)*x + q(0,3));
+    }
+    row_y_.resize(size_t(size.height));
+    for (int y = 0; y < size.height; y++) {
+        row_y_[size_t(y)] = float(q(1,1)*y + q(1,3));
+    }
+
+    // a zero entry marks a disparity that is behind the camera or beyond the depth limit
+    size_t entries = size_t(max_disparity)*16 + 1;
+    inv_w_.assign(entries, 0.f);
+    depth_.assign(entries, 0.f);
+    for (size_t d16 = 1; d16 < entries; d16++) {
+        double w = q(3,2)*(d16/16.) + q(3,3);
+        if (w <= 0) {
+            continue;
+        }
+        double z = q(2,3)/w;
+        if (z <= 0 || z > CLOUD_MAX_DEPTH_MM) {
+            continue;
+        }
+        inv_w_[d16] = float(1./w);
+        depth_[d16] = float(z);
+    }
+}
+
+void PointCloudBuilder::build(const Mat& disp, vector<Point3f>& points) {
+    CV_Assert(disp.type() == CV_16S);
+    if (++stamp_ == 0) {
+        // the stamp wrapped, old slots could look current again
+        for (Voxel& v : table_) {
+            v.stamp = 0;
+        }
+        stamp_ = 1;
+    }
+    used_.clear();
+
+    const int rows = min(disp.rows, int(row_y_.size()));
+    const int cols = min(disp.cols, int(col_x_.size()));
+    const int entries = int(inv_w_.size());
+    for (int y = 0; y < rows; y++) {
+        const short* d = disp.ptr<short>(y);
+        for (int x = 0; x < cols; x++) {
+            int d16 = d[x];
+            if (d16 <= 0 || d16 >= entries || inv_w_[size_t(d16)] == 0.f) {
+                continue;
+            }
+            if (separable_) {
+                float iw = inv_w_[size_t(d16)];
+                add_point(col_x_[size_t(x)]*iw, row_y_[size_t(y)]*iw, depth_[size_t(d16)]);
+            } else {
+                Vec4d p = Q_*Vec4d(x, y, d16/16., 1.);
+                add_point(float(p[0]/p[3]), float(p[1]/p[3]), float(p[2]/p[3]));
+            }
+        }
+    }
+
+    points.resize(used_.size());
+    for (size_t i = 0; i < used_.size(); i++) {
+        const Voxel& v = table_[used_[i]];
+        points[i] = Point3f(v.x/v.count, v.y/v.count, v.z/v.count);
+    }
+}
+
+// open addressing with linear probing, new voxels are dropped once the output limit is reached
+void PointCloudBuilder::add_point(float x, float y, float z) {
+    const float inv_size = 1.f/voxel_size_;
+    uint64_t ix = uint64_t(int64_t(floor(x*inv_size)) + CLOUD_KEY_BIAS) & CLOUD_KEY_MASK;
+    uint64_t iy = uint64_t(int64_t(floor(y*inv_size)) + CLOUD_KEY_BIAS) & CLOUD_KEY_MASK;
+    uint64_t iz = uint64_t(int64_t(floor(z*inv_size)) + CLOUD_KEY_BIAS) & CLOUD_KEY_MASK;
+    uint64_t key = ix | (iy << CLOUD_KEY_BITS) | (iz << (2*CLOUD_KEY_BITS));
+
+    const size_t mask = table_.size() - 1;
+    size_t slot = size_t((key*0x9E3779B97F4A7C15ull) >> (64 - CLOUD_HASH_BITS));
+    for (;;) {
+        Voxel& v = table_[slot];
+        if (v.stamp != stamp_) {
+            if (used_.size() >= CLOUD_MAX_POINTS) {
+                return;
+            }
+            v.key = key;
+            v.stamp = stamp_;
+            v.count = 1;
+            v.x = x;
+            v.y = y;
+            v.z = z;
+            used_.push_back(uint32_t(slot));
+            return;
+        }
+        if (v.key == key) {
+            v.count++;
+            v.x += x;
+            v.y += y;
+            v.z += z;
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+bool PointCloudWriter::open(const string& path) {
+    close();
+    out_.open(path, ios::binary | ios::trunc);
+    start_ticks_ = getTickCount();
+    return out_.is_open();
+}
+
+void PointCloudWriter::close() {
+    if (out_.is_open()) {
+        out_.close();
+    }
+}
+
+void PointCloudWriter::write_frame(uint32_t frame_id, const vector<Point3f>& points, float voxel_size) {
+    if (!out_.is_open()) {
+        return;
+    }
+    RecordHeader header;
+    header.magic = CLOUD_RECORD_MAGIC;
+    header.frame_id = frame_id;
+    header.timestamp = double(getTickCount() - start_ticks_)/getTickFrequency();
+    header.count = uint32_t(points.size());
+    header.voxel_size = voxel_size;
+
+    buffer_.resize(points.size()*3);
+    for (size_t i = 0; i < points.size(); i++) {
+        buffer_[i*3]   = saturate_cast<int16_t>(points[i].x);
+        buffer_[i*3+1] = saturate_cast<int16_t>(points[i].y);
+        buffer_[i*3+2] = saturate_cast<int16_t>(points[i].z);
+    }
+    out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out_.write(reinterpret_cast<const char*>(buffer_.data()), streamsize(buffer_.size()*sizeof(int16_t)));
+}
+
+bool PointCloudWriter::write_ply(const string& path, const vector<Point3f>& points) {
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+    file << "ply\n"
+         << "format binary_little_endian 1.0\n"
+         << "element vertex " << points.size() << "\n"
+         << "property float x\n"
+         << "property float y\n"
+         << "property float z\n"
+         << "end_header\n";
+    file.write(reinterpret_cast<const char*>(points.data()), streamsize(points.size()*sizeof(Point3f)));
+    return file.good();
+}
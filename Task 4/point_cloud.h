@@ -0,0 +1,73 @@
+#ifndef POINT_CLOUD_H
+#define POINT_CLOUD_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#define CLOUD_VOXEL_SIZE_MM 20.f       // edge of a voxel, every voxel becomes one output point
+#define CLOUD_MAX_DEPTH_MM 4000.f      // anything further away is too noisy to be worth keeping
+#define CLOUD_HASH_BITS 16             // 65536 slot voxel table
+#define CLOUD_MAX_POINTS (1 << (CLOUD_HASH_BITS - 1)) // table is never filled past half, bounds the output
+#define CLOUD_RECORD_MAGIC 0x504c574f  // "OWLP"
+
+// reprojects a disparity map to 3D with the Q matrix from stereoRectify and downsamples the points into
+// a hashed voxel grid. Q is split into per-column, per-row and per-disparity tables when it has the
+// usual rectified layout, so each pixel costs a few lookups and multiplies instead of a 4x4 product.
+class PointCloudBuilder {
+public:
+    PointCloudBuilder(const cv::Mat& Q, cv::Size size, int max_disparity, float voxel_size = CLOUD_VOXEL_SIZE_MM);
+
+    // voxel centroids in millimetres, camera frame of the left eye
+    void build(const cv::Mat& disp, std::vector<cv::Point3f>& points);
+
+private:
+    struct Voxel {
+        uint64_t key;
+        uint32_t stamp;  // frame the slot was last used in, saves clearing the table every frame
+        uint32_t count;
+        float x, y, z;
+    };
+
+    void add_point(float x, float y, float z);
+
+    cv::Matx44d Q_;
+    bool separable_;
+    float voxel_size_;
+    std::vector<float> col_x_, row_y_;     // q00*x + q03 and q11*y + q13
+    std::vector<float> inv_w_, depth_;     // 1/w and z/w per disparity in 1/16 pixel steps
+    std::vector<Voxel> table_;
+    std::vector<uint32_t> used_;
+    uint32_t stamp_ = 0;
+};
+
+// streams voxelised clouds to disk, either as one binary PLY per snapshot or as a sequence of compact
+// per-frame records (header + int16 millimetre coordinates, 6 bytes per point)
+class PointCloudWriter {
+public:
+    struct RecordHeader {
+        uint32_t magic;
+        uint32_t frame_id;
+        double timestamp;    // seconds since the stream was opened
+        uint32_t count;
+        float voxel_size;
+    };
+
+    ~PointCloudWriter() { close(); }
+
+    bool open(const std::string& path);
+    void close();
+    bool is_open() const { return out_.is_open(); }
+    void write_frame(uint32_t frame_id, const std::vector<cv::Point3f>& points, float voxel_size = CLOUD_VOXEL_SIZE_MM);
+
+    static bool write_ply(const std::string& path, const std::vector<cv::Point3f>& points);
+
+private:
+    std::ofstream out_;
+    int64_t start_ticks_ = 0;
+    std::vector<int16_t> buffer_;
+};
+
+#endif // POINT_CLOUD_H
@@ -0,0 +1,182 @@
+#include "stereo_engine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+using namespace cv;
+using namespace std;
+
+// OpenCV's semi-global block matcher, the original Task 4 matcher
+class SgbmEngine : public StereoEngine {
+public:
+    SgbmEngine(int block_size, int num_disparities) {
+        sgbm_ = StereoSGBM::create(0, 16, 3);
+        sgbm_->setPreFilterCap(63);
+        sgbm_->setMinDisparity(0);
+        sgbm_->setUniquenessRatio(10);
+        sgbm_->setSpeckleWindowSize(100);
+        sgbm_->setSpeckleRange(32);
+        sgbm_->setDisp12MaxDiff(1);
+        sgbm_->setMode(StereoSGBM::MODE_SGBM);
+        set_block_size(block_size);
+        set_num_disparities(num_disparities);
+    }
+    string name() const override { return "sgbm"; }
+    void compute(const Mat& left, const Mat& right, Mat& disp) override {
+        // the smoothness penalties scale with the number of channels the matching cost is summed over
+        if (left.channels() != channels_) {
+            channels_ = left.channels();
+            set_block_size(block_size());
+        }
+        sgbm_->compute(left, right, disp);
+    }
+    Ptr<StereoEngine> clone() const override {
+        Ptr<StereoEngine> engine = makePtr<SgbmEngine>(block_size(), num_disparities());
+        engine->set_min_disparity(min_disparity());
+        return engine;
+    }
+    void set_block_size(int block_size) override {
+        sgbm_->setBlockSize(block_size);
+        sgbm_->setP1(8*channels_*block_size*block_size);
+        sgbm_->setP2(32*channels_*block_size*block_size);
+    }
+    void set_num_disparities(int num_disparities) override { sgbm_->setNumDisparities(num_disparities); }
+    void set_min_disparity(int min_disparity) override { sgbm_->setMinDisparity(min_disparity); }
+    int block_size() const override { return sgbm_->getBlockSize(); }
+    int num_disparities() const override { return sgbm_->getNumDisparities(); }
+    int min_disparity() const override { return sgbm_->getMinDisparity(); }
+private:
+    Ptr<StereoSGBM> sgbm_;
+    int channels_ = 1;
+};
+
+// OpenCV's local block matcher, greyscale only and a lot cheaper than SGBM
+class BmEngine : public StereoEngine {
+public:
+    BmEngine(int block_size, int num_disparities) {
+        bm_ = StereoBM::create(16, 9);
+        bm_->setPreFilterCap(31);
+        bm_->setMinDisparity(0);
+        bm_->setTextureThreshold(10);
+        bm_->setUniquenessRatio(15);
+        bm_->setSpeckleWindowSize(100);
+        bm_->setSpeckleRange(32);
+        bm_->setDisp12MaxDiff(1);
+        set_block_size(block_size);
+        set_num_disparities(num_disparities);
+    }
+    string name() const override { return "bm"; }
+    void compute(const Mat& left, const Mat& right, Mat& disp) override {
+        if (left.channels() == 3) {
+            cvtColor(left, left_grey_, COLOR_BGR2GRAY);
+            cvtColor(right, right_grey_, COLOR_BGR2GRAY);
+            bm_->compute(left_grey_, right_grey_, disp);
+        } else {
+            bm_->compute(left, right, disp);
+        }
+    }
+    Ptr<StereoEngine> clone() const override {
+        Ptr<StereoEngine> engine = makePtr<BmEngine>(block_size(), num_disparities());
+        engine->set_min_disparity(min_disparity());
+        return engine;
+    }
+    // StereoBM only accepts odd block sizes of 5 or more
+    void set_block_size(int block_size) override { bm_->setBlockSize(max(5, block_size | 1)); }
+    void set_num_disparities(int num_disparities) override { bm_->setNumDisparities(num_disparities); }
+    void set_min_disparity(int min_disparity) override { bm_->setMinDisparity(min_disparity); }
+    int block_size() const override { return bm_->getBlockSize(); }
+    int num_disparities() const override { return bm_->getNumDisparities(); }
+    int min_disparity() const override { return bm_->getMinDisparity(); }
+private:
+    Ptr<StereoBM> bm_;
+    Mat left_grey_, right_grey_;
+};
+
+Ptr<StereoEngine> create_sgbm_engine(int block_size, int num_disparities) {
+    return makePtr<SgbmEngine>(block_size, num_disparities);
+}
+
+Ptr<StereoEngine> create_bm_engine(int block_size, int num_disparities) {
+    return makePtr<BmEngine>(block_size, num_disparities);
+}
+
+bool load_stereo_pairs(const string& list_file, vector<StereoPair>& pairs) {
+    pairs.clear();
+    FileStorage fs(list_file, FileStorage::READ);
+    if (!fs.isOpened()) {
+        return false;
+    }
+    FileNode n = fs.getFirstTopLevelNode();
+    if (n.type() != FileNode::SEQ) {
+        return false;
+    }
+    vector<string> files;
+    for (FileNodeIterator it = n.begin(); it != n.end(); ++it) {
+        files.push_back(string(*it));
+    }
+    for (size_t i = 0; i + 1 < files.size(); i += 2) {
+        Mat left = imread(files[i], IMREAD_COLOR);
+        Mat right = imread(files[i+1], IMREAD_COLOR);
+        if (left.empty() || right.empty() || left.size() != right.size()) {
+            cout << "skipping pair " << files[i] << ", " << files[i+1] << endl;
+            continue;
+        }
+        pairs.push_back(StereoPair(left, right));
+    }
+    return !pairs.empty();
+}
+
+void benchmark_engines(const vector<Ptr<StereoEngine>>& engines, const vector<StereoPair>& pairs, ostream& out) {
+    if (engines.empty() || pairs.empty()) {
+        return;
+    }
+
+    // reference disparity maps for the quality comparison
+    vector<Mat> reference(pairs.size());
+    for (size_t i = 0; i < pairs.size(); i++) {
+        engines[0]->compute(pairs[i].first, pairs[i].second, reference[i]);
+    }
+
+    out << left << setw(10) << "engine" << right
+        << setw(12) << "mean ms" << setw(12) << "stddev ms" << setw(10) << "fps"
+        << setw(12) << "density %" << setw(12) << "agree %" << endl;
+
+    for (const Ptr<StereoEngine>& engine : engines) {
+        Mat disp;
+        // warm up so one-off allocations are not timed
+        engine->compute(pairs[0].first, pairs[0].second, disp);
+
+        double sum = 0, sum_sq = 0;
+        int runs = 0;
+        double valid = 0, agree = 0, both_valid = 0, pixels = 0;
+        for (size_t i = 0; i < pairs.size(); i++) {
+            for (int r = 0; r < BENCH_REPEATS; r++) {
+                int64 start = getTickCount();
+                engine->compute(pairs[i].first, pairs[i].second, disp);
+                double ms = (getTickCount() - start)*1000./getTickFrequency();
+                sum += ms;
+                sum_sq += ms*ms;
+                runs++;
+            }
+
+            Mat engine_valid = disp > (engine->min_disparity() - 1)*16;
+            Mat ref_valid = reference[i] > (engines[0]->min_disparity() - 1)*16;
+            Mat diff;
+            absdiff(disp, reference[i], diff);
+            Mat agreeing = (diff <= BENCH_AGREE_THRESH) & engine_valid & ref_valid;
+            valid += countNonZero(engine_valid);
+            both_valid += countNonZero(engine_valid & ref_valid);
+            agree += countNonZero(agreeing);
+            pixels += disp.total();
+        }
+
+        double mean_ms = sum/runs;
+        double stddev_ms = sqrt(max(0., sum_sq/runs - mean_ms*mean_ms));
+        out << left << setw(10) << engine->name() << right << fixed << setprecision(2)
+            << setw(12) << mean_ms << setw(12) << stddev_ms << setw(10) << 1000./mean_ms
+            << setw(12) << 100.*valid/pixels << setw(12) << (both_valid > 0 ? 100.*agree/both_valid : 0.) << endl;
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef STEREO_ENGINE_H
+#define STEREO_ENGINE_H
+
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/calib3d.hpp>
+
+#define BENCH_REPEATS 5          // timed runs per image pair
+#define BENCH_AGREE_THRESH 16    // 1 pixel in 1/16 disparity units, used to compare an engine against the reference
+
+// common interface for the block matchers Task 4 can switch between at runtime.
+// every engine takes rectified 8-bit images (grey or BGR) and produces a CV_16S disparity map with
+// 4 fractional bits, pixels without a match are set to (min_disparity-1)*16 like OpenCV's matchers.
+class StereoEngine {
+public:
+    virtual ~StereoEngine() {}
+
+    virtual std::string name() const = 0;
+    virtual void compute(const cv::Mat& left, const cv::Mat& right, cv::Mat& disp) = 0;
+    // new engine with the same settings, used when a matcher is needed for sub-regions of a frame
+    virtual cv::Ptr<StereoEngine> clone() const = 0;
+
+    virtual void set_block_size(int block_size) = 0;
+    virtual void set_num_disparities(int num_disparities) = 0;
+    virtual void set_min_disparity(int min_disparity) = 0;
+    virtual int block_size() const = 0;
+    virtual int num_disparities() const = 0;
+    virtual int min_disparity() const = 0;
+};
+
+cv::Ptr<StereoEngine> create_sgbm_engine(int block_size, int num_disparities);
+cv::Ptr<StereoEngine> create_bm_engine(int block_size, int num_disparities);
+cv::Ptr<StereoEngine> create_census_engine(int block_size, int num_disparities);
+// SGBM over the full range at 1/4 resolution, refined within a few pixels at 1/2 and full resolution
+cv::Ptr<StereoEngine> create_hierarchical_engine(int block_size, int num_disparities);
+// SGBM on half size images, upsampled with a left-right checked, edge aware WLS filter
+cv::Ptr<StereoEngine> create_wls_engine(int block_size, int num_disparities);
+
+// a left/right image pair
+typedef std::pair<cv::Mat, cv::Mat> StereoPair;
+
+// read an image list in the Stereo Calibration format (alternating left/right file names)
+bool load_stereo_pairs(const std::string& list_file, std::vector<StereoPair>& pairs);
+// time every engine over the pairs and report speed and quality, the first engine is the quality reference
+void benchmark_engines(const std::vector<cv::Ptr<StereoEngine>>& engines, const std::vector<StereoPair>& pairs,
+                       std::ostream& out = std::cout);
+
+#endif // STEREO_ENGINE_H
@@ -0,0 +1,199 @@
+#include "temporal_stereo.h"
+
+#include <algorithm>
+#include <climits>
+#include <opencv2/imgproc.hpp>
+
+using namespace cv;
+using namespace std;
+
+// shrink a frame to a small greyscale image, cheap enough to difference every frame
+static void to_small_grey(const Mat& src, Mat& dst) {
+    Mat small;
+    resize(src, small, Size(), 1./TEMPORAL_DIFF_SCALE, 1./TEMPORAL_DIFF_SCALE, INTER_AREA);
+    if (small.channels() == 3) {
+        cvtColor(small, dst, COLOR_BGR2GRAY);
+    } else {
+        dst = small;
+    }
+}
+
+// map a full resolution tile onto the difference image
+static Rect small_rect(const Rect& r, Size small_size) {
+    Rect s(r.x/TEMPORAL_DIFF_SCALE, r.y/TEMPORAL_DIFF_SCALE,
+           max(1, r.width/TEMPORAL_DIFF_SCALE), max(1, r.height/TEMPORAL_DIFF_SCALE));
+    return s & Rect(Point(0, 0), small_size);
+}
+
+TemporalStereo::TemporalStereo(Ptr<StereoEngine> engine)
+    : engine_(engine) {
+}
+
+void TemporalStereo::reset() {
+    disp_.release();
+    tiles_.clear();
+}
+
+void TemporalStereo::set_engine(Ptr<StereoEngine> engine) {
+    engine_ = engine;
+    tile_engine_.release();
+    reset();
+}
+
+void TemporalStereo::compute(const Mat& left, const Mat& right, Mat& disp) {
+    Mat small_left, small_right;
+    to_small_grey(left, small_left);
+    to_small_grey(right, small_right);
+
+    bool full = settings_changed() || tile_engine_.empty();
+    if (full) {
+        tile_engine_ = engine_->clone();
+    }
+    full |= disp_.empty() || disp_.size() != left.size();
+    full |= ++frames_since_full_ >= TEMPORAL_REFRESH_FRAMES;
+    if (!full) {
+        mark_dirty_tiles(small_left, small_right);
+        full = dirty_count_ > TEMPORAL_FULL_FRACTION*tiles_.size();
+    }
+
+    if (full) {
+        full_compute(left, right);
+        small_left_ = small_left;
+        small_right_ = small_right;
+    } else if (dirty_count_ > 0) {
+        // every range is taken from the previous map before any tile gets overwritten
+        vector<Vec2i> ranges(tiles_.size());
+        for (size_t i = 0; i < tiles_.size(); i++) {
+            if (tiles_[i].dirty) {
+                search_range(i, ranges[i][0], ranges[i][1]);
+            }
+        }
+        for (size_t i = 0; i < tiles_.size(); i++) {
+            Tile& tile = tiles_[i];
+            if (!tile.dirty) {
+                continue;
+            }
+            compute_tile(left, right, tile, ranges[i][0], ranges[i][1]);
+            update_tile_range(tile);
+
+            // the reference image only moves on where the disparity was refreshed, so slow changes still add up
+            Rect r = small_rect(tile.rect, small_left.size());
+            small_left(r).copyTo(small_left_(r));
+            small_right(r).copyTo(small_right_(r));
+        }
+    }
+
+    disp_.copyTo(disp);
+}
+
+void TemporalStereo::full_compute(const Mat& left, const Mat& right) {
+    engine_->compute(left, right, disp_);
+    if (tiles_.empty() || tiles_x_*TEMPORAL_TILE_SIZE < disp_.cols || tiles_y_*TEMPORAL_TILE_SIZE < disp_.rows) {
+        build_tiles(disp_.size());
+    }
+    for (Tile& tile : tiles_) {
+        tile.dirty = true;
+        update_tile_range(tile);
+    }
+    dirty_count_ = int(tiles_.size());
+    frames_since_full_ = 0;
+}
+
+void TemporalStereo::build_tiles(Size size) {
+    tiles_x_ = (size.width + TEMPORAL_TILE_SIZE - 1)/TEMPORAL_TILE_SIZE;
+    tiles_y_ = (size.height + TEMPORAL_TILE_SIZE - 1)/TEMPORAL_TILE_SIZE;
+    tiles_.clear();
+    for (int ty = 0; ty < tiles_y_; ty++) {
+        for (int tx = 0; tx < tiles_x_; tx++) {
+            Tile tile;
+            tile.rect = Rect(tx*TEMPORAL_TILE_SIZE, ty*TEMPORAL_TILE_SIZE, TEMPORAL_TILE_SIZE, TEMPORAL_TILE_SIZE)
+                      & Rect(Point(0, 0), size);
+            tile.min_disp = SHRT_MAX;
+            tile.max_disp = SHRT_MIN;
+            tile.dirty = true;
+            tiles_.push_back(tile);
+        }
+    }
+}
+
+void TemporalStereo::mark_dirty_tiles(const Mat& small_left, const Mat& small_right) {
+    Mat diff_left, diff_right, diff;
+    absdiff(small_left, small_left_, diff_left);
+    absdiff(small_right, small_right_, diff_right);
+    cv::max(diff_left, diff_right, diff);
+
+    dirty_count_ = 0;
+    for (Tile& tile : tiles_) {
+        tile.dirty = mean(diff(small_rect(tile.rect, diff.size())))[0] > TEMPORAL_CHANGE_THRESH;
+        dirty_count_ += tile.dirty;
+    }
+}
+
+void TemporalStereo::update_tile_range(Tile& tile) {
+    Mat roi = disp_(tile.rect);
+    Mat valid = roi > (min_disparity_ - 1)*16;
+    if (countNonZero(valid) == 0) {
+        tile.min_disp = SHRT_MAX;
+        tile.max_disp = SHRT_MIN;
+        return;
+    }
+    double lo, hi;
+    minMaxLoc(roi, &lo, &hi, nullptr, nullptr, valid);
+    tile.min_disp = short(lo);
+    tile.max_disp = short(hi);
+}
+
+// union of the previous ranges of a tile and its neighbours, so objects moving in from the side are still found
+void TemporalStereo::search_range(size_t index, int& min_disp, int& max_disp) const {
+    int tx = int(index) % tiles_x_, ty = int(index) / tiles_x_;
+    int lo = INT_MAX, hi = INT_MIN;
+    for (int y = max(0, ty - 1); y <= min(tiles_y_ - 1, ty + 1); y++) {
+        for (int x = max(0, tx - 1); x <= min(tiles_x_ - 1, tx + 1); x++) {
+            const Tile& n = tiles_[size_t(y*tiles_x_ + x)];
+            if (n.min_disp <= n.max_disp) {
+                lo = min(lo, int(n.min_disp));
+                hi = max(hi, int(n.max_disp));
+            }
+        }
+    }
+
+    min_disp = min_disparity_;
+    max_disp = min_disparity_ + num_disparities_;
+    if (lo <= hi) {
+        min_disp = max(min_disp, lo/16 - TEMPORAL_DISP_MARGIN);
+        max_disp = min(max_disp, hi/16 + 1 + TEMPORAL_DISP_MARGIN);
+    }
+}
+
+void TemporalStereo::compute_tile(const Mat& left, const Mat& right, const Tile& tile, int min_disp, int max_disp) {
+    int num_disp = max(16, (max_disp - min_disp + 15) & ~15);
+
+    // the matcher only produces output once x >= min_disp+num_disp, so the crop reaches that far left of the tile
+    const Rect& inner = tile.rect;
+    int x0 = max(0, inner.x - min_disp - num_disp - TEMPORAL_TILE_PAD);
+    int y0 = max(0, inner.y - TEMPORAL_TILE_PAD);
+    int x1 = min(left.cols, inner.br().x + TEMPORAL_TILE_PAD);
+    int y1 = min(left.rows, inner.br().y + TEMPORAL_TILE_PAD);
+    Rect crop(x0, y0, x1 - x0, y1 - y0);
+
+    tile_engine_->set_min_disparity(min_disp);
+    tile_engine_->set_num_disparities(num_disp);
+    tile_engine_->compute(left(crop), right(crop), tile_disp_);
+
+    // pixels the narrowed search rejected get the same invalid value a full frame match would give them
+    Mat src = tile_disp_(Rect(inner.x - x0, inner.y - y0, inner.width, inner.height));
+    Mat dst = disp_(inner);
+    src.copyTo(dst);
+    dst.setTo(Scalar((min_disparity_ - 1)*16), src < min_disp*16);
+}
+
+// the trackbars change the matcher between frames, any change invalidates the stored map
+bool TemporalStereo::settings_changed() {
+    bool changed = engine_->block_size() != block_size_
+                || engine_->num_disparities() != num_disparities_
+                || engine_->min_disparity() != min_disparity_;
+    block_size_ = engine_->block_size();
+    num_disparities_ = engine_->num_disparities();
+    min_disparity_ = engine_->min_disparity();
+    return changed;
+}
@@ -0,0 +1,58 @@
+#ifndef TEMPORAL_STEREO_H
+#define TEMPORAL_STEREO_H
+
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "stereo_engine.h"
+
+#define TEMPORAL_TILE_SIZE 80        // tile edge in pixels, 640x480 splits into 8x6 tiles
+#define TEMPORAL_DIFF_SCALE 4        // frame difference is taken at 1/4 resolution
+#define TEMPORAL_CHANGE_THRESH 6.0   // mean absolute grey level change that marks a tile as dirty
+#define TEMPORAL_DISP_MARGIN 8       // extra disparity search (pixels) either side of the previous range
+#define TEMPORAL_TILE_PAD 16         // context added around a tile so block matching has support
+#define TEMPORAL_REFRESH_FRAMES 60   // force a full frame match every N frames so errors cannot persist
+#define TEMPORAL_FULL_FRACTION 0.5   // above this fraction of dirty tiles a full frame match is cheaper
+
+// keeps the previous disparity map and only rematches the tiles that changed since the last frame.
+// each rematched tile searches a disparity range narrowed around what it (and its neighbours) held before.
+class TemporalStereo {
+public:
+    explicit TemporalStereo(cv::Ptr<StereoEngine> engine);
+
+    // same contract as StereoEngine::compute
+    void compute(const cv::Mat& left, const cv::Mat& right, cv::Mat& disp);
+    // drop the stored state so the next frame is matched in full
+    void reset();
+    void set_engine(cv::Ptr<StereoEngine> engine);
+
+    int dirty_tiles() const { return dirty_count_; }
+    int total_tiles() const { return int(tiles_.size()); }
+
+private:
+    struct Tile {
+        cv::Rect rect;
+        short min_disp; // previous valid range in 1/16 pixel units, min > max when the tile held no valid pixels
+        short max_disp;
+        bool dirty;
+    };
+
+    void full_compute(const cv::Mat& left, const cv::Mat& right);
+    void build_tiles(cv::Size size);
+    void mark_dirty_tiles(const cv::Mat& small_left, const cv::Mat& small_right);
+    void update_tile_range(Tile& tile);
+    void search_range(size_t index, int& min_disp, int& max_disp) const;
+    void compute_tile(const cv::Mat& left, const cv::Mat& right, const Tile& tile, int min_disp, int max_disp);
+    bool settings_changed();
+
+    cv::Ptr<StereoEngine> engine_;
+    cv::Ptr<StereoEngine> tile_engine_;
+    std::vector<Tile> tiles_;
+    int tiles_x_ = 0, tiles_y_ = 0;
+    cv::Mat disp_, small_left_, small_right_, tile_disp_;
+    int block_size_ = 0, num_disparities_ = 0, min_disparity_ = 0;
+    int frames_since_full_ = 0;
+    int dirty_count_ = 0;
+};
+
+#endif // TEMPORAL_STEREO_H
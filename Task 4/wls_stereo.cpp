@@ -0,0 +1,101 @@
+#include "stereo_engine.h"
+
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/ximgproc/disparity_filter.hpp>
+
+using namespace cv;
+using namespace std;
+
+#define WLS_SCALE 2            // matching runs at 1/2 resolution in each direction
+#define WLS_LAMBDA 8000.       // smoothness of the filtered map
+#define WLS_SIGMA_COLOR 1.5    // how strongly edges in the guide image stop the smoothing
+
+// fast matcher for display and point queries: SGBM matches the left and the right view at half resolution
+// (1/4 of the pixels and 1/2 of the disparities, so about 1/8 of the work) and the WLS filter upsamples the
+// left map to full resolution guided by the full size left image. the output is dense and keeps object
+// edges where the guide has them.
+class WlsEngine : public StereoEngine {
+public:
+    WlsEngine(int block_size, int num_disparities) {
+        left_matcher_ = StereoSGBM::create(0, 16, 3);
+        left_matcher_->setPreFilterCap(63);
+        left_matcher_->setUniquenessRatio(10);
+        left_matcher_->setSpeckleWindowSize(100);
+        left_matcher_->setSpeckleRange(32);
+        left_matcher_->setDisp12MaxDiff(1);
+        left_matcher_->setMode(StereoSGBM::MODE_SGBM);
+        set_block_size(block_size);
+        set_num_disparities(num_disparities);
+    }
+    string name() const override { return "wls"; }
+    void compute(const Mat& left, const Mat& right, Mat& disp) override;
+    Ptr<StereoEngine> clone() const override {
+        Ptr<StereoEngine> engine = makePtr<WlsEngine>(block_size_, num_disparities_);
+        engine->set_min_disparity(min_disparity_);
+        return engine;
+    }
+    void set_block_size(int block_size) override {
+        block_size_ = block_size | 1;
+        stale_ = true;
+    }
+    void set_num_disparities(int num_disparities) override {
+        num_disparities_ = num_disparities;
+        stale_ = true;
+    }
+    void set_min_disparity(int min_disparity) override {
+        min_disparity_ = min_disparity;
+        stale_ = true;
+    }
+    int block_size() const override { return block_size_; }
+    int num_disparities() const override { return num_disparities_; }
+    int min_disparity() const override { return min_disparity_; }
+
+private:
+    void configure();
+
+    Ptr<StereoSGBM> left_matcher_;
+    Ptr<StereoMatcher> right_matcher_;
+    Ptr<ximgproc::DisparityWLSFilter> wls_;
+    int block_size_ = 0, num_disparities_ = 0, min_disparity_ = 0, channels_ = 1;
+    bool stale_ = true;
+    Mat small_left_, small_right_, left_disp_, right_disp_;
+};
+
+// the right matcher and the filter copy the left matcher's settings when they are created, so both are
+// rebuilt whenever a setting changes
+void WlsEngine::configure() {
+    // the half size search still needs a multiple of 16 disparities
+    int small_block = max(3, (block_size_/WLS_SCALE) | 1);
+    left_matcher_->setBlockSize(small_block);
+    left_matcher_->setP1(8*channels_*small_block*small_block);
+    left_matcher_->setP2(32*channels_*small_block*small_block);
+    left_matcher_->setMinDisparity(min_disparity_/WLS_SCALE);
+    left_matcher_->setNumDisparities(max(16, (num_disparities_/WLS_SCALE + 15) & ~15));
+
+    right_matcher_ = ximgproc::createRightMatcher(left_matcher_);
+    wls_ = ximgproc::createDisparityWLSFilter(left_matcher_);
+    wls_->setLambda(WLS_LAMBDA);
+    wls_->setSigmaColor(WLS_SIGMA_COLOR);
+    stale_ = false;
+}
+
+void WlsEngine::compute(const Mat& left, const Mat& right, Mat& disp) {
+    if (stale_ || left.channels() != channels_) {
+        channels_ = left.channels();
+        configure();
+    }
+    resize(left, small_left_, Size(), 1./WLS_SCALE, 1./WLS_SCALE, INTER_AREA);
+    resize(right, small_right_, Size(), 1./WLS_SCALE, 1./WLS_SCALE, INTER_AREA);
+    left_matcher_->compute(small_left_, small_right_, left_disp_);
+    right_matcher_->compute(small_right_, small_left_, right_disp_);
+
+    // the left-right check becomes a per pixel confidence that weights the filter, inconsistent pixels are
+    // filled in from their confident neighbours. given a guide larger than the disparity maps the filter
+    // upsamples them and scales the values to match.
+    wls_->filter(left_disp_, left, disp, right_disp_, Rect(), right);
+}
+
+Ptr<StereoEngine> create_wls_engine(int block_size, int num_disparities) {
+    return makePtr<WlsEngine>(block_size, num_disparities);
+}
@@ -0,0 +1,11 @@
+TEMPLATE = app
+CONFIG += console c++17
+CONFIG -= app_bundle
+CONFIG -= qt
+
+#====================Project Includes======================
+SOURCES += \
+    main.cpp
+
+HEADERS += \
+    ..\telemetry.h
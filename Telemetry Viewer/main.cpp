@@ -0,0 +1,146 @@
+//Telemetry viewer: follows the per frame records a running tool publishes to its shared memory ring, as a live
+//summary once a second or dumped to CSV. it only reads the ring, the tool never waits for it
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../telemetry.h"
+
+using namespace std;
+
+#define VIEWER_POLL_MS 50           //well inside the time the tools take to wrap the ring
+#define VIEWER_SUMMARY_MS 1000
+#define VIEWER_RETRY_MS 500         //while the tool has not started yet
+
+static atomic<bool> running(true);
+
+static void onInterrupt(int)
+{
+    running = false;
+}
+
+static void writeCsvHeader(ostream& out, const TelemetryHeader& info)
+{
+    out << "frame,time_us";
+    for(uint32_t i = 0; i < info.stageCount; i++)
+        out << "," << info.stageNames[i] << "_ms";
+    out << ",rx,ry,lx,ly,neck,confidence,distance\n";
+}
+
+static void writeCsvRecord(ostream& out, const TelemetryHeader& info, const TelemetryRecord& r)
+{
+    out << r.frameId << "," << r.timeUs;
+    for(uint32_t i = 0; i < info.stageCount; i++)
+        out << "," << r.stageMs[i];
+    for(int i = 0; i < TELEMETRY_SERVOS; i++)
+        out << "," << r.servos[i];
+    out << "," << r.confidence << "," << r.distance << "\n";
+}
+
+//one line per interval: rate, mean stage times, where the servos are and what the tracker reports
+static void printSummary(const TelemetryHeader& info, const vector<TelemetryRecord>& records, uint64_t lost, double seconds)
+{
+    if(records.empty()) {
+        cout << info.tool << ": no new frames" << endl;
+        return;
+    }
+    cout << fixed << setprecision(1) << info.tool << ": " << records.size()/seconds << " fps";
+    for(uint32_t i = 0; i < info.stageCount; i++) {
+        double sum = 0;
+        for(const TelemetryRecord& r : records)
+            sum += r.stageMs[i];
+        cout << "  " << info.stageNames[i] << " " << sum/records.size() << "ms";
+    }
+    const TelemetryRecord& last = records.back();
+    cout << "  servos (" << last.servos[0];
+    for(int i = 1; i < TELEMETRY_SERVOS; i++)
+        cout << ", " << last.servos[i];
+    cout << ")";
+    if(last.confidence >= 0)
+        cout << setprecision(2) << "  confidence " << last.confidence << setprecision(1);
+    if(last.distance >= 0)
+        cout << "  distance " << last.distance << "mm";
+    if(lost > 0)
+        cout << "  lost " << lost;
+    cout << defaultfloat << endl;
+}
+
+int main(int argc, char** argv)
+{
+    string tool, csvPath;
+    for(int i = 1; i < argc; i++) {
+        if(strncmp(argv[i], "-csv=", 5) == 0)
+            csvPath = argv[i] + 5;
+        else if(argv[i][0] != '-')
+            tool = argv[i];
+    }
+    if(tool.empty()) {
+        cout << "Usage:\n ./TelemetryViewer <task1|task2|task3|task4|servocalib> [-csv=<file>]\n"
+                "prints a summary each second, or with -csv writes every record to the file until ctrl-c" << endl;
+        return 0;
+    }
+    signal(SIGINT, onInterrupt);
+
+    TelemetryReader reader;
+    bool waiting = false;
+    while(running && !reader.open(tool)) {
+        if(!waiting)
+            cout << "Waiting for " << tool << " to start publishing..." << endl;
+        waiting = true;
+        this_thread::sleep_for(chrono::milliseconds(VIEWER_RETRY_MS));
+    }
+    if(!running)
+        return 0;
+    const TelemetryHeader& info = reader.info();
+    cout << "Following " << info.tool << ", " << info.capacity << " record ring" << endl;
+
+    ofstream csv;
+    if(!csvPath.empty()) {
+        csv.open(csvPath);
+        if(!csv.is_open()) {
+            cout << "Could not open " << csvPath << endl;
+            return -1;
+        }
+        writeCsvHeader(csv, info);
+    }
+
+    vector<TelemetryRecord> records;
+    uint64_t lost = 0, written = 0;
+    //the summary is a live rate, so skip what is already in the ring. the CSV keeps it
+    if(!csv.is_open()) {
+        reader.poll(records);
+        records.clear();
+    }
+    auto summaryStart = chrono::steady_clock::now();
+    while(running) {
+        this_thread::sleep_for(chrono::milliseconds(VIEWER_POLL_MS));
+        lost += reader.poll(records);
+
+        if(csv.is_open()) {
+            for(const TelemetryRecord& r : records)
+                writeCsvRecord(csv, info, r);
+            written += records.size();
+            records.clear();
+            continue;
+        }
+        auto now = chrono::steady_clock::now();
+        double elapsed = chrono::duration<double>(now - summaryStart).count();
+        if(elapsed*1000 >= VIEWER_SUMMARY_MS) {
+            printSummary(info, records, lost, elapsed);
+            records.clear();
+            lost = 0;
+            summaryStart = now;
+        }
+    }
+    if(csv.is_open())
+        cout << written << " records written to " << csvPath << (lost ? ", " + to_string(lost) + " lost" : "") << endl;
+    return 0;
+}
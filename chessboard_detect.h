@@ -0,0 +1,126 @@
+#ifndef CHESSBOARD_DETECT_H
+#define CHESSBOARD_DETECT_H
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#define CHESS_DETECT_WIDTH 320        //width the first detection runs at
+#define CHESS_DETECT_FLAGS (cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_NORMALIZE_IMAGE)
+#define CHESS_UPSCALE 2               //last resort for boards too small to detect at full resolution
+#define CHESS_UPSCALE_MAX_SPACING 24  //px between corners at full resolution above which upscaling cannot help
+#define CHESS_REFINE_WIN_MAX 11       //cornerSubPix half window, the old fixed value
+#define CHESS_REFINE_WIN_MIN 3
+
+//which step of findChessboard found the board
+enum ChessboardLevel
+{
+    CHESS_NOT_FOUND = 0,
+    CHESS_FOUND_DOWNSCALED,
+    CHESS_FOUND_FULL,
+    CHESS_FOUND_UPSCALED
+};
+
+//smallest distance between neighbouring corners, bounds how far cornerSubPix may search
+inline float chessboardSpacing(const std::vector<cv::Point2f>& corners, cv::Size boardSize)
+{
+    float spacing = FLT_MAX;
+    for(int y = 0; y < boardSize.height; y++)
+        for(int x = 0; x < boardSize.width; x++) {
+            const cv::Point2f& p = corners[size_t(y*boardSize.width + x)];
+            if(x + 1 < boardSize.width)
+                spacing = std::min(spacing, float(cv::norm(p - corners[size_t(y*boardSize.width + x + 1)])));
+            if(y + 1 < boardSize.height)
+                spacing = std::min(spacing, float(cv::norm(p - corners[size_t((y + 1)*boardSize.width + x)])));
+        }
+    return spacing;
+}
+
+//rough square size of a board that was only partly detected, from the closest pair of the corners found.
+//0 if there are too few to tell
+inline float partialChessboardSpacing(const std::vector<cv::Point2f>& corners)
+{
+    float spacing = FLT_MAX;
+    for(size_t i = 0; i < corners.size(); i++)
+        for(size_t j = i + 1; j < corners.size(); j++)
+            spacing = std::min(spacing, float(cv::norm(corners[i] - corners[j])));
+    return spacing == FLT_MAX ? 0.f : spacing;
+}
+
+//map corners found in a resized copy back to the original image (pixel centres line up, not the corners)
+inline void rescaleCorners(std::vector<cv::Point2f>& corners, double scale)
+{
+    for(cv::Point2f& p : corners)
+        p = cv::Point2f(float((p.x + 0.5)/scale - 0.5), float((p.y + 0.5)/scale - 0.5));
+}
+
+//refine corners against the full resolution image with a window that stays inside one square
+inline void refineChessboard(const cv::Mat& grey, cv::Size boardSize, std::vector<cv::Point2f>& corners)
+{
+    int win = int(chessboardSpacing(corners, boardSize)*0.4f);
+    win = std::max(CHESS_REFINE_WIN_MIN, std::min(CHESS_REFINE_WIN_MAX, win));
+    cv::cornerSubPix(grey, corners, cv::Size(win, win), cv::Size(-1, -1),
+                     cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.01));
+}
+
+//quick detection on a copy downscaled to CHESS_DETECT_WIDTH, corners are mapped back to full resolution but
+//not refined. cheap enough to run on every live frame
+inline bool findChessboardDownscaled(const cv::Mat& grey, cv::Size boardSize, std::vector<cv::Point2f>& corners)
+{
+    corners.clear();
+    double scale = std::min(1., double(CHESS_DETECT_WIDTH)/grey.cols);
+    cv::Mat small = grey;
+    if(scale < 1.)
+        cv::resize(grey, small, cv::Size(), scale, scale, cv::INTER_AREA);
+    if(!cv::findChessboardCorners(small, boardSize, corners, CHESS_DETECT_FLAGS | cv::CALIB_CB_FAST_CHECK)) {
+        corners.clear();
+        return false;
+    }
+    rescaleCorners(corners, scale);
+    return true;
+}
+
+//find and refine a chessboard in an 8-bit greyscale image, cheapest attempt first:
+// 1. quick presence check and detection on a copy downscaled to CHESS_DETECT_WIDTH
+// 2. full resolution detection
+// 3. a CHESS_UPSCALE times upscaled detection, as the original calibration always tried. it is only skipped
+//    when the corners the full resolution search did find are at least CHESS_UPSCALE_MAX_SPACING apart, a
+//    board that large fails for some other reason than its size. with no corners to judge by it still runs
+//every success is refined with cornerSubPix at full resolution, so the accuracy does not depend on the step.
+inline ChessboardLevel findChessboard(const cv::Mat& grey, cv::Size boardSize, std::vector<cv::Point2f>& corners)
+{
+    corners.clear();
+    if(grey.empty())
+        return CHESS_NOT_FOUND;
+
+    if(grey.cols > CHESS_DETECT_WIDTH && findChessboardDownscaled(grey, boardSize, corners)) {
+        refineChessboard(grey, boardSize, corners);
+        return CHESS_FOUND_DOWNSCALED;
+    }
+
+    if(cv::findChessboardCorners(grey, boardSize, corners, CHESS_DETECT_FLAGS)) {
+        refineChessboard(grey, boardSize, corners);
+        return CHESS_FOUND_FULL;
+    }
+    //a failed search can still hand back the corners it did find, they tell how big the squares are
+    if(partialChessboardSpacing(corners) >= CHESS_UPSCALE_MAX_SPACING) {
+        corners.clear();
+        return CHESS_NOT_FOUND;
+    }
+
+    cv::Mat large;
+    cv::resize(grey, large, cv::Size(), CHESS_UPSCALE, CHESS_UPSCALE);
+    if(cv::findChessboardCorners(large, boardSize, corners, CHESS_DETECT_FLAGS)) {
+        rescaleCorners(corners, CHESS_UPSCALE);
+        refineChessboard(grey, boardSize, corners);
+        return CHESS_FOUND_UPSCALED;
+    }
+    corners.clear();
+    return CHESS_NOT_FOUND;
+}
+
+#endif // CHESSBOARD_DETECT_H
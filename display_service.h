@@ -0,0 +1,274 @@
+#ifndef DISPLAY_SERVICE_H
+#define DISPLAY_SERVICE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#define DISPLAY_REFRESH_HZ 30       //default window refresh rate
+#define DISPLAY_EVENT_LIMIT 64      //oldest events are dropped if the processing loop stops reading them
+#define DISPLAY_HEADLESS_FLAG "-headless"
+
+//a key press, mouse event or trackbar move from one of the windows
+struct DisplayEvent
+{
+    enum Type { KEY, MOUSE, TRACKBAR };
+    Type type;
+    std::string window;
+    std::string name;   //trackbar name
+    int key = -1;       //KEY: key code as returned by waitKey
+    int event = 0;      //MOUSE: cv::MouseEventTypes, position and flags
+    int x = 0, y = 0, flags = 0;
+    int pos = 0;        //TRACKBAR: new position
+};
+
+//runs HighGUI on its own thread so the processing loop never sleeps in waitKey or waits for a window to
+//redraw. show() drops the frame into a per-window mailbox, replacing one that has not been drawn yet, and the
+//display thread draws whatever is newest at a fixed refresh rate. input comes back through an event queue,
+//trackbar moves included, so their handlers run on the processing thread. every window call (trackbars,
+//mouse callbacks, closing) is forwarded to the display thread because HighGUI windows belong to the thread
+//that created them. in headless mode no thread or window is created and everything is a no-op, callers can
+//check headless() to skip drawing overlays altogether.
+class DisplayService
+{
+public:
+    explicit DisplayService(bool headless = false, double refreshHz = DISPLAY_REFRESH_HZ)
+        : headlessMode(headless), period(std::chrono::microseconds(int64_t(1e6/std::max(1., refreshHz))))
+    {
+        if(!headlessMode)
+            worker = std::thread(&DisplayService::run, this);
+    }
+
+    ~DisplayService()
+    {
+        running = false;
+        if(worker.joinable())
+            worker.join();
+    }
+
+    DisplayService(const DisplayService&) = delete;
+    DisplayService& operator=(const DisplayService&) = delete;
+
+    bool headless() const { return headlessMode; }
+
+    //queue a frame for a window. the image is copied into a recycled buffer, so the caller can keep drawing on it
+    void show(const std::string& window, const cv::Mat& image)
+    {
+        if(headlessMode || image.empty())
+            return;
+        cv::Mat buffer;
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);
+            buffer = mailboxes[window].spare;
+            mailboxes[window].spare.release();
+        }
+        image.copyTo(buffer);
+        std::lock_guard<std::mutex> lock(frameMutex);
+        Mailbox& box = mailboxes[window];
+        std::swap(box.pending, buffer);
+        box.fresh = true;
+        //a frame that was never drawn is dropped and its buffer reused
+        if(box.spare.empty())
+            box.spare = buffer;
+    }
+
+    //report mouse events for a window through the event queue
+    void trackMouse(const std::string& window)
+    {
+        post([this, window]() {
+            cv::namedWindow(window);
+            mouseSlots.push_back(Slot{this, window, ""});
+            cv::setMouseCallback(window, onMouse, &mouseSlots.back());
+        });
+    }
+
+    //create a trackbar, its moves are reported through the event queue
+    void addTrackbar(const std::string& name, const std::string& window, int value, int max, int min = 0)
+    {
+        post([this, name, window, value, max, min]() {
+            cv::namedWindow(window);
+            trackbarSlots.push_back(Slot{this, window, name});
+            cv::createTrackbar(name, window, nullptr, max, onTrackbar, &trackbarSlots.back());
+            cv::setTrackbarMin(name, window, min);
+            cv::setTrackbarPos(name, window, value);
+        });
+    }
+
+    void setTrackbarPos(const std::string& name, const std::string& window, int pos)
+    {
+        post([name, window, pos]() { cv::setTrackbarPos(name, window, pos); });
+    }
+
+    void closeWindow(const std::string& window)
+    {
+        if(headlessMode)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);
+            mailboxes.erase(window);
+        }
+        post([window]() { cv::destroyWindow(window); });
+    }
+
+    //next queued event, false if there are none
+    bool pollEvent(DisplayEvent& event)
+    {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        if(events.empty())
+            return false;
+        event = events.front();
+        events.pop_front();
+        return true;
+    }
+
+    //next key press or -1, for tools that only take keyboard input. other queued events are discarded
+    int pollKey()
+    {
+        DisplayEvent event;
+        while(pollEvent(event))
+            if(event.type == DisplayEvent::KEY)
+                return event.key;
+        return -1;
+    }
+
+private:
+    struct Mailbox
+    {
+        cv::Mat pending, spare;
+        bool fresh = false;
+    };
+
+    struct Slot
+    {
+        DisplayService* service;
+        std::string window, name;
+    };
+
+    void post(std::function<void()> command)
+    {
+        if(headlessMode)
+            return;
+        std::lock_guard<std::mutex> lock(commandMutex);
+        commands.push_back(std::move(command));
+    }
+
+    void pushEvent(const DisplayEvent& event)
+    {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        if(events.size() >= DISPLAY_EVENT_LIMIT)
+            events.pop_front();
+        events.push_back(event);
+    }
+
+    static void onMouse(int event, int x, int y, int flags, void* userdata)
+    {
+        Slot* slot = static_cast<Slot*>(userdata);
+        DisplayEvent e;
+        e.type = DisplayEvent::MOUSE;
+        e.window = slot->window;
+        e.event = event;
+        e.x = x;
+        e.y = y;
+        e.flags = flags;
+        //plain mouse moves would flood the queue, only buttons and the wheel are reported
+        if(event != cv::EVENT_MOUSEMOVE)
+            slot->service->pushEvent(e);
+    }
+
+    static void onTrackbar(int pos, void* userdata)
+    {
+        Slot* slot = static_cast<Slot*>(userdata);
+        DisplayEvent e;
+        e.type = DisplayEvent::TRACKBAR;
+        e.window = slot->window;
+        e.name = slot->name;
+        e.pos = pos;
+        slot->service->pushEvent(e);
+    }
+
+    void run()
+    {
+        std::vector<std::function<void()>> pendingCommands;
+        std::vector<std::pair<std::string, cv::Mat>> frames;
+        while(running) {
+            auto next = std::chrono::steady_clock::now() + period;
+
+            {
+                std::lock_guard<std::mutex> lock(commandMutex);
+                pendingCommands.swap(commands);
+            }
+            for(std::function<void()>& command : pendingCommands)
+                command();
+            pendingCommands.clear();
+
+            {
+                std::lock_guard<std::mutex> lock(frameMutex);
+                for(auto& box : mailboxes) {
+                    if(!box.second.fresh)
+                        continue;
+                    frames.emplace_back(box.first, cv::Mat());
+                    std::swap(frames.back().second, box.second.pending);
+                    box.second.fresh = false;
+                }
+            }
+            for(auto& frame : frames)
+                cv::imshow(frame.first, frame.second);
+            {
+                //imshow keeps its own copy, so the buffers go back for reuse
+                std::lock_guard<std::mutex> lock(frameMutex);
+                for(auto& frame : frames) {
+                    auto box = mailboxes.find(frame.first);
+                    if(box != mailboxes.end() && box->second.spare.empty())
+                        box->second.spare = frame.second;
+                }
+            }
+            frames.clear();
+
+            //waitKey pumps the window messages and sleeps out the rest of the refresh period
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(next - std::chrono::steady_clock::now());
+            int key = cv::waitKey(std::max(1, int(left.count())));
+            if(key != -1) {
+                DisplayEvent e;
+                e.type = DisplayEvent::KEY;
+                e.key = key;
+                pushEvent(e);
+            }
+        }
+        cv::destroyAllWindows();
+    }
+
+    bool headlessMode;
+    std::chrono::steady_clock::duration period;
+    std::atomic<bool> running{true};
+    std::thread worker;
+
+    std::mutex frameMutex, commandMutex, eventMutex;
+    std::map<std::string, Mailbox> mailboxes;
+    std::vector<std::function<void()>> commands;
+    std::deque<DisplayEvent> events;
+    std::list<Slot> mouseSlots, trackbarSlots;  //only touched by the display thread, lists keep the callback pointers valid
+};
+
+//true if the tool was started with -headless
+inline bool displayHeadless(int argc, char** argv)
+{
+    for(int i = 1; i < argc; i++)
+        if(strcmp(argv[i], DISPLAY_HEADLESS_FLAG) == 0 || strcmp(argv[i], "--headless") == 0)
+            return true;
+    return false;
+}
+
+#endif // DISPLAY_SERVICE_H
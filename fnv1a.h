@@ -0,0 +1,16 @@
+#ifndef FNV1A_H
+#define FNV1A_H
+
+#include <cstddef>
+#include <cstdint>
+
+//FNV-1a, continued from a previous hash so several inputs can be chained
+inline uint64_t fnv1a(const void* data, size_t n, uint64_t hash = 14695981039346656037ull)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    for(size_t i = 0; i < n; i++)
+        hash = (hash ^ p[i])*1099511628211ull;
+    return hash;
+}
+
+#endif // FNV1A_H
@@ -0,0 +1,151 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+//OpenCV 4.1 passes the access flags to MatAllocator::allocate as int, later versions as cv::AccessFlag.
+//the type is deduced from the allocate overload itself so the pool builds against either
+template <typename Flags>
+Flags framePoolAccessFlags(cv::UMatData* (cv::MatAllocator::*)(int, const int*, int, void*, size_t*, Flags, cv::UMatUsageFlags) const);
+typedef decltype(framePoolAccessFlags(&cv::MatAllocator::allocate)) FramePoolAccessFlags;
+
+struct FramePoolStats
+{
+    size_t capacity = 0;
+    size_t inUse = 0;
+    size_t peakInUse = 0;
+    uint64_t served = 0;            //buffers handed out from the pool
+    uint64_t heapAllocations = 0;   //requests the pool could not serve (too large or none free), these hit the heap
+};
+
+//fixed number of equally sized image buffers, allocated up front and reused. the pool is a cv::MatAllocator:
+//a Mat created with mat.allocator = &pool takes a free buffer, and when the last Mat or view referring to it
+//is released OpenCV's own reference count hands it back. buffers are cv::fastMalloc aligned (SIMD friendly)
+//and written once at construction so their pages are resident before the first frame. a steady
+//heapAllocations count means the loop runs without touching the heap for its frames.
+//the pool has to outlive every Mat holding one of its buffers.
+class FramePool : public cv::MatAllocator
+{
+public:
+    FramePool(cv::Size size, int type, int count) : frameSize(size), frameType(type),
+        bufferSize(size_t(size.area())*CV_ELEM_SIZE(type)), slots(size_t(count))
+    {
+        counters.capacity = slots.size();
+        freeSlots.reserve(slots.size());
+        for(Slot& slot : slots) {
+            slot.data = static_cast<uchar*>(cv::fastMalloc(bufferSize));
+            std::memset(slot.data, 0, bufferSize);
+            slot.u = new cv::UMatData(this);
+            slot.u->userdata = &slot;
+            freeSlots.push_back(&slot);
+        }
+    }
+
+    ~FramePool()
+    {
+        for(Slot& slot : slots) {
+            delete slot.u;
+            cv::fastFree(slot.data);
+        }
+    }
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    //point mat at a pooled buffer of the pool's size and type. whatever it held before is released first,
+    //so a Mat acquired every frame keeps cycling through the same buffer
+    void acquire(cv::Mat& mat) const
+    {
+        mat.release();
+        mat.allocator = const_cast<FramePool*>(this);
+        mat.create(frameSize, frameType);
+    }
+
+    FramePoolStats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counters;
+    }
+
+    void report(std::ostream& out) const
+    {
+        FramePoolStats s = stats();
+        out << "frame pool  " << s.inUse << "/" << s.capacity << " in use (peak " << s.peakInUse << "), "
+            << s.served << " served, " << s.heapAllocations << " heap allocations\n";
+    }
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                           FramePoolAccessFlags flags, cv::UMatUsageFlags usage) const override
+    {
+        //wrapping memory the caller owns, nothing to pool
+        if(data)
+            return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage);
+
+        //continuous layout, the same steps the default allocator fills in
+        size_t total = CV_ELEM_SIZE(type);
+        for(int i = dims - 1; i >= 0; i--) {
+            if(step)
+                step[i] = total;
+            total *= size_t(sizes[i]);
+        }
+
+        Slot* slot = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(total <= bufferSize && !freeSlots.empty()) {
+                slot = freeSlots.back();
+                freeSlots.pop_back();
+                counters.served++;
+                counters.inUse++;
+                counters.peakInUse = std::max(counters.peakInUse, counters.inUse);
+            }
+            else
+                counters.heapAllocations++;
+        }
+        if(!slot)
+            return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, nullptr, step, flags, usage);
+
+        cv::UMatData* u = slot->u;
+        u->data = u->origdata = slot->data;
+        u->size = total;
+        u->refcount = u->urefcount = 0;
+        return u;
+    }
+
+    bool allocate(cv::UMatData* u, FramePoolAccessFlags, cv::UMatUsageFlags) const override
+    {
+        return u != nullptr;
+    }
+
+    //called by OpenCV once nothing refers to the buffer any more
+    void deallocate(cv::UMatData* u) const override
+    {
+        CV_Assert(u->refcount == 0 && u->urefcount == 0);
+        std::lock_guard<std::mutex> lock(mutex);
+        freeSlots.push_back(static_cast<Slot*>(u->userdata));
+        counters.inUse--;
+    }
+
+private:
+    struct Slot
+    {
+        uchar* data = nullptr;
+        cv::UMatData* u = nullptr;  //kept with the buffer so handing it out does not allocate either
+    };
+
+    cv::Size frameSize;
+    int frameType;
+    size_t bufferSize;
+    std::vector<Slot> slots;
+    mutable std::vector<Slot*> freeSlots;   //last in first out, the buffer just returned is still in cache
+    mutable std::mutex mutex;
+    mutable FramePoolStats counters;
+};
+
+#endif // FRAME_POOL_H
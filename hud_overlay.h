@@ -0,0 +1,109 @@
+#ifndef HUD_OVERLAY_H
+#define HUD_OVERLAY_H
+
+#include <functional>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#define HUD_OUTLINE_KERNEL 3    //erode size for the outline, the same 1px black edge the tools drew by hand
+
+//draws one element into a frame sized single channel mask with Scalar(255), anti-aliased edges become partial
+//alpha. state is whatever the caller passed to setState, e.g. whether a key is held
+typedef std::function<void(cv::Mat& mask, int state)> HudDraw;
+
+//static HUD drawing that is rasterised once instead of every frame. each element is rendered into a sprite
+//cropped to its bounding box and only rendered again when its state changes. compose() blends the sprites
+//over a frame through vectorised OpenCV arithmetic on the bounding boxes alone, the rest of the frame is not
+//touched. sprites are stored premultiplied: blended = frame*(255 - alpha)/255 + colour*alpha/255.
+class HudOverlay
+{
+public:
+    explicit HudOverlay(cv::Size frameSize) : frameSize(frameSize) {}
+
+    //add an element drawn in colour. with outline the shape gets a black edge, like drawing the mask in black,
+    //eroding it and drawing it again in colour. returns the id for setState/setVisible
+    int add(HudDraw draw, cv::Scalar colour, bool outline = false, int state = 0)
+    {
+        Element element;
+        element.draw = draw;
+        element.colour = colour;
+        element.outline = outline;
+        element.state = state;
+        elements.push_back(element);
+        return int(elements.size()) - 1;
+    }
+
+    //the element is rendered again before the next compose only if the state actually changed
+    void setState(int id, int state)
+    {
+        Element& element = elements[size_t(id)];
+        if(element.state != state) {
+            element.state = state;
+            element.dirty = true;
+        }
+    }
+
+    void setVisible(int id, bool visible) { elements[size_t(id)].visible = visible; }
+
+    //blend every visible element over an 8-bit BGR frame of the size given at construction
+    void compose(cv::Mat& frame)
+    {
+        CV_Assert(frame.type() == CV_8UC3 && frame.size() == frameSize);
+        for(Element& element : elements) {
+            if(!element.visible)
+                continue;
+            if(element.dirty)
+                render(element);
+            if(element.box.area() == 0)
+                continue;
+            cv::Mat roi = frame(element.box);
+            cv::multiply(roi, element.inverseAlpha, element.scratch, 1./255);
+            cv::add(element.scratch, element.premultiplied, roi);
+        }
+    }
+
+private:
+    struct Element
+    {
+        HudDraw draw;
+        cv::Scalar colour;
+        bool outline = false;
+        int state = 0;
+        bool visible = true;
+        bool dirty = true;
+        cv::Rect box;
+        cv::Mat premultiplied;  //colour*alpha/255, CV_8UC3
+        cv::Mat inverseAlpha;   //255 - alpha in all three channels, CV_8UC3
+        cv::Mat scratch;        //reused by compose
+    };
+
+    void render(Element& element)
+    {
+        element.dirty = false;
+        cv::Mat mask(frameSize, CV_8U, cv::Scalar(0));
+        element.draw(mask, element.state);
+        element.box = cv::boundingRect(mask);
+        if(element.box.area() == 0)
+            return;
+
+        //alpha is the drawn coverage, the colour is black on the outline and the element colour inside it
+        cv::Mat alpha = mask(element.box).clone();
+        cv::Mat colour(alpha.size(), CV_8UC3, element.colour);
+        if(element.outline) {
+            cv::Mat inner;
+            cv::erode(alpha, inner, cv::Mat::ones(HUD_OUTLINE_KERNEL, HUD_OUTLINE_KERNEL, CV_8U));
+            colour.setTo(cv::Scalar(0, 0, 0), inner == 0);
+        }
+        cv::Mat alpha3;
+        cv::Mat channels[3] = {alpha, alpha, alpha};
+        cv::merge(channels, 3, alpha3);
+        cv::multiply(colour, alpha3, element.premultiplied, 1./255);
+        cv::subtract(cv::Scalar::all(255), alpha3, element.inverseAlpha);
+    }
+
+    cv::Size frameSize;
+    std::vector<Element> elements;
+};
+
+#endif // HUD_OVERLAY_H
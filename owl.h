@@ -9,27 +9,129 @@
 #include <windows.h>
 #include <sys/types.h>
 #include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include <functional>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include "frame_pool.h"
+
 using namespace std;
 using namespace cv;
 
 #define SERVO_PWM2RAD 0.00174532925
+#define OWL_CALIB_FILEPATH "../owl_calib.txt"   //written by the servo calibration, shared by every tool
+#define OWL_CALIB_ITEMS 5                       //RxC RyC LxC LyC NeckC
+#define OWL_HOST_ENV "OWL_HOST"                 //set to another address, e.g. 127.0.0.1 for the Owl Simulator
+#define OWL_FRAME_POOL_SIZE 12                  //stereo frames in flight at once, enough for the deepest pipeline
+#define OWL_DEFAULT_HOST "10.0.0.10"
+#define OWL_SERVO_PORT 12345
+#define OWL_STREAM_PORT 8080
+
+//read the servo centres written by the servo calibration, the values are left as they are if the file is missing
+inline bool loadOwlCalibration(const char* filepath, int calib[OWL_CALIB_ITEMS])
+{
+    std::ifstream file(filepath);
+    int values[OWL_CALIB_ITEMS];
+    for(int i = 0; i < OWL_CALIB_ITEMS; i++)
+        if(!(file >> values[i]))
+            return false;
+    for(int i = 0; i < OWL_CALIB_ITEMS; i++)
+        calib[i] = values[i];
+    return true;
+}
+
+inline bool saveOwlCalibration(const char* filepath, const int calib[OWL_CALIB_ITEMS])
+{
+    std::ofstream file(filepath);
+    if(!file.is_open()) {
+        std::cout << "could not open: " << filepath << "\n";
+        return false;
+    }
+    for(int i = 0; i < OWL_CALIB_ITEMS; i++)
+        file << calib[i] << " ";
+    return file.good();
+}
+
+//camera frames are drawn from here. a function static, so it outlives every Mat still holding one of its buffers
+inline FramePool& owlFramePool()
+{
+    static FramePool pool(Size(640*2, 480), CV_8UC3, OWL_FRAME_POOL_SIZE);
+    return pool;
+}
+
+//where one owl is and how to drive it. the defaults are the single owl on the lab network, with OWL_HOST
+//applied, so one process can also drive several owls or simulators by giving each its own config
+struct OwlConfig
+{
+    string host = OWL_DEFAULT_HOST;
+    int servoPort = OWL_SERVO_PORT;
+    int streamPort = OWL_STREAM_PORT;
+    string calibPath = OWL_CALIB_FILEPATH;
+    bool quietMode = false;             //camera only, the servos are never sent anything
+    bool externalServos = false;        //no socket of its own, packets go to the sender given to routeServoPackets
+    FramePool* framePool = nullptr;     //owlFramePool() if not set
+
+    //the servo server and the camera stream both live on the owl, OWL_HOST moves them elsewhere
+    static OwlConfig fromEnvironment()
+    {
+        OwlConfig config;
+        if(const char* host = getenv(OWL_HOST_ENV))
+        {
+            config.host = host;
+            cout<<"Using the owl at "<<config.host<<endl;
+        }
+        return config;
+    }
+
+    string streamUrl() const { return "http://" + host + ":" + to_string(streamPort) + "/stream/video.mjpeg"; }
+};
 
 //A class to manage the TCP and IP camera streams between the owl and the PC
 class robotOwl
 {
 public:
 
-    //connect to the owl on initilisation
+    //connect to the owl on initilisation. the servo centres in OWL_CALIB_FILEPATH are used if it exists,
+    //the values passed in are only a fallback for an owl that has not been calibrated
     robotOwl(int RxC, int RyC, int LxC, int LyC, int NeckC, bool quietMode = false)
+        : robotOwl(quietConfig(quietMode), RxC, RyC, LxC, LyC, NeckC)
     {
-        //quiet mode doesnt activate the motors, you can use this if you only need the camera feed
-        this->quietMode=quietMode;
+    }
+
+    robotOwl(const OwlConfig& config, int RxC, int RyC, int LxC, int LyC, int NeckC)
+    {
+        int calib[OWL_CALIB_ITEMS] = {RxC, RyC, LxC, LyC, NeckC};
+        if(loadOwlCalibration(config.calibPath.c_str(), calib))
+            cout<<"Servo calibration loaded from "<<config.calibPath<<endl;
+        RxC=calib[0];
+        RyC=calib[1];
+        LxC=calib[2];
+        LyC=calib[3];
+        NeckC=calib[4];
+
+        PiADDR = config.host;
+        PORT = config.servoPort;
+        source = config.streamUrl();
+        framePool = config.framePool ? config.framePool : &owlFramePool();
+        externalServos = config.externalServos;
 
-        if(!quietMode)
+        //quiet mode doesnt activate the motors, you can use this if you only need the camera feed
+        this->quietMode=config.quietMode;
+
+        //save calibration values, the owl starts at its centres. set in every mode so the positions
+        //reported by getRawServoPositions are always defined, even if nothing is ever sent
+        this->RxC=RxC;
+        this->RyC=RyC;
+        this->LxC=LxC;
+        this->LyC=LyC;
+        this->NeckC=NeckC;
+        Rx=RxC; Ry=RyC; Lx=LxC; Ly=LyC; Neck=NeckC;
+
+        //with external servos whoever routes the packets owns the connection, only the positions are kept here
+        if(!quietMode && !externalServos)
         {
             //check winSock version
             WSAData version;
@@ -57,6 +159,7 @@ public:
             if(conn==SOCKET_ERROR){
                 std::cout<<"Unable to open socket "<<WSAGetLastError()<<std::endl;
                 closesocket(u_sock);
+                u_sock=INVALID_SOCKET;
                 WSACleanup();
 
                 cout<<"Make sure to run ./OWLsocket on the owls terminal"<<endl;
@@ -65,12 +168,6 @@ public:
             else
                 cout<<"Owl TCP connection established"<<endl;
 
-            //save calibration values
-            this->RxC=RxC;
-            this->RyC=RyC;
-            this->LxC=LxC;
-            this->LyC=LyC;
-            this->NeckC=NeckC;
             setServoRawPositions(RxC, RyC, LxC, LyC, NeckC);
         }
 
@@ -86,7 +183,14 @@ public:
     //close stream when owl leaves scope
     ~robotOwl()
     {
-        closesocket(u_sock);
+        if(u_sock!=INVALID_SOCKET)
+            closesocket(u_sock);
+    }
+
+    //with OwlConfig::externalServos, every servo packet goes to sender instead of a socket of the owl's own
+    void routeServoPackets(std::function<void(const string&)> sender)
+    {
+        servoSender = sender;
     }
 
     //set all servos to raw PWM positions
@@ -137,16 +241,45 @@ public:
         sendServoPos();
     }
 
-    //read camera frames
+    //read camera frames. left and right are views into one pooled buffer, see owlFramePool
     void getCameraFrames(Mat& left, Mat& right)
     {
-        //if the cameras dont return a frame, set frame to black
+        grabCameraFrames();
+        retrieveCameraFrames(left, right);
+    }
+
+    //the two halves of getCameraFrames: grab waits for the next frame of the stream, retrieve decodes it.
+    //split so the waiting and the decoding can happen on different threads
+    bool grabCameraFrames()
+    {
+        grabbed = cap.grab();
+        return grabbed;
+    }
+
+    //drop the camera stream and open it again, for a stream that was not up when the owl was created or that
+    //has stopped delivering frames since
+    bool reconnectCamera()
+    {
+        cap.release();
+        grabbed = false;
+        return cap.open(source);
+    }
+
+    void retrieveCameraFrames(Mat& left, Mat& right)
+    {
+        //hand the previous frame back first, a caller that keeps left and right across frames cycles one buffer
+        left.release();
+        right.release();
         Mat Frame;
-        if (!cap.read(Frame))
+        framePool->acquire(Frame);
+        if (!grabbed || !cap.retrieve(Frame))
         {
+            //if the cameras dont return a frame, set frame to black. a failed retrieve may have released the buffer
             cout  << "Could not open the input video: " << source << endl;
-            Frame = Mat(Size(640*2,480), CV_8UC3, Scalar(0,0,0));
+            framePool->acquire(Frame);
+            Frame.setTo(Scalar(0,0,0));
         }
+        grabbed = false;
 
         //flip and split the frame into left and right images
         flip(Frame,Frame,1);
@@ -154,6 +287,16 @@ public:
         right=Frame( Rect(640, 0, 640, 480));
     }
 
+    //replace the servo centres used by setServoAbsolutePositions, e.g. after calibrating
+    void setServoCentres(int RxC, int RyC, int LxC, int LyC, int NeckC)
+    {
+        this->RxC=RxC;
+        this->RyC=RyC;
+        this->LxC=LxC;
+        this->LyC=LyC;
+        this->NeckC=NeckC;
+    }
+
     //return the raw servo positions
     void getRawServoPositions(int& Rx, int& Ry, int& Lx, int& Ly, int& Neck)
     {
@@ -184,12 +327,23 @@ public:
 	
 
 private:
-    SOCKET u_sock;
+    SOCKET u_sock=INVALID_SOCKET;
     string source ="http://10.0.0.10:8080/stream/video.mjpeg"; // was argv[1];           // the source file name
-    string PiADDR = "10.0.0.10";
-    int PORT=12345;
+    string PiADDR = OWL_DEFAULT_HOST;
+    int PORT=OWL_SERVO_PORT;
     VideoCapture cap;
     bool quietMode;
+    bool grabbed = false;
+    FramePool* framePool;
+    bool externalServos = false;
+    std::function<void(const string&)> servoSender;
+
+    static OwlConfig quietConfig(bool quietMode)
+    {
+        OwlConfig config = OwlConfig::fromEnvironment();
+        config.quietMode = quietMode;
+        return config;
+    }
 
     int Rx, Ry, Lx, Ly, Neck;
     int RxC=1530, RyC=1455, LxC=1530, LyC=1540, NeckC=1520; //default calib values
@@ -199,6 +353,12 @@ private:
 
     //Send data over the TCP connection
     void sendPacket (string CMD){
+        if(externalServos)
+        {
+            if(servoSender)
+                servoSender(CMD);
+            return;
+        }
         char receivedCHARS[3] = {0,0,0}; // send 'ok' back
 
         int smsg=send(u_sock,CMD.c_str(),strlen(CMD.c_str()),0);
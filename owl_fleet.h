@@ -0,0 +1,557 @@
+#ifndef OWL_FLEET_H
+#define OWL_FLEET_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "owl.h"
+#include "stream_stats.h"
+
+#define FLEET_TIMING_WINDOW 64          //frames the per owl timing is averaged over
+#define FLEET_RECONNECT_MS 1000         //between attempts to reach a servo server or stream that is not up yet
+#define FLEET_FRAME_POOL_SIZE 4         //per owl: one being decoded, one being processed and spares
+#define FLEET_SELECT_TIMEOUT_MS 100     //the servo loop also wakes this often to retry connections
+
+//a fixed set of threads running tasks in the order they were queued
+class WorkerPool
+{
+public:
+    //0 threads means one per core
+    explicit WorkerPool(unsigned count = 0)
+    {
+        if(count == 0)
+            count = std::max(1u, std::thread::hardware_concurrency());
+        for(unsigned i = 0; i < count; i++)
+            threads.emplace_back(&WorkerPool::run, this);
+    }
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    ~WorkerPool() { stop(); }
+
+    void submit(std::function<void()> task)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+        taskReady.notify_one();
+    }
+
+    //runs what is still queued, then joins the threads
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        taskReady.notify_all();
+        for(std::thread& t : threads)
+            if(t.joinable())
+                t.join();
+    }
+
+    unsigned size() const { return unsigned(threads.size()); }
+
+private:
+    void run()
+    {
+        while(true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                taskReady.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if(tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable taskReady;
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+};
+
+//one thread carrying the servo traffic of every owl over non blocking sockets. the owl's server answers
+//every packet with "ok" before it reads the next, so a link has one packet in flight. packets sent while it
+//is waiting collapse into the newest, the servos only need to know where to be now, not every step on the way.
+//links are added before start(). select() limits a process to FD_SETSIZE (64 on Windows) links
+class OwlServoLoop
+{
+public:
+    OwlServoLoop()
+    {
+        WSAData version;
+        if(WSAStartup(MAKEWORD(2,2), &version) != 0)
+            cout<<"WinSock version is not supported! - "<<WSAGetLastError()<<endl;
+
+        //a datagram to ourselves wakes select() when a packet is queued
+        wakeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        addr.sin_port = 0;
+        int length = sizeof(wakeAddr);
+        if(wakeSocket == INVALID_SOCKET || bind(wakeSocket, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR
+           || getsockname(wakeSocket, (SOCKADDR*)&wakeAddr, &length) == SOCKET_ERROR) {
+            cout<<"Servo loop wake socket failed "<<WSAGetLastError()<<", packets wait for the next poll"<<endl;
+            if(wakeSocket != INVALID_SOCKET)
+                closesocket(wakeSocket);
+            wakeSocket = INVALID_SOCKET;
+        }
+        setNonBlocking(wakeSocket);
+    }
+    OwlServoLoop(const OwlServoLoop&) = delete;
+    OwlServoLoop& operator=(const OwlServoLoop&) = delete;
+
+    ~OwlServoLoop()
+    {
+        stop();
+        for(auto& link : links)
+            closeLink(*link);
+        if(wakeSocket != INVALID_SOCKET)
+            closesocket(wakeSocket);
+        WSACleanup();
+    }
+
+    //returns the id to send() to
+    int add(const string& host, int port)
+    {
+        std::unique_ptr<Link> link(new Link);
+        link->host = host;
+        link->port = port;
+        std::lock_guard<std::mutex> lock(mutex);
+        links.push_back(std::move(link));
+        return int(links.size()) - 1;
+    }
+
+    //queue a packet, it goes out as soon as the link is connected and the previous one was acknowledged
+    void send(int id, const string& packet)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Link& link = *links[size_t(id)];
+            if(link.hasPending)
+                link.coalesced++;
+            link.pending = packet;
+            link.hasPending = true;
+        }
+        wake();
+    }
+
+    void start()
+    {
+        running = true;
+        thread = std::thread(&OwlServoLoop::run, this);
+    }
+
+    void stop()
+    {
+        if(!running.exchange(false))
+            return;
+        wake();
+        if(thread.joinable())
+            thread.join();
+    }
+
+    //packets sent, packets that were replaced by a newer one before they went out and the round trip to "ok"
+    void report(std::ostream& out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto& link : links) {
+            out << std::left << std::setw(22) << (link->host + ":" + to_string(link->port)) << std::right
+                << std::setw(8) << link->sent << " sent" << std::setw(8) << link->coalesced << " coalesced"
+                << std::fixed << std::setprecision(2) << std::setw(8) << link->rttMs.mean() << " ms rtt"
+                << (link->state == Link::DISCONNECTED ? "  disconnected" : "") << "\n";
+        }
+        out << std::defaultfloat;
+    }
+
+private:
+    struct Link
+    {
+        enum State { DISCONNECTED, CONNECTING, IDLE, AWAITING_ACK };
+
+        string host;
+        int port = 0;
+        SOCKET socket = INVALID_SOCKET;
+        State state = DISCONNECTED;
+        std::chrono::steady_clock::time_point retryAt, sentAt;
+
+        string pending;                 //newest packet not sent yet
+        bool hasPending = false;
+        string inFlight;                //last packet sent, until it is acknowledged
+        string outgoing;                //what a full send buffer left of it
+        int ackBytes = 0;
+
+        uint64_t sent = 0, coalesced = 0;
+        WindowStats<double, FLEET_TIMING_WINDOW> rttMs;
+    };
+
+    static void setNonBlocking(SOCKET s)
+    {
+        u_long on = 1;
+        if(s != INVALID_SOCKET)
+            ioctlsocket(s, FIONBIO, &on);
+    }
+
+    void wake()
+    {
+        if(wakeSocket != INVALID_SOCKET)
+            sendto(wakeSocket, "w", 1, 0, (SOCKADDR*)&wakeAddr, sizeof(wakeAddr));
+    }
+
+    void connectLink(Link& link)
+    {
+        link.socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if(link.socket == INVALID_SOCKET) {
+            link.retryAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(FLEET_RECONNECT_MS);
+            return;
+        }
+        setNonBlocking(link.socket);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = inet_addr(link.host.c_str());
+        addr.sin_port = htons(u_short(link.port));
+        if(connect(link.socket, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) {
+            closeLink(link);
+            return;
+        }
+        link.state = Link::CONNECTING;
+    }
+
+    //retried after FLEET_RECONNECT_MS. a packet that was in flight goes out again unless a newer one is waiting
+    void closeLink(Link& link)
+    {
+        if(link.state == Link::AWAITING_ACK && !link.hasPending) {
+            link.pending = link.inFlight;
+            link.hasPending = true;
+        }
+        if(link.socket != INVALID_SOCKET)
+            closesocket(link.socket);
+        link.socket = INVALID_SOCKET;
+        link.state = Link::DISCONNECTED;
+        link.outgoing.clear();
+        link.ackBytes = 0;
+        link.retryAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(FLEET_RECONNECT_MS);
+    }
+
+    void transmit(Link& link)
+    {
+        if(link.outgoing.empty()) {
+            if(!link.hasPending)
+                return;
+            link.outgoing = link.inFlight = link.pending;
+            link.hasPending = false;
+            link.sentAt = std::chrono::steady_clock::now();
+            link.ackBytes = 0;
+            link.sent++;
+            link.state = Link::AWAITING_ACK;
+        }
+        int n = ::send(link.socket, link.outgoing.data(), int(link.outgoing.size()), 0);
+        if(n == SOCKET_ERROR) {
+            if(WSAGetLastError() != WSAEWOULDBLOCK) {
+                cout<<"Servo link "<<link.host<<":"<<link.port<<" send failed "<<WSAGetLastError()<<endl;
+                closeLink(link);
+            }
+            return;
+        }
+        link.outgoing.erase(0, size_t(n));
+    }
+
+    void receive(Link& link)
+    {
+        char reply[16];
+        int n = recv(link.socket, reply, sizeof(reply), 0);
+        if(n == 0 || (n == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK)) {
+            cout<<"Servo link "<<link.host<<":"<<link.port<<" closed"<<endl;
+            closeLink(link);
+            return;
+        }
+        if(n < 0 || link.state != Link::AWAITING_ACK)
+            return;
+        link.ackBytes += n;
+        if(link.ackBytes >= 2 && link.outgoing.empty()) {
+            link.rttMs.push(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - link.sentAt).count());
+            link.state = Link::IDLE;
+        }
+    }
+
+    void run()
+    {
+        while(running) {
+            fd_set readSet, writeSet, errorSet;
+            FD_ZERO(&readSet);
+            FD_ZERO(&writeSet);
+            FD_ZERO(&errorSet);
+            if(wakeSocket != INVALID_SOCKET)
+                FD_SET(wakeSocket, &readSet);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto now = std::chrono::steady_clock::now();
+                for(auto& l : links) {
+                    Link& link = *l;
+                    if(link.state == Link::DISCONNECTED && now >= link.retryAt)
+                        connectLink(link);
+                    if(link.state == Link::DISCONNECTED)
+                        continue;
+                    if(link.state == Link::CONNECTING) {
+                        //windows reports a failed connect as an exception, a successful one as writable
+                        FD_SET(link.socket, &writeSet);
+                        FD_SET(link.socket, &errorSet);
+                        continue;
+                    }
+                    FD_SET(link.socket, &readSet);
+                    if(!link.outgoing.empty())
+                        FD_SET(link.socket, &writeSet);
+                }
+            }
+
+            timeval timeout = {0, FLEET_SELECT_TIMEOUT_MS*1000};
+            if(select(0, &readSet, &writeSet, &errorSet, &timeout) == SOCKET_ERROR) {
+                //nothing to wait on makes winsock fail select, sleep instead
+                std::this_thread::sleep_for(std::chrono::milliseconds(FLEET_SELECT_TIMEOUT_MS));
+                continue;
+            }
+            if(wakeSocket != INVALID_SOCKET && FD_ISSET(wakeSocket, &readSet)) {
+                char drain[64];
+                while(recv(wakeSocket, drain, sizeof(drain), 0) > 0) {}
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for(auto& l : links) {
+                Link& link = *l;
+                if(link.socket == INVALID_SOCKET)
+                    continue;
+                if(link.state == Link::CONNECTING) {
+                    int error = 0;
+                    int length = sizeof(error);
+                    if(FD_ISSET(link.socket, &writeSet))
+                        getsockopt(link.socket, SOL_SOCKET, SO_ERROR, (char*)&error, &length);
+                    if(FD_ISSET(link.socket, &errorSet) || error != 0)
+                        closeLink(link);
+                    else if(FD_ISSET(link.socket, &writeSet)) {
+                        cout<<"Servo link "<<link.host<<":"<<link.port<<" connected"<<endl;
+                        link.state = Link::IDLE;
+                    }
+                }
+                else {
+                    if(FD_ISSET(link.socket, &readSet))
+                        receive(link);
+                    if(link.socket != INVALID_SOCKET && FD_ISSET(link.socket, &writeSet))
+                        transmit(link);
+                }
+                if(link.state == Link::IDLE)
+                    transmit(link);
+            }
+        }
+    }
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Link>> links;
+    SOCKET wakeSocket = INVALID_SOCKET;
+    sockaddr_in wakeAddr;
+    std::thread thread;
+    std::atomic<bool> running{false};
+};
+
+//many owls in one process. each owl has a thread that waits on its camera stream, one OwlServoLoop carries
+//the servo traffic of all of them and a shared WorkerPool decodes their frames and runs the vision.
+//an owl has at most one frame on the pool at a time, so its handler never runs concurrently with itself and
+//the pool's queue visits the owls round robin. a frame that arrives while the owl's previous one is still
+//being processed is skipped, so a slow owl runs at the rate its processing allows without holding up the rest.
+//OpenCV's own threading is switched off: with an owl per core the parallelism comes from working on several
+//owls at once, and a per call thread pool would only fight the workers for the same cores
+class OwlFleet
+{
+public:
+    //runs on a pool worker with the owl's decoded frame pair. the handler may move the owl's servos but not
+    //read its camera, the fleet does that
+    typedef std::function<void(robotOwl& owl, int index, Mat& left, Mat& right)> FrameHandler;
+
+    explicit OwlFleet(unsigned workers = 0) : pool(workers)
+    {
+        setNumThreads(0);
+    }
+    OwlFleet(const OwlFleet&) = delete;
+    OwlFleet& operator=(const OwlFleet&) = delete;
+    ~OwlFleet() { stop(); }
+
+    //connects the camera stream straight away, the servo link once start() runs. returns the owl's index
+    int add(OwlConfig config, const int centres[OWL_CALIB_ITEMS], FrameHandler handler)
+    {
+        std::unique_ptr<Member> member(new Member);
+        member->name = config.host + ":" + to_string(config.servoPort);
+        member->framePool.reset(new FramePool(Size(640*2, 480), CV_8UC3, FLEET_FRAME_POOL_SIZE));
+        config.framePool = member->framePool.get();
+        config.externalServos = true;
+        member->owl.reset(new robotOwl(config, centres[0], centres[1], centres[2], centres[3], centres[4]));
+        member->handler = handler;
+        if(!config.quietMode) {
+            int link = servos.add(config.host, config.servoPort);
+            member->owl->routeServoPackets([this, link](const string& packet) { servos.send(link, packet); });
+            //centre the servos as the owl's own connection would have, it goes out once the link is up
+            int Rx, Ry, Lx, Ly, Neck;
+            member->owl->getRawServoPositions(Rx, Ry, Lx, Ly, Neck);
+            member->owl->setServoRawPositions(Rx, Ry, Lx, Ly, Neck);
+        }
+        members.push_back(std::move(member));
+        return int(members.size()) - 1;
+    }
+
+    size_t size() const { return members.size(); }
+    unsigned workers() const { return pool.size(); }
+    robotOwl& owl(int index) { return *members[size_t(index)]->owl; }
+
+    void start()
+    {
+        started = std::chrono::steady_clock::now();
+        running = true;
+        servos.start();
+        for(size_t i = 0; i < members.size(); i++)
+            members[i]->grabber = std::thread(&OwlFleet::grabFrames, this, std::ref(*members[i]), int(i));
+    }
+
+    //safe to call from a handler
+    void requestStop()
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stopRequested = true;
+        stopCondition.notify_all();
+    }
+
+    void wait()
+    {
+        {
+            std::unique_lock<std::mutex> lock(stopMutex);
+            stopCondition.wait(lock, [this]() { return stopRequested; });
+        }
+        stop();
+    }
+
+    //a grabber blocked on a stalled stream holds this up until the capture times out
+    void stop()
+    {
+        if(!running.exchange(false))
+            return;
+        for(auto& member : members) {
+            std::lock_guard<std::mutex> lock(member->mutex);
+            member->retrieved.notify_all();
+        }
+        for(auto& member : members)
+            if(member->grabber.joinable())
+                member->grabber.join();
+        pool.stop();
+        servos.stop();
+    }
+
+    //per owl: frames processed per second, decode plus handler time, time spent queued for a worker and the
+    //frames skipped because the previous one was still in progress. then the servo links and the total
+    void report(std::ostream& out)
+    {
+        double seconds = std::max(1e-3, std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+        uint64_t total = 0;
+        for(auto& member : members) {
+            std::lock_guard<std::mutex> lock(member->mutex);
+            total += member->frames;
+            out << std::left << std::setw(22) << member->name << std::right << std::fixed << std::setprecision(2)
+                << std::setw(8) << member->frames/seconds << " fps" << std::setw(8) << member->ms.mean() << " ms +-"
+                << std::setw(6) << member->ms.stddev() << std::setw(8) << member->queuedMs.mean() << " ms queued"
+                << std::setw(8) << member->skipped << " skipped\n";
+        }
+        servos.report(out);
+        out << std::fixed << std::setprecision(2) << members.size() << " owls on " << pool.size() << " workers: "
+            << total/seconds << " fps in total\n" << std::defaultfloat;
+    }
+
+private:
+    struct Member
+    {
+        string name;
+        std::unique_ptr<FramePool> framePool;       //declared first so it outlives every frame below
+        std::unique_ptr<robotOwl> owl;
+        FrameHandler handler;
+        std::thread grabber;
+
+        std::mutex mutex;
+        std::condition_variable retrieved;
+        bool busy = false, decoded = false;
+        Mat left, right;
+
+        WindowStats<double, FLEET_TIMING_WINDOW> ms, queuedMs;
+        uint64_t frames = 0, skipped = 0;
+    };
+
+    //waiting on the stream is the only blocking I/O left per owl, so it keeps a thread of its own. the capture
+    //is not safe to use from two threads, the next grab waits until the worker has retrieved the last one
+    void grabFrames(Member& member, int index)
+    {
+        while(running) {
+            if(!member.owl->grabCameraFrames()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(FLEET_RECONNECT_MS));
+                if(running)
+                    member.owl->reconnectCamera();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(member.mutex);
+            if(member.busy) {
+                member.skipped++;
+                continue;
+            }
+            member.busy = true;
+            member.decoded = false;
+            auto queued = std::chrono::steady_clock::now();
+            pool.submit([this, &member, index, queued]() { process(member, index, queued); });
+            member.retrieved.wait(lock, [&]() { return member.decoded || !running; });
+        }
+    }
+
+    void process(Member& member, int index, std::chrono::steady_clock::time_point queued)
+    {
+        auto start = std::chrono::steady_clock::now();
+        member.owl->retrieveCameraFrames(member.left, member.right);
+        {
+            std::lock_guard<std::mutex> lock(member.mutex);
+            member.decoded = true;
+        }
+        member.retrieved.notify_one();
+
+        if(member.handler)
+            member.handler(*member.owl, index, member.left, member.right);
+
+        auto end = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(member.mutex);
+        member.ms.push(std::chrono::duration<double, std::milli>(end - start).count());
+        member.queuedMs.push(std::chrono::duration<double, std::milli>(start - queued).count());
+        member.frames++;
+        member.busy = false;
+    }
+
+    std::vector<std::unique_ptr<Member>> members;
+    OwlServoLoop servos;
+    WorkerPool pool;
+    std::atomic<bool> running{false};
+    std::chrono::steady_clock::time_point started;
+
+    std::mutex stopMutex;
+    std::condition_variable stopCondition;
+    bool stopRequested = false;
+};
+
+#endif // OWL_FLEET_H
@@ -0,0 +1,345 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "stream_stats.h"
+
+#define PIPELINE_QUEUE_DEPTH 2          //default room between two stages, enough to overlap neighbours
+#define PIPELINE_RECYCLE_LIMIT 8        //spare packets kept for reuse per recycler
+#define PIPELINE_TIMING_WINDOW 64       //frames the per stage timing is averaged over
+
+//what a full queue does with a new packet: live camera input wants the newest frame (DROP_OLDEST),
+//processing stages usually want every frame and slow the producer down instead (BLOCK)
+enum class QueuePolicy { DROP_OLDEST, BLOCK };
+
+//spare packets for reuse, so cv::Mat members keep their buffers instead of being reallocated every frame.
+//the last stage hands packets back, the first one takes them out again
+template <typename T>
+class Recycler
+{
+public:
+    explicit Recycler(size_t limit = PIPELINE_RECYCLE_LIMIT) : limit(limit) {}
+
+    T acquire()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(spare.empty())
+            return T();
+        T item = std::move(spare.back());
+        spare.pop_back();
+        return item;
+    }
+
+    void release(T&& item)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(spare.size() < limit)
+            spare.push_back(std::move(item));
+    }
+
+private:
+    size_t limit;
+    std::mutex mutex;
+    std::vector<T> spare;
+};
+
+//fixed size ring between one producer stage and one consumer stage. a mutex keeps it simple, at camera
+//frame rates the lock is never the bottleneck. close() wakes both sides and makes further pushes fail, pops
+//drain what is left first
+template <typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(size_t capacity, QueuePolicy policy, std::shared_ptr<Recycler<T>> recycler = nullptr)
+        : ring(std::max<size_t>(capacity, 1)), policy(policy), recycler(recycler) {}
+
+    //false once the queue is closed
+    bool push(T&& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if(policy == QueuePolicy::BLOCK)
+            notFull.wait(lock, [this]() { return closed || count < ring.size(); });
+        if(closed)
+            return false;
+        if(count == ring.size()) {
+            //drop the oldest, its buffers go back for reuse
+            T old = std::move(ring[head]);
+            head = (head + 1) % ring.size();
+            count--;
+            droppedCount++;
+            lock.unlock();
+            recycle(std::move(old));
+            lock.lock();
+        }
+        ring[(head + count) % ring.size()] = std::move(item);
+        count++;
+        notEmpty.notify_one();
+        return true;
+    }
+
+    //waits for a packet, false once the queue is closed and empty
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this]() { return closed || count > 0; });
+        if(count == 0)
+            return false;
+        item = std::move(ring[head]);
+        head = (head + 1) % ring.size();
+        count--;
+        notFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+    //hand a consumed packet back to whoever produced it
+    void recycle(T&& item)
+    {
+        if(recycler)
+            recycler->release(std::move(item));
+    }
+
+    std::shared_ptr<Recycler<T>> packetRecycler() const { return recycler; }
+    uint64_t dropped() const { return droppedCount; }
+
+private:
+    std::vector<T> ring;
+    size_t head = 0, count = 0;
+    QueuePolicy policy;
+    std::shared_ptr<Recycler<T>> recycler;
+    std::mutex mutex;
+    std::condition_variable notEmpty, notFull;
+    bool closed = false;
+    std::atomic<uint64_t> droppedCount{0};
+};
+
+//a chain of stages, each on its own thread and connected by bounded queues, so frame N+1 is captured while
+//frame N is still being processed and every stage gets a core of its own. stage functions return false to
+//drop the packet (a source returning false ends the stream). build the graph, start() it and wait() until a
+//stage calls requestStop() or the source runs dry; report() prints how long each stage takes per packet.
+class Pipeline
+{
+public:
+    ~Pipeline() { stop(); }
+
+    //first stage, fills a packet (recycled when possible) per call
+    template <typename T>
+    std::shared_ptr<BoundedQueue<T>> source(const std::string& name, std::function<bool(T&)> fn,
+                                           QueuePolicy policy = QueuePolicy::DROP_OLDEST,
+                                           size_t capacity = PIPELINE_QUEUE_DEPTH)
+    {
+        auto recycler = std::make_shared<Recycler<T>>();
+        auto output = std::make_shared<BoundedQueue<T>>(capacity, policy, recycler);
+        Stage& stage = addStage(name, [output]() { output->close(); }, [output]() { return output->dropped(); });
+        stage.body = [this, &stage, fn, output, recycler]() {
+            while(!stopping) {
+                T item = recycler->acquire();
+                auto start = std::chrono::steady_clock::now();
+                bool ok = fn(item);
+                stage.record(start, ok);
+                if(!ok || !output->push(std::move(item)))
+                    break;
+            }
+            output->close();
+        };
+        return output;
+    }
+
+    //stage that works on the packet in place and passes it on, buffers are recycled with the input's
+    template <typename T>
+    std::shared_ptr<BoundedQueue<T>> stage(const std::string& name, std::shared_ptr<BoundedQueue<T>> input,
+                                          std::function<bool(T&)> fn, QueuePolicy policy = QueuePolicy::BLOCK,
+                                          size_t capacity = PIPELINE_QUEUE_DEPTH)
+    {
+        auto output = std::make_shared<BoundedQueue<T>>(capacity, policy, input->packetRecycler());
+        Stage& stage = addStage(name, [output]() { output->close(); }, [output]() { return output->dropped(); });
+        stage.body = [&stage, fn, input, output]() {
+            T item;
+            while(input->pop(item)) {
+                auto start = std::chrono::steady_clock::now();
+                bool ok = fn(item);
+                stage.record(start, ok);
+                if(!ok)
+                    input->recycle(std::move(item));
+                else if(!output->push(std::move(item)))
+                    break;
+            }
+            output->close();
+        };
+        return output;
+    }
+
+    //stage that turns one packet type into another
+    template <typename In, typename Out>
+    std::shared_ptr<BoundedQueue<Out>> transform(const std::string& name, std::shared_ptr<BoundedQueue<In>> input,
+                                                std::function<bool(In&, Out&)> fn, QueuePolicy policy = QueuePolicy::BLOCK,
+                                                size_t capacity = PIPELINE_QUEUE_DEPTH)
+    {
+        auto recycler = std::make_shared<Recycler<Out>>();
+        auto output = std::make_shared<BoundedQueue<Out>>(capacity, policy, recycler);
+        Stage& stage = addStage(name, [output]() { output->close(); }, [output]() { return output->dropped(); });
+        stage.body = [&stage, fn, input, output, recycler]() {
+            In item;
+            while(input->pop(item)) {
+                Out result = recycler->acquire();
+                auto start = std::chrono::steady_clock::now();
+                bool ok = fn(item, result);
+                stage.record(start, ok);
+                input->recycle(std::move(item));
+                if(!ok)
+                    recycler->release(std::move(result));
+                else if(!output->push(std::move(result)))
+                    break;
+            }
+            output->close();
+        };
+        return output;
+    }
+
+    //last stage, consumed packets go back to the source for reuse
+    template <typename T>
+    void sink(const std::string& name, std::shared_ptr<BoundedQueue<T>> input, std::function<bool(T&)> fn)
+    {
+        Stage& stage = addStage(name, []() {}, []() { return uint64_t(0); });
+        stage.body = [this, &stage, fn, input]() {
+            T item;
+            while(input->pop(item)) {
+                auto start = std::chrono::steady_clock::now();
+                bool ok = fn(item);
+                stage.record(start, ok);
+                input->recycle(std::move(item));
+            }
+            requestStop();
+        };
+    }
+
+    void start()
+    {
+        for(auto& stage : stages)
+            stage->thread = std::thread(stage->body);
+    }
+
+    //ask every stage to finish, safe to call from inside a stage
+    void requestStop()
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stopRequested = true;
+        stopCondition.notify_all();
+    }
+
+    //block until requestStop() or the end of the stream, then shut the stages down
+    void wait()
+    {
+        {
+            std::unique_lock<std::mutex> lock(stopMutex);
+            stopCondition.wait(lock, [this]() { return stopRequested; });
+        }
+        stop();
+    }
+
+    //close every queue so blocked stages wake up, then join them
+    void stop()
+    {
+        stopping = true;
+        for(auto& stage : stages)
+            stage->closeOutput();
+        for(auto& stage : stages)
+            if(stage->thread.joinable())
+                stage->thread.join();
+    }
+
+    //mean and spread of the time per packet in each stage, how many it rejected and how many its output
+    //queue dropped. the slowest stage sets the frame rate
+    void report(std::ostream& out)
+    {
+        for(auto& stage : stages) {
+            std::lock_guard<std::mutex> lock(stage->timingMutex);
+            out << std::left << std::setw(12) << stage->name << std::right << std::fixed << std::setprecision(2)
+                << std::setw(8) << stage->ms.mean() << " ms +-" << std::setw(6) << stage->ms.stddev()
+                << std::setw(8) << stage->processed << " packets" << std::setw(6) << stage->rejected << " rejected"
+                << std::setw(6) << stage->dropped() << " dropped\n";
+        }
+        out << std::defaultfloat;
+    }
+
+    std::vector<std::string> stageNames() const
+    {
+        std::vector<std::string> names;
+        for(auto& stage : stages)
+            names.push_back(stage->name);
+        return names;
+    }
+
+    //the time each stage took for the packet it finished most recently, in stage order, for per frame telemetry
+    void lastStageTimes(float* ms, size_t count) const
+    {
+        for(size_t i = 0; i < count && i < stages.size(); i++) {
+            std::lock_guard<std::mutex> lock(stages[i]->timingMutex);
+            ms[i] = float(stages[i]->lastMs);
+        }
+    }
+
+private:
+    struct Stage
+    {
+        std::string name;
+        std::function<void()> body;
+        std::function<void()> closeOutput;
+        std::function<uint64_t()> dropped;
+        std::thread thread;
+
+        std::mutex timingMutex;
+        WindowStats<double, PIPELINE_TIMING_WINDOW> ms;
+        double lastMs = 0;
+        uint64_t processed = 0, rejected = 0;
+
+        void record(std::chrono::steady_clock::time_point start, bool ok)
+        {
+            double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::lock_guard<std::mutex> lock(timingMutex);
+            ms.push(elapsed);
+            lastMs = elapsed;
+            processed++;
+            rejected += !ok;
+        }
+    };
+
+    Stage& addStage(const std::string& name, std::function<void()> closeOutput, std::function<uint64_t()> dropped)
+    {
+        stages.emplace_back(new Stage);
+        Stage& stage = *stages.back();
+        stage.name = name;
+        stage.closeOutput = closeOutput;
+        stage.dropped = dropped;
+        return stage;
+    }
+
+    std::vector<std::unique_ptr<Stage>> stages;
+    std::atomic<bool> stopping{false};
+    std::mutex stopMutex;
+    std::condition_variable stopCondition;
+    bool stopRequested = false;
+};
+
+#endif // PIPELINE_H
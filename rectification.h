@@ -0,0 +1,305 @@
+#ifndef RECTIFICATION_H
+#define RECTIFICATION_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "fnv1a.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define RECT_CACHE_MAGIC 0x54434552   // "RECT"
+#define RECT_CACHE_VERSION 1
+#define RECT_CACHE_SUFFIX ".rectcache"
+#define RECT_ALPHA -1                 // stereoRectify free scaling, shared so every tool gets the same maps
+#define RECT_BAND_ROWS 16             // rows per band in the fused rectify, small enough to stay in cache
+
+//a read-only memory mapping of a whole file, unmapped when the last owner lets go
+class MappedFile
+{
+public:
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if(data) UnmapViewOfFile(data);
+        if(mapping) CloseHandle(mapping);
+        if(file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if(data) munmap(data, length);
+#endif
+    }
+
+    static std::shared_ptr<MappedFile> open(const std::string& path)
+    {
+        std::shared_ptr<MappedFile> mf(new MappedFile());
+#ifdef _WIN32
+        mf->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if(mf->file == INVALID_HANDLE_VALUE)
+            return nullptr;
+        LARGE_INTEGER size;
+        if(!GetFileSizeEx(mf->file, &size) || size.QuadPart == 0)
+            return nullptr;
+        mf->length = size_t(size.QuadPart);
+        mf->mapping = CreateFileMappingA(mf->file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(!mf->mapping)
+            return nullptr;
+        mf->data = MapViewOfFile(mf->mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            return nullptr;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return nullptr;
+        }
+        mf->length = size_t(st.st_size);
+        void* p = mmap(nullptr, mf->length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        mf->data = (p == MAP_FAILED) ? nullptr : p;
+#endif
+        return mf->data ? mf : nullptr;
+    }
+
+    const uint8_t* bytes() const { return static_cast<const uint8_t*>(data); }
+    size_t size() const { return length; }
+
+private:
+    MappedFile() {}
+    void* data = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#endif
+};
+
+//everything cv::remap and the 3D reprojection need for a rectified stereo pair
+struct StereoRectification
+{
+    cv::Size size;
+    cv::Mat map11, map12, map21, map22; //CV_16SC2 + CV_16UC1 maps per eye, read-only when they come from the cache
+    cv::Rect roi1, roi2;
+    cv::Mat Q;
+    std::shared_ptr<MappedFile> cache;  //keeps the mapped maps alive
+};
+
+//fixed size block at the start of a cache file, the maps follow it in the order map11, map12, map21, map22
+struct RectCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;
+    int32_t width, height;
+    int32_t roi1[4], roi2[4];
+    double Q[16];
+    uint8_t padding[8];    //keeps the maps 64 byte aligned
+};
+static_assert(sizeof(RectCacheHeader) % 64 == 0, "cache header must keep the maps aligned");
+
+inline bool readFileBytes(const std::string& path, std::vector<char>& bytes)
+{
+    std::ifstream file(path, std::ios::binary);
+    if(!file.is_open())
+        return false;
+    bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+//key for the cache: both calibration files, the image size and the rectification settings
+inline bool rectificationKey(const std::string& intrinsics, const std::string& extrinsics, cv::Size size, uint64_t& hash)
+{
+    std::vector<char> bytes;
+    hash = fnv1a(nullptr, 0);
+    if(!readFileBytes(intrinsics, bytes))
+        return false;
+    hash = fnv1a(bytes.data(), bytes.size(), hash);
+    if(!readFileBytes(extrinsics, bytes))
+        return false;
+    hash = fnv1a(bytes.data(), bytes.size(), hash);
+    int32_t settings[4] = {size.width, size.height, RECT_ALPHA, RECT_CACHE_VERSION};
+    hash = fnv1a(settings, sizeof(settings), hash);
+    return true;
+}
+
+inline size_t rectMapBytes(cv::Size size)
+{
+    //one CV_16SC2 map (4 bytes/pixel) and one CV_16UC1 map (2 bytes/pixel) per eye
+    return size_t(size.area())*(4 + 2)*2;
+}
+
+inline bool loadRectificationCache(const std::string& path, uint64_t hash, cv::Size size, StereoRectification& rect)
+{
+    std::shared_ptr<MappedFile> mf = MappedFile::open(path);
+    if(!mf || mf->size() != sizeof(RectCacheHeader) + rectMapBytes(size))
+        return false;
+
+    RectCacheHeader header;
+    memcpy(&header, mf->bytes(), sizeof(header));
+    if(header.magic != RECT_CACHE_MAGIC || header.version != RECT_CACHE_VERSION || header.hash != hash
+            || header.width != size.width || header.height != size.height)
+        return false;
+
+    uchar* maps = const_cast<uchar*>(mf->bytes() + sizeof(RectCacheHeader));
+    size_t xy = size_t(size.area())*4, interp = size_t(size.area())*2;
+    rect.map11 = cv::Mat(size, CV_16SC2, maps);
+    rect.map12 = cv::Mat(size, CV_16UC1, maps + xy);
+    rect.map21 = cv::Mat(size, CV_16SC2, maps + xy + interp);
+    rect.map22 = cv::Mat(size, CV_16UC1, maps + xy*2 + interp);
+    rect.roi1 = cv::Rect(header.roi1[0], header.roi1[1], header.roi1[2], header.roi1[3]);
+    rect.roi2 = cv::Rect(header.roi2[0], header.roi2[1], header.roi2[2], header.roi2[3]);
+    rect.Q = cv::Mat(4, 4, CV_64F, header.Q).clone();
+    rect.size = size;
+    rect.cache = mf;
+    return true;
+}
+
+inline void saveRectificationCache(const std::string& path, uint64_t hash, const StereoRectification& rect)
+{
+    RectCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = RECT_CACHE_MAGIC;
+    header.version = RECT_CACHE_VERSION;
+    header.hash = hash;
+    header.width = rect.size.width;
+    header.height = rect.size.height;
+    int32_t roi1[4] = {rect.roi1.x, rect.roi1.y, rect.roi1.width, rect.roi1.height};
+    int32_t roi2[4] = {rect.roi2.x, rect.roi2.y, rect.roi2.width, rect.roi2.height};
+    memcpy(header.roi1, roi1, sizeof(roi1));
+    memcpy(header.roi2, roi2, sizeof(roi2));
+    cv::Mat Q64;
+    rect.Q.convertTo(Q64, CV_64F);
+    memcpy(header.Q, Q64.ptr<double>(), sizeof(header.Q));
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if(!file.is_open()) {
+        std::cout << "could not write rectification cache: " << path << std::endl;
+        return;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    const cv::Mat* maps[4] = {&rect.map11, &rect.map12, &rect.map21, &rect.map22};
+    for(const cv::Mat* m : maps) {
+        cv::Mat c = m->isContinuous() ? *m : m->clone();
+        file.write(reinterpret_cast<const char*>(c.data), std::streamsize(c.total()*c.elemSize()));
+    }
+}
+
+//load the rectification maps for a calibrated pair. the maps are memory-mapped from a binary cache next to the
+//extrinsics file when the calibration has not changed, otherwise they are computed and the cache is rewritten.
+//calibrated is the image size the intrinsics were found at, when size differs the camera matrices are scaled to
+//match. maps at any size other than the tools' own should pass useCache false so the shared cache is left alone.
+inline bool loadRectification(const std::string& intrinsics, const std::string& extrinsics, cv::Size size, StereoRectification& rect,
+                              bool useCache = true, cv::Size calibrated = cv::Size())
+{
+    uint64_t hash;
+    if(!rectificationKey(intrinsics, extrinsics, size, hash)) {
+        printf("Failed to open file %s or %s\n", intrinsics.c_str(), extrinsics.c_str());
+        return false;
+    }
+    std::string cache_path = extrinsics + RECT_CACHE_SUFFIX;
+    if(useCache && loadRectificationCache(cache_path, hash, size, rect))
+        return true;
+
+    cv::FileStorage fs(intrinsics, cv::FileStorage::READ);
+    if(!fs.isOpened()) {
+        printf("Failed to open file %s\n", intrinsics.c_str());
+        return false;
+    }
+    cv::Mat M1, D1, M2, D2;
+    fs["M1"] >> M1;
+    fs["D1"] >> D1;
+    fs["M2"] >> M2;
+    fs["D2"] >> D2;
+    if(calibrated.area() > 0 && calibrated != size) {
+        //focal lengths and principal points scale with the image, distortion does not
+        double sx = double(size.width)/calibrated.width, sy = double(size.height)/calibrated.height;
+        for(cv::Mat* M : {&M1, &M2}) {
+            M->convertTo(*M, CV_64F);
+            cv::Mat fx = M->row(0), fy = M->row(1);
+            fx *= sx;
+            fy *= sy;
+        }
+    }
+
+    fs.open(extrinsics, cv::FileStorage::READ);
+    if(!fs.isOpened()) {
+        printf("Failed to open file %s\n", extrinsics.c_str());
+        return false;
+    }
+    cv::Mat R, T, R1, P1, R2, P2;
+    fs["R"] >> R;
+    fs["T"] >> T;
+
+    stereoRectify(M1, D1, M2, D2, size, R, T, R1, R2, P1, P2, rect.Q, cv::CALIB_ZERO_DISPARITY, RECT_ALPHA, size, &rect.roi1, &rect.roi2);
+    initUndistortRectifyMap(M1, D1, R1, P1, size, CV_16SC2, rect.map11, rect.map12);
+    initUndistortRectifyMap(M2, D2, R2, P2, size, CV_16SC2, rect.map21, rect.map22);
+    rect.size = size;
+    rect.cache.reset();
+
+    if(useCache)
+        saveRectificationCache(cache_path, hash, rect);
+    return true;
+}
+
+//rectify a BGR image straight to greyscale. each band of output rows is remapped into a small colour buffer
+//that stays in cache and converted to grey from there, so the full size colour result is never written out.
+//bands run in parallel.
+inline void rectifyGrey(const cv::Mat& src, cv::Mat& dst, const cv::Mat& map1, const cv::Mat& map2)
+{
+    CV_Assert(map1.size() == map2.size());
+    if(src.channels() == 1) {
+        cv::remap(src, dst, map1, map2, cv::INTER_LINEAR);
+        return;
+    }
+    CV_Assert(src.data != dst.data);
+    dst.create(map1.size(), CV_8UC1);
+    const int bands = (map1.rows + RECT_BAND_ROWS - 1)/RECT_BAND_ROWS;
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+        cv::Mat colour;
+        for(int b = range.start; b < range.end; b++) {
+            cv::Range rows(b*RECT_BAND_ROWS, std::min(map1.rows, (b + 1)*RECT_BAND_ROWS));
+            //the maps hold absolute source coordinates, so a band of them remaps a band of the output
+            cv::remap(src, colour, map1.rowRange(rows), map2.rowRange(rows), cv::INTER_LINEAR);
+            cv::Mat out = dst.rowRange(rows);
+            cv::cvtColor(colour, out, cv::COLOR_BGR2GRAY);
+        }
+    });
+}
+
+//rectify both eyes for matching. the colour images are only rectified when something is going to show them
+inline void rectifyPair(const cv::Mat& left, const cv::Mat& right, const StereoRectification& rect,
+                        cv::Mat& grey_left, cv::Mat& grey_right, cv::Mat* colour_left = nullptr, cv::Mat* colour_right = nullptr)
+{
+    if(colour_left && colour_right) {
+        cv::remap(left, *colour_left, rect.map11, rect.map12, cv::INTER_LINEAR);
+        cv::remap(right, *colour_right, rect.map21, rect.map22, cv::INTER_LINEAR);
+        cv::cvtColor(*colour_left, grey_left, cv::COLOR_BGR2GRAY);
+        cv::cvtColor(*colour_right, grey_right, cv::COLOR_BGR2GRAY);
+        return;
+    }
+    rectifyGrey(left, grey_left, rect.map11, rect.map12);
+    rectifyGrey(right, grey_right, rect.map21, rect.map22);
+}
+
+#endif // RECTIFICATION_H
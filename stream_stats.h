@@ -0,0 +1,205 @@
+#ifndef STREAM_STATS_H
+#define STREAM_STATS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+// streaming statistics over the last N samples, every push is O(1) (the median is O(log N) + a short memmove).
+// each filter takes an inclusive valid range, samples outside it (and NaN) are ignored instead of being averaged in,
+// e.g. WindowStats<short, 16> disparity(1) drops the zero/negative values SGBM uses for "no match".
+
+// picks a wide accumulator so sums of small integer types cannot overflow
+template <typename T>
+struct StatsAccumulator {
+    typedef typename std::conditional<std::is_integral<T>::value, int64_t, double>::type type;
+};
+
+// valid range check shared by all filters, written so NaN fails both comparisons
+template <typename T>
+class ValidRange {
+public:
+    ValidRange(T lo, T hi) : lo_(lo), hi_(hi) {}
+    bool operator()(T value) const { return value >= lo_ && value <= hi_; }
+private:
+    T lo_, hi_;
+};
+
+// sliding window mean, variance, min and max
+template <typename T, size_t N>
+class WindowStats {
+public:
+    explicit WindowStats(T valid_min = std::numeric_limits<T>::lowest(), T valid_max = std::numeric_limits<T>::max())
+        : valid_(valid_min, valid_max) {
+        static_assert(std::is_arithmetic<T>::value, "must be built-in arithmetic type.");
+        static_assert(N > 0, "N must be greater than 0");
+        clear();
+    }
+    // returns false if the sample was rejected as invalid
+    bool push(T value) {
+        if (!valid_(value)) {
+            return false;
+        }
+        if (full()) {
+            Acc old = Acc(buf_[head_]);
+            sum_ -= old;
+            sum_sq_ -= old*old;
+        } else {
+            count_++;
+        }
+        buf_[head_] = value;
+        sum_ += Acc(value);
+        sum_sq_ += Acc(value)*Acc(value);
+        head_ = (head_+1) % N;
+
+        // floating point sums drift as samples are added and removed, rebuild them once per few windows
+        if (std::is_floating_point<T>::value && ++pushes_ >= 4*N) {
+            resync();
+        }
+        return true;
+    }
+    double mean() const {
+        return count_ ? double(sum_)/count_ : 0.;
+    }
+    double variance() const {
+        if (count_ < 2) {
+            return 0.;
+        }
+        double m = mean();
+        return std::max(0., (double(sum_sq_) - count_*m*m)/(count_ - 1));
+    }
+    double stddev() const {
+        return std::sqrt(variance());
+    }
+    size_t count() const {
+        return count_;
+    }
+    bool full() const {
+        return count_ >= N;
+    }
+    void clear() {
+        memset(buf_, 0, N*sizeof(T));
+        head_ = count_ = pushes_ = 0;
+        sum_ = sum_sq_ = 0;
+    }
+private:
+    typedef typename StatsAccumulator<T>::type Acc;
+
+    void resync() {
+        sum_ = sum_sq_ = 0;
+        for (size_t i = 0; i < count_; i++) {
+            sum_ += Acc(buf_[i]);
+            sum_sq_ += Acc(buf_[i])*Acc(buf_[i]);
+        }
+        pushes_ = 0;
+    }
+
+    ValidRange<T> valid_;
+    T buf_[N];
+    size_t head_, count_, pushes_;
+    Acc sum_, sum_sq_;
+};
+
+// sliding window median. the window is kept sorted next to the ring buffer, so the median is just indexed;
+// a push is two binary searches plus a memmove of at most N elements and never allocates.
+template <typename T, size_t N>
+class WindowMedian {
+public:
+    explicit WindowMedian(T valid_min = std::numeric_limits<T>::lowest(), T valid_max = std::numeric_limits<T>::max())
+        : valid_(valid_min, valid_max) {
+        static_assert(std::is_arithmetic<T>::value, "must be built-in arithmetic type.");
+        static_assert(N > 0, "N must be greater than 0");
+        clear();
+    }
+    bool push(T value) {
+        if (!valid_(value)) {
+            return false;
+        }
+        if (full()) {
+            T* old = std::lower_bound(sorted_, sorted_ + count_, buf_[head_]);
+            memmove(old, old + 1, size_t(sorted_ + count_ - old - 1)*sizeof(T));
+            count_--;
+        }
+        T* pos = std::upper_bound(sorted_, sorted_ + count_, value);
+        memmove(pos + 1, pos, size_t(sorted_ + count_ - pos)*sizeof(T));
+        *pos = value;
+        count_++;
+
+        buf_[head_] = value;
+        head_ = (head_+1) % N;
+        return true;
+    }
+    double median() const {
+        if (count_ == 0) {
+            return 0.;
+        }
+        if (count_ % 2) {
+            return double(sorted_[count_/2]);
+        }
+        return (double(sorted_[count_/2 - 1]) + double(sorted_[count_/2]))/2.;
+    }
+    // q in [0, 1], nearest rank
+    T quantile(double q) const {
+        if (count_ == 0) {
+            return T(0);
+        }
+        size_t i = size_t(std::min(1., std::max(0., q))*(count_ - 1) + 0.5);
+        return sorted_[i];
+    }
+    size_t count() const {
+        return count_;
+    }
+    bool full() const {
+        return count_ >= N;
+    }
+    void clear() {
+        memset(buf_, 0, N*sizeof(T));
+        memset(sorted_, 0, N*sizeof(T));
+        head_ = count_ = 0;
+    }
+private:
+    ValidRange<T> valid_;
+    T buf_[N];
+    T sorted_[N];
+    size_t head_, count_;
+};
+
+// exponential moving average, alpha is the weight of the newest sample
+template <typename T>
+class ExponentialAverage {
+public:
+    explicit ExponentialAverage(double alpha, T valid_min = std::numeric_limits<T>::lowest(),
+                                T valid_max = std::numeric_limits<T>::max())
+        : alpha_(alpha), valid_(valid_min, valid_max) {
+        static_assert(std::is_arithmetic<T>::value, "must be built-in arithmetic type.");
+    }
+    bool push(T value) {
+        if (!valid_(value)) {
+            return false;
+        }
+        value_ = count_ ? value_ + alpha_*(double(value) - value_) : double(value);
+        count_++;
+        return true;
+    }
+    double value() const {
+        return value_;
+    }
+    size_t count() const {
+        return count_;
+    }
+    void clear() {
+        value_ = 0.;
+        count_ = 0;
+    }
+private:
+    double alpha_;
+    ValidRange<T> valid_;
+    double value_ = 0.;
+    size_t count_ = 0;
+};
+
+#endif // STREAM_STATS_H
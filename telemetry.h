@@ -0,0 +1,287 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define TELEMETRY_MAGIC 0x4d4c4554      // "TELM"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_CAPACITY 1024         //records kept, half a minute of frames at 30fps
+#define TELEMETRY_STAGES 8              //stage timings per record
+#define TELEMETRY_NAME_LEN 16
+#define TELEMETRY_SERVOS 5              //raw Rx Ry Lx Ly Neck
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the telemetry ring needs lock free 64 bit atomics");
+
+//one frame of a tool. fields a tool does not measure stay at their defaults
+struct TelemetryRecord
+{
+    uint64_t frameId = 0;
+    int64_t timeUs = 0;                         //steady clock, comparable between tools on one machine
+    float stageMs[TELEMETRY_STAGES] = {};       //named in the ring header, in pipeline order
+    int32_t servos[TELEMETRY_SERVOS] = {};
+    float confidence = -1;                      //0 to 1, negative if the tool has no tracker
+    float distance = -1;                        //mm, negative if the tool does not measure one
+};
+
+struct TelemetryHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t stageCount;
+    char tool[TELEMETRY_NAME_LEN];
+    char stageNames[TELEMETRY_STAGES][TELEMETRY_NAME_LEN];
+    std::atomic<uint64_t> published;            //records written since the tool started
+};
+
+//a record with its sequence number. odd while the writer is in the middle of it, 2n + 2 once record n is
+//complete, so a reader can tell a torn or overwritten copy from a good one
+struct TelemetrySlot
+{
+    std::atomic<uint64_t> sequence;
+    TelemetryRecord record;
+};
+
+inline int64_t telemetryNowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline std::string telemetryMappingName(const std::string& tool)
+{
+#ifdef _WIN32
+    return "Local\\owl_telemetry_" + tool;
+#else
+    return "/owl_telemetry_" + tool;
+#endif
+}
+
+inline size_t telemetryBytes(uint32_t capacity)
+{
+    return sizeof(TelemetryHeader) + size_t(capacity)*sizeof(TelemetrySlot);
+}
+
+//a named shared memory block, read-write for the tool that owns it, read-only for everyone else
+class SharedMemory
+{
+public:
+    SharedMemory() {}
+    SharedMemory(const SharedMemory&) = delete;
+    SharedMemory& operator=(const SharedMemory&) = delete;
+    ~SharedMemory() { close(); }
+
+    bool create(const std::string& name, size_t bytes)
+    {
+        close();
+        length = bytes;
+#ifdef _WIN32
+        mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, DWORD(uint64_t(bytes) >> 32), DWORD(bytes), name.c_str());
+        if(!mapping)
+            return false;
+        data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+#else
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+        if(fd < 0)
+            return false;
+        if(ftruncate(fd, off_t(bytes)) != 0) {
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        data = (p == MAP_FAILED) ? nullptr : p;
+#endif
+        return data != nullptr;
+    }
+
+    bool open(const std::string& name)
+    {
+        close();
+#ifdef _WIN32
+        mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+        if(!mapping)
+            return false;
+        data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        MEMORY_BASIC_INFORMATION info;
+        if(data && VirtualQuery(data, &info, sizeof(info)))
+            length = info.RegionSize;
+#else
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if(fd < 0)
+            return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        length = size_t(st.st_size);
+        void* p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        data = (p == MAP_FAILED) ? nullptr : p;
+#endif
+        return data != nullptr;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if(data) UnmapViewOfFile(data);
+        if(mapping) CloseHandle(mapping);
+        mapping = NULL;
+#else
+        if(data) munmap(data, length);
+#endif
+        data = nullptr;
+        length = 0;
+    }
+
+    void* bytes() const { return data; }
+    size_t size() const { return length; }
+
+private:
+    void* data = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE mapping = NULL;
+#endif
+};
+
+//the producing side, one per tool. publish() is wait-free: it never takes a lock and never waits for a
+//reader, a reader that falls behind just loses the oldest records. the ring is named after the tool, so a
+//viewer finds it without any set up. if the mapping cannot be created publish() does nothing
+class TelemetryWriter
+{
+public:
+    bool open(const std::string& tool, const std::vector<std::string>& stages, uint32_t capacity = TELEMETRY_CAPACITY)
+    {
+        if(!memory.create(telemetryMappingName(tool), telemetryBytes(capacity))) {
+            header = nullptr;
+            return false;
+        }
+        header = static_cast<TelemetryHeader*>(memory.bytes());
+        slots = reinterpret_cast<TelemetrySlot*>(header + 1);
+        //a reader may still have the ring of a previous run mapped, it notices published going backwards
+        header->published.store(0, std::memory_order_release);
+        header->magic = TELEMETRY_MAGIC;
+        header->version = TELEMETRY_VERSION;
+        header->capacity = capacity;
+        header->stageCount = uint32_t(std::min<size_t>(stages.size(), TELEMETRY_STAGES));
+        std::memset(header->tool, 0, sizeof(header->tool));
+        std::strncpy(header->tool, tool.c_str(), TELEMETRY_NAME_LEN - 1);
+        std::memset(header->stageNames, 0, sizeof(header->stageNames));
+        for(uint32_t i = 0; i < header->stageCount; i++)
+            std::strncpy(header->stageNames[i], stages[i].c_str(), TELEMETRY_NAME_LEN - 1);
+        for(uint32_t i = 0; i < capacity; i++)
+            slots[i].sequence.store(0, std::memory_order_relaxed);
+        next = 0;
+        return true;
+    }
+
+    bool isOpen() const { return header != nullptr; }
+
+    //stamps the frame time if the caller did not
+    void publish(TelemetryRecord record)
+    {
+        if(!header)
+            return;
+        if(record.timeUs == 0)
+            record.timeUs = telemetryNowUs();
+        TelemetrySlot& slot = slots[next % header->capacity];
+        slot.sequence.store(2*next + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(&slot.record, &record, sizeof(record));
+        slot.sequence.store(2*next + 2, std::memory_order_release);
+        next++;
+        header->published.store(next, std::memory_order_release);
+    }
+
+private:
+    SharedMemory memory;
+    TelemetryHeader* header = nullptr;
+    TelemetrySlot* slots = nullptr;
+    uint64_t next = 0;
+};
+
+//the consuming side. it only ever reads the shared memory, so any number of readers can watch one tool
+class TelemetryReader
+{
+public:
+    bool open(const std::string& tool)
+    {
+        header = nullptr;
+        if(!memory.open(telemetryMappingName(tool)))
+            return false;
+        const TelemetryHeader* h = static_cast<const TelemetryHeader*>(memory.bytes());
+        if(memory.size() < sizeof(TelemetryHeader) || h->magic != TELEMETRY_MAGIC || h->version != TELEMETRY_VERSION
+           || memory.size() < telemetryBytes(h->capacity))
+            return false;
+        header = h;
+        slots = reinterpret_cast<const TelemetrySlot*>(header + 1);
+        //start from the oldest record still in the ring
+        uint64_t published = header->published.load(std::memory_order_acquire);
+        cursor = published > header->capacity ? published - header->capacity : 0;
+        return true;
+    }
+
+    bool isOpen() const { return header != nullptr; }
+    const TelemetryHeader& info() const { return *header; }
+
+    //append the records published since the last call, oldest first. returns how many were lost because the
+    //writer overwrote them before they were read
+    uint64_t poll(std::vector<TelemetryRecord>& records)
+    {
+        if(!header)
+            return 0;
+        uint64_t published = header->published.load(std::memory_order_acquire);
+        if(published < cursor)  //the tool restarted
+            cursor = 0;
+        uint64_t lost = 0;
+        if(published - cursor > header->capacity) {
+            lost += published - header->capacity - cursor;
+            cursor = published - header->capacity;
+        }
+        for(; cursor < published; cursor++) {
+            const TelemetrySlot& slot = slots[cursor % header->capacity];
+            uint64_t before = slot.sequence.load(std::memory_order_acquire);
+            if(before != 2*cursor + 2) {
+                lost++;
+                continue;
+            }
+            TelemetryRecord record;
+            std::memcpy(&record, &slot.record, sizeof(record));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(slot.sequence.load(std::memory_order_relaxed) != before) {
+                lost++;
+                continue;
+            }
+            records.push_back(record);
+        }
+        return lost;
+    }
+
+private:
+    SharedMemory memory;
+    const TelemetryHeader* header = nullptr;
+    const TelemetrySlot* slots = nullptr;
+    uint64_t cursor = 0;
+};
+
+#endif // TELEMETRY_H